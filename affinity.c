@@ -0,0 +1,209 @@
+/* affinity.c
+ * Write IRQ affinity. The procfs write is synchronous: the kernel
+ * changes affinity within write(). So the batch of writes is spread
+ * among the worker threads. The calling thread processes jobs too and
+ * returns when all the jobs are done. The workers are created on first
+ * big batch and live until affinity_pool_free().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "irq.h"
+#include "path.h"
+#include "affinity.h"
+
+struct affinity_pool_s {
+	pthread_t threads[AFFINITY_WORKERS];
+	pthread_mutex_t mutex;
+	pthread_cond_t work; /* New batch or stop */
+	pthread_cond_t done; /* All jobs of batch are done */
+	affinity_job_t *jobs;
+	unsigned int num;
+	unsigned int next; /* Next job to take */
+	unsigned int finished; /* Number of done jobs */
+	unsigned long long batch; /* Batch sequence number */
+	int stop;
+};
+typedef struct affinity_pool_s affinity_pool_t;
+
+static affinity_pool_t *pool = NULL;
+static int list_files = 1; /* Kernel has smp_affinity_list files */
+
+/*--------------------------------------------------------- */
+/* Write string to file. Returns 0 or errno. The O_TRUNC is like
+   shell's "echo 3 > smp_affinity_list". Procfs ignores it but the
+   file of fake tree can become shorter. */
+static int write_str(const char *path, const char *str)
+{
+	size_t len = strlen(str);
+	ssize_t ret;
+	int f;
+	int err = 0;
+
+	if ((f = open(path, O_WRONLY | O_TRUNC)) < 0)
+		return errno;
+	ret = write(f, str, len);
+	if (ret < 0)
+		err = errno;
+	else if ((size_t)ret != len)
+		err = EIO;
+	close(f);
+
+	return err;
+}
+
+/*--------------------------------------------------------- */
+/* Write CPU list to /proc/irq/<irq>/smp_affinity_list. The list is
+   short and doesn't depend on NR_CPUS. The old kernels have no such
+   file so the hex mask is written to smp_affinity. Returns 0 or errno. */
+int affinity_write(unsigned int irq, const char *list, const char *mask)
+{
+	char path[PATH_MAX];
+	int err;
+
+	if (__atomic_load_n(&list_files, __ATOMIC_RELAXED)) {
+		path_build(path, sizeof(path), "%s/%u/smp_affinity_list",
+			PROC_IRQ, irq);
+		if ((err = write_str(path, list)) != ENOENT)
+			return err;
+	}
+	path_build(path, sizeof(path), "%s/%u/smp_affinity", PROC_IRQ, irq);
+	/* The IRQ exists but list file doesn't. Don't try it anymore. */
+	if (!(err = write_str(path, mask)))
+		__atomic_store_n(&list_files, 0, __ATOMIC_RELAXED);
+
+	return err;
+}
+
+/*--------------------------------------------------------- */
+/* Take and do jobs of current batch. Called with mutex locked. */
+static void pool_work(affinity_pool_t *p)
+{
+	while (p->next < p->num) {
+		affinity_job_t *job = &p->jobs[p->next++];
+		pthread_mutex_unlock(&p->mutex);
+		job->err = affinity_write(job->irq, job->list, job->mask);
+		pthread_mutex_lock(&p->mutex);
+		if (++p->finished == p->num)
+			pthread_cond_broadcast(&p->done);
+	}
+}
+
+/*--------------------------------------------------------- */
+static void *worker(void *arg)
+{
+	affinity_pool_t *p = (affinity_pool_t *)arg;
+	unsigned long long batch = 0;
+
+	pthread_mutex_lock(&p->mutex);
+	while (1) {
+		while (!p->stop && (p->batch == batch))
+			pthread_cond_wait(&p->work, &p->mutex);
+		if (p->stop)
+			break;
+		batch = p->batch;
+		pool_work(p);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+/*--------------------------------------------------------- */
+static affinity_pool_t *pool_new(void)
+{
+	affinity_pool_t *p;
+	int i;
+
+	if (!(p = calloc(1, sizeof(*p))))
+		return NULL;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	for (i = 0; i < AFFINITY_WORKERS; i++) {
+		if (pthread_create(&p->threads[i], NULL, worker, p) != 0)
+			break;
+	}
+	/* Can't create threads. The batch will be done serially. */
+	if (i < AFFINITY_WORKERS) {
+		pthread_mutex_lock(&p->mutex);
+		p->stop = 1;
+		pthread_cond_broadcast(&p->work);
+		pthread_mutex_unlock(&p->mutex);
+		while (i--)
+			pthread_join(p->threads[i], NULL);
+		pthread_cond_destroy(&p->done);
+		pthread_cond_destroy(&p->work);
+		pthread_mutex_destroy(&p->mutex);
+		free(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+/*--------------------------------------------------------- */
+void affinity_pool_free(void)
+{
+	int i;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 0; i < AFFINITY_WORKERS; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+	pool = NULL;
+}
+
+/*--------------------------------------------------------- */
+/* Write all the jobs. The result of each job is in job->err.
+   Returns number of failed jobs. */
+int affinity_write_batch(affinity_job_t *jobs, unsigned int num)
+{
+	unsigned int i;
+	int failed = 0;
+
+	if ((num >= AFFINITY_BATCH_MIN) && !pool)
+		pool = pool_new();
+
+	if ((num < AFFINITY_BATCH_MIN) || !pool) {
+		for (i = 0; i < num; i++)
+			jobs[i].err = affinity_write(jobs[i].irq,
+				jobs[i].list, jobs[i].mask);
+	} else {
+		pthread_mutex_lock(&pool->mutex);
+		pool->jobs = jobs;
+		pool->num = num;
+		pool->next = 0;
+		pool->finished = 0;
+		pool->batch++;
+		pthread_cond_broadcast(&pool->work);
+		pool_work(pool);
+		while (pool->finished < pool->num)
+			pthread_cond_wait(&pool->done, &pool->mutex);
+		pool->jobs = NULL;
+		pool->num = 0;
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (jobs[i].err)
+			failed++;
+	}
+
+	return failed;
+}
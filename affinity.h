@@ -0,0 +1,22 @@
+#ifndef _affinity_h
+#define _affinity_h
+
+/* Batched writes of smp_affinity_list (or smp_affinity) files. The batch is processed by
+   the pool of worker threads together with calling thread. */
+
+#define AFFINITY_WORKERS 4 /* Number of worker threads */
+#define AFFINITY_BATCH_MIN 32 /* Smaller batches are written serially */
+
+struct affinity_job_s {
+	unsigned int irq;
+	const char *list; /* String to write to smp_affinity_list */
+	const char *mask; /* String to write to smp_affinity */
+	int err; /* Result: 0 or errno */
+};
+typedef struct affinity_job_s affinity_job_t;
+
+int affinity_write(unsigned int irq, const char *list, const char *mask);
+int affinity_write_batch(affinity_job_t *jobs, unsigned int num);
+void affinity_pool_free(void);
+
+#endif
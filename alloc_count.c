@@ -0,0 +1,41 @@
+/* alloc_count.c
+ * Allocation counter for birq-bench. The glibc's allocation functions
+ * are replaced by the wrappers so the allocations made by libc itself
+ * (fopen(), getline() etc.) are counted too. The daemon is not linked
+ * with this file.
+ */
+
+#include <stdlib.h>
+
+#include "overhead.h"
+
+static unsigned long long allocs = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+unsigned long long overhead_allocs(void)
+{
+	return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
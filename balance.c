@@ -12,26 +12,68 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h> /* open, write */
+#include <errno.h>
 
 #include "statistics.h"
 #include "cpu.h"
 #include "irq.h"
 #include "balance.h"
+#include "rps.h"
+#include "path.h"
+#include "event.h"
+#include "affinity.h"
+
+/* Print the decisions to stdout. The events are logged anyway. */
+static int verbose = 0;
+
+/* Names of strategies. Indexed by birq_choose_strategy_e */
+static const char *strategy_names[BIRQ_CHOOSE_NUM] = {
+	"max",
+	"min",
+	"rnd"
+};
+
+void balance_verbose(int on)
+{
+	verbose = on;
+}
+
+/* Get strategy by name */
+int balance_strategy(const char *str, birq_choose_strategy_e *strategy)
+{
+	int i;
+
+	for (i = 0; i < BIRQ_CHOOSE_NUM; i++) {
+		if (!strcmp(str, strategy_names[i])) {
+			*strategy = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Get name of strategy */
+const char *balance_strategy_name(birq_choose_strategy_e strategy)
+{
+	if (strategy >= BIRQ_CHOOSE_NUM)
+		return "unknown";
+
+	return strategy_names[strategy];
+}
 
 /* Drop the dont_move flag on all IRQs for specified CPU */
 static int dec_weight(cpu_t *cpu, int value)
 {
-	lub_list_node_t *iter;
+	ilist_link_t *link;
 
 	if (!cpu)
 		return -1;
 	if (value < 0)
 		return -1;
 
-	for (iter = lub_list_iterator_init(cpu->irqs); iter;
-		iter = lub_list_iterator_next(iter)) {
-		irq_t *irq;
-		irq = (irq_t *)lub_list_node__get_data(iter);
+	ilist_for_each(link, &cpu->irqs) {
+		irq_t *irq = ilist_entry(link, irq_t, cpu_link);
 		if (irq->weight >= value)
 			irq->weight -= value;
 	}
@@ -42,21 +84,29 @@ static int dec_weight(cpu_t *cpu, int value)
 /* Remove IRQ from specified CPU */
 int remove_irq_from_cpu(irq_t *irq, cpu_t *cpu)
 {
-	lub_list_node_t *node;
-
 	if (!irq || !cpu)
 		return -1;
 
 	irq->cpu = NULL;
-	node = lub_list_search(cpu->irqs, irq);
-	if (!node)
-		return 0;
-	lub_list_del(cpu->irqs, node);
-	lub_list_node_free(node);
+	if (irq->cpu_link.list == &cpu->irqs)
+		ilist_del(&irq->cpu_link);
 
 	return 0;
 }
 
+/* Add IRQ to CPU's list sorted by IRQ number. The IRQs are usually
+   linked in order so the search starts from the tail. */
+static void link_irq_to_cpu(irq_t *irq, cpu_t *cpu)
+{
+	ilist_link_t *pos;
+
+	for (pos = cpu->irqs.tail; pos; pos = pos->prev) {
+		if (ilist_entry(pos, irq_t, cpu_link)->irq <= irq->irq)
+			break;
+	}
+	ilist_insert_after(&cpu->irqs, pos, &irq->cpu_link);
+}
+
 /* Move IRQ to specified CPU. Remove IRQ from the IRQ list
  * of old CPU.
  */
@@ -72,15 +122,53 @@ int move_irq_to_cpu(irq_t *irq, cpu_t *cpu)
 	}
 	dec_weight(cpu, 1);
 	irq->cpu = cpu;
-	lub_list_add(cpu->irqs, irq);
+	ilist_del(&irq->cpu_link);
+	link_irq_to_cpu(irq, cpu);
 
 	return 0;
 }
 
+/* Current cooldown of IRQ. It grows exponentially for IRQs
+   moved repeatedly. */
+static unsigned long long irq_cooldown(irq_t *irq, unsigned int cooldown)
+{
+	return (unsigned long long)cooldown << irq->backoff;
+}
+
+/* IRQ was moved recently. Don't move it again. */
+static int in_cooldown(irq_t *irq, unsigned int cooldown,
+	unsigned long long now)
+{
+	if (!irq->last_move)
+		return 0;
+	return ((now - irq->last_move) < irq_cooldown(irq, cooldown));
+}
+
+/* Save move metadata. The repeated move (within doubled cooldown)
+   increases the cooldown. */
+static void account_move(irq_t *irq, unsigned int cooldown,
+	unsigned long long now)
+{
+	if (irq->last_move &&
+		((now - irq->last_move) < 2 * irq_cooldown(irq, cooldown))) {
+		if (irq->backoff < BIRQ_MAX_BACKOFF)
+			irq->backoff++;
+	} else {
+		irq->backoff = 0;
+	}
+	irq->last_move = now;
+	irq->moves++;
+	irq->rate_before = irq->rate;
+	irq->rate_after = 0;
+	irq->rate_after_pending = 1;
+}
+
 /* Search for the best CPU. Best CPU is a CPU with minimal load.
    If several CPUs have the same load then the best CPU is a CPU
-   with minimal number of assigned IRQs */
-static cpu_t *choose_cpu(lub_list_t *cpus, cpumask_t *cpumask, float load_limit)
+   with minimal number of assigned IRQs. The CPUs from hint (can be
+   NULL) get a bonus. The hint is not a constraint. */
+cpu_t *choose_cpu(lub_list_t *cpus, cpumask_t *cpumask, cpumask_t *hint,
+	float load_limit)
 {
 	lub_list_node_t *iter;
 	lub_list_t * min_cpus = NULL;
@@ -90,13 +178,17 @@ static cpu_t *choose_cpu(lub_list_t *cpus, cpumask_t *cpumask, float load_limit)
 
 	for (iter = lub_list_iterator_init(cpus); iter;
 		iter = lub_list_iterator_next(iter)) {
+		float load;
 		cpu = (cpu_t *)lub_list_node__get_data(iter);
 		if (!cpu_isset(cpu->id, *cpumask))
 			continue;
 		if (cpu->load >= load_limit)
 			continue;
-		if ((!min_cpus) || (cpu->load < min_load)) {
-			min_load = cpu->load;
+		load = cpu->load;
+		if (hint && cpu_isset(cpu->id, *hint))
+			load -= BIRQ_HINT_BONUS;
+		if ((!min_cpus) || (load < min_load)) {
+			min_load = load;
 			if (!min_cpus)
 				min_cpus = lub_list_new(cpu_list_compare_len);
 			while ((node = lub_list__get_tail(min_cpus))) {
@@ -105,7 +197,7 @@ static cpu_t *choose_cpu(lub_list_t *cpus, cpumask_t *cpumask, float load_limit)
 			}
 			lub_list_add(min_cpus, cpu);
 		}
-		if (cpu->load == min_load)
+		if (load == min_load)
 			lub_list_add(min_cpus, cpu);
 	}
 	if (!min_cpus)
@@ -121,49 +213,246 @@ static cpu_t *choose_cpu(lub_list_t *cpus, cpumask_t *cpumask, float load_limit)
 	return cpu;
 }
 
-static int irq_set_affinity(irq_t *irq, cpumask_t *cpumask)
+/* Handle result of affinity write. The affinity for some IRQ can't
+   be changed. So don't consider such IRQs. The example is IRQ 0 - timer.
+   Blacklist this IRQ. The IRQ blacklisted due to temporary error will
+   be retried later (see age_blacklist()). The ENOENT means IRQ is
+   disappeared. It will be removed by next scan. */
+static int irq_affinity_result(irq_t *irq, int err)
 {
-	char path[PATH_MAX];
-	char buf[NR_CPUS + 1];
-	int f;
-
-	if (!irq)
+	if (!err) {
+		irq->blacklist_count = 0;
+		return 0;
+	}
+	if (err == ENOENT)
 		return -1;
+	irq->blacklisted = 1;
+	irq->blacklist_errno = err;
+	irq->blacklist_time = 0; /* Will be set by age_blacklist() */
+	irq->blacklist_count++;
+	remove_irq_from_cpu(irq, irq->cpu);
+	if (verbose)
+		printf("Blacklist IRQ %u: %s\n", irq->irq, strerror(err));
+	event_log(EVENT_WARNING, "blacklist",
+		"\"irq\":%u,\"errno\":%d,\"permanent\":%s", irq->irq, err,
+		irq_error_permanent(err) ? "true" : "false");
+
+	return -1;
+}
+
+/* Return IRQ blacklisted due to temporary error back to balancing.
+   The delay grows exponentially with number of failures in a row. */
+static void age_blacklist(irq_t *irq, unsigned long long now)
+{
+	unsigned int shift;
+
+	if (irq_error_permanent(irq->blacklist_errno))
+		return;
+	if (!irq->blacklist_time) {
+		irq->blacklist_time = now;
+		return;
+	}
+	shift = irq->blacklist_count ? irq->blacklist_count - 1 : 0;
+	if (shift > IRQ_BLACKLIST_MAX_SHIFT)
+		shift = IRQ_BLACKLIST_MAX_SHIFT;
+	if (now - irq->blacklist_time <
+		((unsigned long long)IRQ_BLACKLIST_DELAY << shift))
+		return;
+	irq->blacklisted = 0;
+	irq_changed(irq);
+	if (verbose)
+		printf("Unblacklist IRQ %u\n", irq->irq);
+	event_log(EVENT_INFO, "unblacklist", "\"irq\":%u,\"failures\":%u",
+		irq->irq, irq->blacklist_count);
+}
 
-	snprintf(path, sizeof(path),
-		"%s/%u/smp_affinity", PROC_IRQ, irq->irq);
-	path[sizeof(path) - 1] = '\0';
-	if ((f = open(path, O_WRONLY | O_SYNC)) < 0)
+/* The written affinity will be verified by next cycles. The time
+   is set by verify_moves(). */
+static void irq_move_pending(irq_t *irq, cpu_t *cpu)
+{
+	irq->move = IRQ_MOVE_PENDING;
+	irq->move_cpu = cpu->id;
+	irq->move_retries = 0;
+	irq->move_time = 0;
+	irq->move_base_valid = 0;
+	irq->move_cur_valid = 0;
+}
+
+static int irq_set_affinity(irq_t *irq, cpu_t *cpu)
+{
+	if (!irq || !cpu)
+		return -1;
+	if (irq_affinity_result(irq,
+		affinity_write(irq->irq, cpu_affinity_list(cpu),
+			cpu_affinity_str(cpu))) < 0)
 		return -1;
-	cpumask_scnprintf(buf, sizeof(buf), *cpumask);
-	buf[sizeof(buf) - 1] = '\0';
-	if (write(f, buf, strlen(buf)) < 0) {
-		/* The affinity for some IRQ can't be changed. So don't
-		   consider such IRQs. The example is IRQ 0 - timer.
-		   Blacklist this IRQ. Note fprintf() without fflush()
-		   will not return I/O error due to buffers. */
-		irq->blacklisted = 1;
-		remove_irq_from_cpu(irq, irq->cpu);
-		printf("Blacklist IRQ %u\n", irq->irq);
+	irq_move_pending(irq, cpu);
+
+	return 0;
+}
+
+/* Check whether the pending move is really applied */
+static int move_applied(irq_t *irq)
+{
+	cpumask_t effective;
+	int applied = 0;
+
+	/* The kernel routes IRQ to target CPU */
+	cpus_init(effective);
+	if (!irq_get_effective(irq, &effective))
+		applied = cpu_isset(irq->move_cpu, effective);
+	cpus_free(effective);
+	if (applied)
+		return 1;
+
+	/* The interrupts are counted on target CPU */
+	if (!irq->move_cur_valid)
+		return 0;
+	if (!irq->move_base_valid) {
+		irq->move_base = irq->move_cur;
+		irq->move_base_valid = 1;
+		return 0;
 	}
-	close(f);
+
+	return (irq->move_cur > irq->move_base);
+}
+
+/* Verify the moves made by previous cycles. It must be called
+   after scan_irqs(). The temporary blacklisted IRQs are aged here too.
+   The pending move is confirmed by effective
+   affinity or by interrupts on target CPU. The unconfirmed move is
+   rewritten with exponential delay. The IRQ is considered stuck if
+   retries don't help. The balancer doesn't move stuck IRQs. */
+int verify_moves(lub_list_t *cpus, lub_list_t *irqs, unsigned long long now)
+{
+	lub_list_node_t *iter;
+
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		cpu_t *cpu;
+
+		if (irq->blacklisted) {
+			age_blacklist(irq, now);
+			continue;
+		}
+		if (irq->move == IRQ_MOVE_STUCK) {
+			if (now - irq->move_time >= IRQ_STUCK_TIMEOUT) {
+				irq->move = IRQ_MOVE_NONE;
+				if (verbose)
+					printf("Unstuck IRQ %u\n", irq->irq);
+			} else {
+				/* The smp_affinity lies. Link IRQ to the
+				   CPUs really handling it. */
+				irq_get_effective(irq, &irq->affinity);
+				irq_changed(irq);
+				/* Parse smp_affinity again on next scan */
+				free(irq->affinity_raw);
+				irq->affinity_raw = NULL;
+			}
+			continue;
+		}
+		if (irq->move != IRQ_MOVE_PENDING)
+			continue;
+		if (!irq->move_time)
+			irq->move_time = now;
+
+		if (move_applied(irq)) {
+			irq->move = IRQ_MOVE_MOVED;
+			continue;
+		}
+		/* No interrupts. The MSI affinity can be applied
+		   on next interrupt only. Wait. */
+		if (irq->intr == 0)
+			continue;
+		if (now - irq->move_time <
+			((unsigned long long)IRQ_VERIFY_DELAY << irq->move_retries))
+			continue;
+		cpu = cpu_list_search(cpus, irq->move_cpu);
+		if (!cpu || (irq->move_retries >= IRQ_MOVE_RETRIES)) {
+			irq->move = IRQ_MOVE_STUCK;
+			irq->move_time = now;
+			if (verbose)
+				printf("Stuck IRQ %u on the way to CPU%u\n",
+					irq->irq, irq->move_cpu);
+			event_log(EVENT_WARNING, "stuck",
+				"\"irq\":%u,\"cpu\":%u", irq->irq, irq->move_cpu);
+			continue;
+		}
+		irq->move_retries++;
+		irq->move_time = now;
+		irq->move_base_valid = 0;
+		if (verbose)
+			printf("Retry IRQ %u to CPU%u\n", irq->irq, cpu->id);
+		event_log(EVENT_INFO, "retry",
+			"\"irq\":%u,\"cpu\":%u,\"retry\":%u",
+			irq->irq, cpu->id, irq->move_retries);
+		irq_affinity_result(irq,
+			affinity_write(irq->irq, cpu_affinity_list(cpu),
+				cpu_affinity_str(cpu)));
+	}
+
+	return 0;
+}
+
+/* Pin IRQ to CPU. The pinned IRQ is never moved by balancer. */
+int pin_irq(lub_list_t *cpus, irq_t *irq, unsigned int cpu_id)
+{
+	cpu_t *cpu;
+
+	if (irq->blacklisted)
+		return -1;
+	if (!(cpu = cpu_list_search(cpus, cpu_id)))
+		return -1;
+	if (irq_set_affinity(irq, cpu) < 0)
+		return -1;
+	cpus_copy(irq->affinity, cpu->cpumask);
+	move_irq_to_cpu(irq, cpu);
+	irq->pinned = 1;
+	if (verbose)
+		printf("Pin IRQ %u to CPU%u\n", irq->irq, cpu->id);
+	event_log(EVENT_INFO, "pin", "\"irq\":%u,\"cpu\":%u",
+		irq->irq, cpu->id);
+
+	return 0;
+}
+
+/* Return IRQ under balancer's control */
+int unpin_irq(irq_t *irq)
+{
+	if (!irq->pinned)
+		return -1;
+	irq->pinned = 0;
+	if (verbose)
+		printf("Unpin IRQ %u\n", irq->irq);
+	event_log(EVENT_INFO, "unpin", "\"irq\":%u", irq->irq);
 
 	return 0;
 }
 
-/* Find best CPUs for IRQs need to be balanced. */
-int balance(lub_list_t *cpus, lub_list_t *balance_irqs, float load_limit)
+/* Choose new CPU for IRQs. Returns number of moved IRQs. */
+int balance(lub_list_t *cpus, lub_list_t *balance_irqs, float load_limit,
+	unsigned int cooldown, unsigned long long now)
 {
 	lub_list_node_t *iter;
+	int moves = 0;
 
 	for (iter = lub_list_iterator_init(balance_irqs); iter;
 		iter = lub_list_iterator_next(iter)) {
 		irq_t *irq;
 		cpu_t *cpu;
 		irq = (irq_t *)lub_list_node__get_data(iter);
+		/* The CPUs near the consumer of IRQ's data are preferred.
+		   They are local CPUs too. */
+		cpu = NULL;
+		if (!cpus_empty(irq->consumer_cpus))
+			cpu = choose_cpu(cpus, &(irq->consumer_cpus),
+				&(irq->hint), load_limit);
 		/* Try to find local CPU to move IRQ to.
 		   The local CPU is CPU with native NUMA node. */
-		cpu = choose_cpu(cpus, &(irq->local_cpus), load_limit);
+		if (!cpu)
+			cpu = choose_cpu(cpus, &(irq->local_cpus),
+				&(irq->hint), load_limit);
 		/* If local CPU is not found then try to use
 		   CPU from another NUMA node. It's better then
 		   overloaded CPUs. */
@@ -174,44 +463,78 @@ int balance(lub_list_t *cpus, lub_list_t *balance_irqs, float load_limit)
 			cpumask_t complement;
 			cpus_init(complement);
 			cpus_complement(complement, irq->local_cpus);
-			cpu = choose_cpu(cpus, &complement, load_limit);
+			cpu = choose_cpu(cpus, &complement, NULL, load_limit);
 			cpus_free(complement);
 		}
 */
 		if (cpu) {
-			if (irq->cpu)
+			if (verbose && irq->cpu)
 				printf("Move IRQ %u from CPU%u to CPU%u\n",
 					irq->irq, irq->cpu->id, cpu->id);
-			else
+			else if (verbose)
 				printf("Move IRQ %u to CPU%u\n", irq->irq, cpu->id);
+			event_log(EVENT_INFO, "move",
+				"\"irq\":%u,\"from\":%d,\"to\":%u,\"rate\":%llu",
+				irq->irq, irq->cpu ? (int)irq->cpu->id : -1,
+				cpu->id, irq->rate);
 			move_irq_to_cpu(irq, cpu);
+			/* Check the linkage by real affinity on next cycle */
+			irq_changed(irq);
+			account_move(irq, cooldown, now);
+			moves++;
 		}
 	}
 
-	return 0;
+	return moves;
 }
 
+/* Write new affinities in one batch. The per-IRQ results are
+   checked after the whole batch is done. */
 int apply_affinity(lub_list_t *balance_irqs)
 {
 	lub_list_node_t *iter;
+	affinity_job_t *jobs;
+	irq_t **irqs;
+	unsigned int num = 0;
+	unsigned int i;
 
+	if (!(jobs = malloc(lub_list_len(balance_irqs) * sizeof(*jobs))))
+		return -1;
+	if (!(irqs = malloc(lub_list_len(balance_irqs) * sizeof(*irqs)))) {
+		free(jobs);
+		return -1;
+	}
 	for (iter = lub_list_iterator_init(balance_irqs); iter;
 		iter = lub_list_iterator_next(iter)) {
 		irq_t *irq;
 		irq = (irq_t *)lub_list_node__get_data(iter);
 		if (!irq->cpu)
 			continue;
-		irq_set_affinity(irq, &(irq->cpu->cpumask));
+		jobs[num].irq = irq->irq;
+		jobs[num].list = cpu_affinity_list(irq->cpu);
+		jobs[num].mask = cpu_affinity_str(irq->cpu);
+		jobs[num].err = 0;
+		irqs[num] = irq;
+		num++;
+	}
+	affinity_write_batch(jobs, num);
+	for (i = 0; i < num; i++) {
+		if (irq_affinity_result(irqs[i], jobs[i].err) == 0)
+			irq_move_pending(irqs[i], irqs[i]->cpu);
 	}
+	free(irqs);
+	free(jobs);
+
 	return 0;
 }
 
 
 /* Count the number of intr-not-null IRQs and minimal IRQ weight */
-static int irq_list_info(lub_list_t *irqs, int *min_weight,
-	unsigned int *irq_num, unsigned int *candidates_num)
+static int irq_list_info(ilist_t *irqs, int *min_weight,
+	unsigned int *irq_num, unsigned int *candidates_num,
+	unsigned int cooldown, unsigned long long now)
 {
-	lub_list_node_t *iter;
+	ilist_link_t *link;
 
 	if (!irqs)
 		return -1;
@@ -222,9 +545,8 @@ static int irq_list_info(lub_list_t *irqs, int *min_weight,
 		*irq_num = 0;
 	if (candidates_num)
 		*candidates_num = 0;
-	for (iter = lub_list_iterator_init(irqs); iter;
-		iter = lub_list_iterator_next(iter)) {
-		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+	ilist_for_each(link, irqs) {
+		irq_t *irq = ilist_entry(link, irq_t, cpu_link);
 		if (irq->intr == 0)
 			continue;
 		if (min_weight) {
@@ -233,7 +555,11 @@ static int irq_list_info(lub_list_t *irqs, int *min_weight,
 		}
 		if (irq_num)
 			*irq_num += 1;
-		if (irq->weight)
+		if (irq->weight || !irq_movable(irq))
+			continue;
+		if (history_burst(&irq->history))
+			continue;
+		if (in_cooldown(irq, cooldown, now))
 			continue;
 		if (candidates_num)
 			*candidates_num += 1;
@@ -243,7 +569,8 @@ static int irq_list_info(lub_list_t *irqs, int *min_weight,
 }
 
 /* Search for most overloaded CPU */
-static cpu_t * most_overloaded_cpu(lub_list_t *cpus, float threshold)
+static cpu_t * most_overloaded_cpu(lub_list_t *cpus, float threshold,
+	unsigned int cooldown, unsigned long long now)
 {
 	lub_list_node_t *iter;
 	cpu_t *overloaded_cpu = NULL;
@@ -262,11 +589,22 @@ static cpu_t * most_overloaded_cpu(lub_list_t *cpus, float threshold)
 		if (cpu->load <= max_load)
 			continue;
 
+		/* Don't chase periodic load. The burst will go away
+		   itself. Only sustained overload is balanced. */
+		if (history_burst(&cpu->history)) {
+			if (verbose)
+				printf("Skip periodic burst on CPU%u\n", cpu->id);
+			event_log(EVENT_DEBUG, "burst",
+				"\"cpu\":%u,\"load\":%.2f", cpu->id, cpu->load);
+			continue;
+		}
+
 		/* Don't move last IRQ */
-		if (lub_list_len(cpu->irqs) <= 1)
+		if (ilist_len(&cpu->irqs) <= 1)
 			continue;
 
-		irq_list_info(cpu->irqs, &min_weight, &irq_num, NULL);
+		irq_list_info(&cpu->irqs, &min_weight, &irq_num, NULL,
+			cooldown, now);
 		/* All IRQs has intr=0 */
 		if (irq_num == 0)
 			continue;
@@ -286,9 +624,10 @@ static cpu_t * most_overloaded_cpu(lub_list_t *cpus, float threshold)
    The IRQs with small number of interrupts have very low load or very
    high load (in a case of NAPI). */
 int choose_irqs_to_move(lub_list_t *cpus, lub_list_t *balance_irqs,
-	float threshold, birq_choose_strategy_e strategy)
+	float threshold, birq_choose_strategy_e strategy,
+	unsigned int cooldown, unsigned long long now)
 {
-	lub_list_node_t *iter;
+	ilist_link_t *link;
 	cpu_t *overloaded_cpu = NULL;
 	irq_t *irq_to_move = NULL;
 	unsigned long long max_intr = 0;
@@ -297,12 +636,17 @@ int choose_irqs_to_move(lub_list_t *cpus, lub_list_t *balance_irqs,
 	unsigned int current = 0;
 
 	/* Search for overloaded CPUs */
-	if (!(overloaded_cpu = most_overloaded_cpu(cpus, threshold)))
+	if (!(overloaded_cpu = most_overloaded_cpu(cpus, threshold,
+		cooldown, now)))
 		return 0;
+	event_log(EVENT_INFO, "overload",
+		"\"cpu\":%u,\"load\":%.2f,\"irqs\":%u", overloaded_cpu->id, overloaded_cpu->load,
+		ilist_len(&overloaded_cpu->irqs));
 
 	if (strategy == BIRQ_CHOOSE_RND) {
 		unsigned int candidates = 0;
-		irq_list_info(overloaded_cpu->irqs, NULL, NULL, &candidates);
+		irq_list_info(&overloaded_cpu->irqs, NULL, NULL, &candidates,
+			cooldown, now);
 		if (candidates == 0)
 			return 0;
 		choose = rand() % candidates;
@@ -310,15 +654,20 @@ int choose_irqs_to_move(lub_list_t *cpus, lub_list_t *balance_irqs,
 
 	/* Search for the IRQ (owned by overloaded CPU) with
 	   maximum/minimum number of interrupts. */
-	for (iter = lub_list_iterator_init(overloaded_cpu->irqs); iter;
-		iter = lub_list_iterator_next(iter)) {
-		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+	ilist_for_each(link, &overloaded_cpu->irqs) {
+		irq_t *irq = ilist_entry(link, irq_t, cpu_link);
 		/* Don't move any IRQs with intr=0. It can be unused IRQ. In
 		   this case the moving is not needed. It can be overloaded
 		   (by NAPI) IRQs. In this case it will be not moved anyway. */
 		if (irq->intr == 0)
 			continue;
-		if (irq->weight)
+		if (irq->weight || !irq_movable(irq))
+			continue;
+		/* Periodic burst of interrupts will go away itself */
+		if (history_burst(&irq->history))
+			continue;
+		/* IRQ was moved recently */
+		if (in_cooldown(irq, cooldown, now))
 			continue;
 		if (strategy == BIRQ_CHOOSE_MAX) {
 			/* Get IRQ with max intr */
@@ -349,3 +698,145 @@ int choose_irqs_to_move(lub_list_t *cpus, lub_list_t *balance_irqs,
 
 	return 0;
 }
+
+/* Choose IRQs handled far from the consumer of their data. The IRQ
+   is moved if some CPU near the consumer is not overloaded. */
+int choose_consumer_irqs(lub_list_t *cpus, lub_list_t *irqs,
+	lub_list_t *balance_irqs, float load_limit, unsigned int cooldown, unsigned long long now)
+{
+	lub_list_node_t *iter;
+	int num = 0;
+
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		if (cpus_empty(irq->consumer_cpus))
+			continue;
+		/* New IRQs are balanced anyway */
+		if (!irq->cpu)
+			continue;
+		if (cpu_isset(irq->cpu->id, irq->consumer_cpus))
+			continue;
+		if (irq->weight || !irq_movable(irq) || irq->blacklisted)
+			continue;
+		if (in_cooldown(irq, cooldown, now))
+			continue;
+		if (lub_list_search(balance_irqs, irq))
+			continue;
+		if (!choose_cpu(cpus, &(irq->consumer_cpus), NULL, load_limit))
+			continue;
+		lub_list_add(balance_irqs, irq);
+		num++;
+	}
+
+	return num;
+}
+
+/* Get the IRQ overloading the CPU alone. The IRQ's share of CPU load
+   is estimated by its share of CPU's interrupts. Returns NULL if
+   the busiest IRQ's share is lower than threshold. */
+static irq_t *hotspot_irq(cpu_t *cpu, float threshold)
+{
+	ilist_link_t *link;
+	irq_t *hotspot = NULL;
+	unsigned long long sum = 0;
+
+	ilist_for_each(link, &cpu->irqs) {
+		irq_t *irq = ilist_entry(link, irq_t, cpu_link);
+		sum += irq->intr;
+		if (!hotspot || (irq->intr > hotspot->intr))
+			hotspot = irq;
+	}
+	if (!hotspot || !hotspot->intr)
+		return NULL;
+	if (cpu->load * hotspot->intr / sum < threshold)
+		return NULL;
+
+	return hotspot;
+}
+
+/* Summary load of IRQ's CPU and CPUs used for RPS */
+static float rps_load(lub_list_t *cpus, irq_t *irq)
+{
+	lub_list_node_t *iter;
+	float load = 0;
+
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		if ((cpu == irq->cpu) || cpu_isset(cpu->id, irq->rps_cpus))
+			load += cpu->load;
+	}
+
+	return load;
+}
+
+/* The single IRQ can overload CPU alone. The moving of such IRQ
+   is useless - it will overload another CPU. For network devices
+   the softirq processing of IRQ's receive queue can be spread over
+   idle local CPUs using RPS. The RPS is disabled when the summary
+   load fits one CPU again. */
+int balance_rps(lub_list_t *cpus, lub_list_t *irqs,
+	float threshold, float load_limit)
+{
+	lub_list_node_t *iter;
+
+	/* Disable RPS for IRQs with low load */
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		if (!irq->rps)
+			continue;
+		if (irq->cpu && (rps_load(cpus, irq) >= load_limit))
+			continue;
+		if (verbose)
+			printf("Disable RPS for IRQ %u\n", irq->irq);
+		event_log(EVENT_INFO, "rps_disable", "\"irq\":%u", irq->irq);
+		rps_disable(irq);
+	}
+
+	/* Search for single-IRQ hotspots */
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		lub_list_node_t *cpu_iter;
+		irq_t *irq;
+		cpumask_t cpumask;
+
+		if (cpu->load < threshold)
+			continue;
+		if (!(irq = hotspot_irq(cpu, threshold)))
+			continue;
+		if (irq->rps)
+			continue;
+
+		/* Idle local CPUs */
+		cpus_init(cpumask);
+		cpus_clear(cpumask);
+		for (cpu_iter = lub_list_iterator_init(cpus); cpu_iter;
+			cpu_iter = lub_list_iterator_next(cpu_iter)) {
+			cpu_t *rps_cpu = (cpu_t *)lub_list_node__get_data(cpu_iter);
+			if (rps_cpu == cpu)
+				continue;
+			if (!cpu_isset(rps_cpu->id, irq->local_cpus))
+				continue;
+			if (rps_cpu->load >= load_limit)
+				continue;
+			cpu_set(rps_cpu->id, cpumask);
+		}
+		if (!cpus_empty(cpumask) && !rps_enable(irq, &cpumask)) {
+			char buf[NR_CPUS + 1];
+			cpumask_scnprintf(buf, sizeof(buf), cpumask);
+			buf[sizeof(buf) - 1] = '\0';
+			if (verbose)
+				printf("Enable RPS for IRQ %u on CPU%u, rps_cpus [%s]\n",
+					irq->irq, cpu->id, buf);
+			event_log(EVENT_INFO, "rps_enable",
+				"\"irq\":%u,\"cpu\":%u,\"rps_cpus\":\"%s\"",
+				irq->irq, cpu->id, buf);
+		}
+		cpus_free(cpumask);
+	}
+
+	return 0;
+}
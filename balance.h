@@ -5,17 +5,40 @@
 #include "irq.h"
 #include "cpu.h"
 
+/* The cooldown is doubled for each repeated move (move within
+   doubled cooldown period) up to BIRQ_MAX_BACKOFF times. */
+#define BIRQ_MAX_BACKOFF 6
+
+/* The CPU from IRQ's affinity hint is chosen if its load is not more
+   than BIRQ_HINT_BONUS percents higher than load of the best CPU. */
+#define BIRQ_HINT_BONUS 10.0
+
 typedef enum {
 	BIRQ_CHOOSE_MAX,
 	BIRQ_CHOOSE_MIN,
-	BIRQ_CHOOSE_RND
+	BIRQ_CHOOSE_RND,
+	BIRQ_CHOOSE_NUM /* Number of strategies */
 } birq_choose_strategy_e;
 
+void balance_verbose(int on);
+int balance_strategy(const char *str, birq_choose_strategy_e *strategy);
+const char *balance_strategy_name(birq_choose_strategy_e strategy);
 int remove_irq_from_cpu(irq_t *irq, cpu_t *cpu);
 int move_irq_to_cpu(irq_t *irq, cpu_t *cpu);
-int balance(lub_list_t *cpus, lub_list_t *balance_irqs, float load_limit);
+cpu_t *choose_cpu(lub_list_t *cpus, cpumask_t *cpumask, cpumask_t *hint,
+	float load_limit);
+int balance(lub_list_t *cpus, lub_list_t *balance_irqs, float load_limit,
+	unsigned int cooldown, unsigned long long now);
 int apply_affinity(lub_list_t *balance_irqs);
+int pin_irq(lub_list_t *cpus, irq_t *irq, unsigned int cpu_id);
+int unpin_irq(irq_t *irq);
+int verify_moves(lub_list_t *cpus, lub_list_t *irqs, unsigned long long now);
 int choose_irqs_to_move(lub_list_t *cpus, lub_list_t *balance_irqs,
-	float threshold, birq_choose_strategy_e strategy);
+	float threshold, birq_choose_strategy_e strategy,
+	unsigned int cooldown, unsigned long long now);
+int choose_consumer_irqs(lub_list_t *cpus, lub_list_t *irqs,
+	lub_list_t *balance_irqs, float load_limit, unsigned int cooldown, unsigned long long now);
+int balance_rps(lub_list_t *cpus, lub_list_t *irqs,
+	float threshold, float load_limit);
 
 #endif
@@ -33,14 +33,30 @@
 #include "statistics.h"
 #include "balance.h"
 #include "pxm.h"
+#include "consumer.h"
+#include "rps.h"
+#include "path.h"
+#include "cycle.h"
+#include "trace.h"
+#include "metrics.h"
+#include "control.h"
+#include "event.h"
+#include "plan.h"
+#include "state.h"
 
 #ifndef VERSION
 #define VERSION "1.2.0"
 #endif
 
+/* Monotonic time in ms */
+static unsigned long long now_ms(void);
+
 /* Signal handlers */
 static volatile int sigterm = 0; /* Exit if 1 */
+static volatile int sigdump = 0; /* Dump self-overhead statistics if 1 */
 static void sighandler(int signo);
+static void sigdump_handler(int signo);
+static void dump_overhead(cycle_t *cycle, const char *fname);
 
 static void help(int status, const char *argv0);
 static struct options *opts_init(void);
@@ -51,14 +67,29 @@ static int opts_parse(int argc, char *argv[], struct options *opts);
 struct options {
 	char *pidfile;
 	char *pxm; /* Proximity config file */
+	char *consumers; /* Consumers config file */
+	char *root; /* Root directory for procfs and sysfs */
+	char *record; /* Trace file to record cycles to */
+	char *replay; /* Trace file to replay */
+	char *stats; /* File to dump self-overhead statistics to */
+	char *metrics; /* Prometheus textfile */
+	char *control; /* Control socket */
+	char *events; /* Event log */
+	char *dry_run; /* Plan file to write moves to */
+	char *apply_plan; /* Plan file to apply */
+	char *state; /* State file for warm start */
+	event_level_e event_level; /* Max level of logged events */
+	unsigned int event_rate; /* Max events per second */
 	int debug; /* Don't daemonize in debug mode */
 	int log_facility;
 	float threshold;
 	float load_limit;
 	int verbose;
 	int ht;
+	int rps; /* Use RPS for single-IRQ hotspots */
 	unsigned int long_interval;
 	unsigned int short_interval;
+	unsigned int cooldown; /* Don't move IRQ again while cooldown, ms */
 	birq_choose_strategy_e strategy;
 };
 
@@ -68,28 +99,46 @@ int main(int argc, char **argv)
 	int retval = -1;
 	struct options *opts = NULL;
 	int pidfd = -1;
-	unsigned int interval;
+	unsigned long long deadline;
+	unsigned long long saved = 0; /* Time of last state save */
+	control_t *control = NULL;
 
 	/* Signal vars */
 	struct sigaction sig_act;
 	sigset_t sig_set;
 
-	/* IRQ list. It contain all found IRQs. */
-	lub_list_t *irqs;
-	/* IRQs need to be balanced */
-	lub_list_t *balance_irqs;
-	/* CPU list. It contain all found CPUs. */
-	lub_list_t *cpus;
-	/* NUMA list. It contain all found NUMA nodes. */
-	lub_list_t *numas;
-	/* Proximity list. */
-	lub_list_t *pxms;
+	/* Balancing context. It contains IRQ, CPU, NUMA lists. */
+	cycle_t *cycle;
 
 	/* Parse command line options */
 	opts = opts_init();
 	if (opts_parse(argc, argv, opts))
 		goto err;
 
+	/* Replay the trace offline and exit */
+	if (opts->replay) {
+		int res = trace_replay(opts->replay, stdout);
+		opts_free(opts);
+		return (res == 0) ? 0 : -1;
+	}
+
+	/* Apply the plan file and exit */
+	if (opts->apply_plan) {
+		int res;
+		path_set_root(opts->root);
+		cycle = cycle_new();
+		cycle->ht = opts->ht;
+		cycle_scan(cycle, opts->pxm);
+		res = plan_apply(cycle, opts->apply_plan);
+		if (res < 0)
+			fprintf(stderr, "Error: Can't apply plan %s.\n",
+				opts->apply_plan);
+		cycle_free(cycle);
+		path_set_root(NULL);
+		opts_free(opts);
+		return (res == 0) ? 0 : -1;
+	}
+
 	/* Initialize syslog */
 	openlog(argv[0], LOG_CONS, opts->log_facility);
 	syslog(LOG_ERR, "Start daemon.\n");
@@ -131,89 +180,132 @@ int main(int argc, char **argv)
 	sigaction(SIGTERM, &sig_act, NULL);
 	sigaction(SIGINT, &sig_act, NULL);
 	sigaction(SIGQUIT, &sig_act, NULL);
+	sig_act.sa_handler = &sigdump_handler;
+	sigaction(SIGUSR1, &sig_act, NULL);
 
 	/* Randomize */
 	srand(time(NULL));
 
-	/* Scan NUMA nodes */
-	numas = lub_list_new(numa_list_compare);
-	scan_numas(numas);
-	if (opts->verbose)
-		show_numas(numas);
-
-	/* Scan CPUs */
-	cpus = lub_list_new(cpu_list_compare);
-	scan_cpus(cpus, opts->ht);
-	if (opts->verbose)
-		show_cpus(cpus);
+	/* Root of procfs and sysfs */
+	path_set_root(opts->root);
 
 	/* Prepare data structures */
-	irqs = lub_list_new(irq_list_compare);
-	balance_irqs = lub_list_new(irq_list_compare);
+	cycle = cycle_new();
+	cycle->threshold = opts->threshold;
+	cycle->load_limit = opts->load_limit;
+	cycle->strategy = opts->strategy;
+	cycle->cooldown = opts->cooldown;
+	cycle->short_interval = opts->short_interval;
+	cycle->long_interval = opts->long_interval;
+	cycle->rps = opts->rps;
+	cycle->ht = opts->ht;
+	cycle->verbose = opts->verbose;
+	balance_verbose(opts->verbose);
+	if (opts->dry_run)
+		cycle->plan = strdup(opts->dry_run);
+	if (opts->record && !(cycle->trace = trace_open(opts->record, cycle)))
+		syslog(LOG_WARNING, "Can't open trace %s: %s",
+			opts->record, strerror(errno));
+
+	/* Scan NUMA nodes, CPUs and parse proximity file */
+	cycle_scan(cycle, opts->pxm);
+
+	/* Parse consumers file */
+	if (opts->consumers) {
+		if (parse_consumer_config(opts->consumers,
+			cycle->consumers) < 0)
+			syslog(LOG_WARNING, "Can't parse consumers %s",
+				opts->consumers);
+		else if (cycle->verbose)
+			show_consumers(cycle->consumers);
+	}
 
-	/* Parse proximity file */
-	pxms = lub_list_new(NULL);
-	if (opts->pxm)
-		parse_pxm_config(opts->pxm, pxms, numas);
-	if (opts->verbose)
-		show_pxms(pxms);
+	/* Warm start */
+	if (opts->state) {
+		int restored = state_load(cycle, opts->state);
+		if (restored < 0)
+			syslog(LOG_WARNING, "Can't load state %s",
+				opts->state);
+		else
+			syslog(LOG_INFO, "Restored state of %d IRQs from %s",
+				restored, opts->state);
+		saved = now_ms();
+	}
+
+	/* Structured event log */
+	if (opts->events && (event_open(opts->events, opts->event_level,
+		opts->event_rate) < 0))
+		syslog(LOG_WARNING, "Can't open event log %s: %s",
+			opts->events, strerror(errno));
+
+	/* Runtime control socket */
+	if (opts->control && !(control = control_open(opts->control,
+		opts->pxm)))
+		syslog(LOG_WARNING, "Can't open control socket %s: %s",
+			opts->control, strerror(errno));
 
 	/* Main loop */
 	while (!sigterm) {
-		lub_list_node_t *node;
 		char outstr[10];
 		time_t t;
 		struct tm *tmp;
+		unsigned long long now = now_ms();
 
 		t = time(NULL);
 		tmp = localtime(&t);
-		if (tmp) {
+		if (opts->verbose && tmp) {
 			strftime(outstr, sizeof(outstr), "%H:%M:%S", tmp);
 			printf("----[ %s ]----------------------------------------------------------------\n", outstr);
 		}
 
-		/* Rescan PCI devices for new IRQs. */
-		scan_irqs(irqs, balance_irqs, pxms);
-		if (opts->verbose)
-			irq_list_show(irqs);
-		/* Link IRQs to CPUs due to real current smp affinity. */
-		link_irqs_to_cpus(cpus, irqs);
-
-		/* Gather statistics on CPU load and number of interrupts. */
-		gather_statistics(cpus, irqs);
-		show_statistics(cpus, opts->verbose);
-		/* Choose IRQ to move to another CPU. */
-		choose_irqs_to_move(cpus, balance_irqs,
-			opts->threshold, opts->strategy);
-
-		/* Balance IRQs */
-		if (lub_list_len(balance_irqs) != 0) {
-			/* Set short interval to make balancing faster. */
-			interval = opts->short_interval;
-			/* Choose new CPU for IRQs need to be balanced. */
-			balance(cpus, balance_irqs, opts->load_limit);
-			/* Write new values to /proc/irq/<IRQ>/smp_affinity */
-			apply_affinity(balance_irqs);
-			/* Free list of balanced IRQs */
-			while ((node = lub_list__get_tail(balance_irqs))) {
-				lub_list_del(balance_irqs, node);
-				lub_list_node_free(node);
+		/* Balance IRQs. Set short interval to make
+		   balancing faster. */
+		if (cycle_run(cycle, now))
+			deadline = now_ms() + cycle->short_interval * 1000ULL;
+		else
+			deadline = now_ms() + cycle->long_interval * 1000ULL;
+		/* Export metrics */
+		if (opts->metrics && (metrics_write(cycle, opts->metrics) < 0))
+			syslog(LOG_WARNING, "Can't write metrics to %s: %s",
+				opts->metrics, strerror(errno));
+
+		/* Save state periodically */
+		if (opts->state && (now - saved >=
+			BIRQ_STATE_INTERVAL * 1000ULL)) {
+			if (state_save(cycle, opts->state) < 0)
+				syslog(LOG_WARNING, "Can't save state %s: %s",
+					opts->state, strerror(errno));
+			saved = now;
+		}
+
+		/* Wait before next iteration. The dump request
+		   interrupts the wait. The control command can
+		   request the next cycle immediately. */
+		while (!sigterm) {
+			now = now_ms();
+			if (now >= deadline)
+				break;
+			if (control_wait(control, cycle, deadline - now))
+				break;
+			if (sigdump) {
+				sigdump = 0;
+				dump_overhead(cycle, opts->stats);
 			}
-		} else {
-			/* If nothing to balance */
-			interval = opts->long_interval;
 		}
-		
-		/* Wait before next iteration */
-		sleep(interval);
 	}
 
+	control_close(control);
+	if (opts->state && (state_save(cycle, opts->state) < 0))
+		syslog(LOG_WARNING, "Can't save state %s: %s",
+			opts->state, strerror(errno));
+	event_close();
+
+	/* Return softirq processing to IRQ's CPUs */
+	rps_disable_all(cycle->irqs);
+
 	/* Free data structures */
-	irq_list_free(irqs);
-	lub_list_free(balance_irqs);
-	cpu_list_free(cpus);
-	numa_list_free(numas);
-	pxm_list_free(pxms);
+	cycle_free(cycle);
+	path_set_root(NULL);
 
 	retval = 0;
 err:
@@ -232,6 +324,15 @@ err:
 	return retval;
 }
 
+/*--------------------------------------------------------- */
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /*--------------------------------------------------------- */
 /*
  * Signal handler for temination signals (like SIGTERM, SIGINT, ...)
@@ -242,6 +343,33 @@ static void sighandler(int signo)
 	signo = signo; /* Happy compiler */
 }
 
+/*--------------------------------------------------------- */
+/* Signal handler for dump request (SIGUSR1) */
+static void sigdump_handler(int signo)
+{
+	sigdump = 1;
+	signo = signo; /* Happy compiler */
+}
+
+/*--------------------------------------------------------- */
+/* Write self-overhead statistics to file or stdout */
+static void dump_overhead(cycle_t *cycle, const char *fname)
+{
+	FILE *f;
+
+	if (!fname) {
+		overhead_dump(cycle->overhead, stdout);
+		return;
+	}
+	if (!(f = fopen(fname, "w"))) {
+		syslog(LOG_WARNING, "Can't open stats file %s: %s",
+			fname, strerror(errno));
+		return;
+	}
+	overhead_dump(cycle->overhead, f);
+	fclose(f);
+}
+
 /*--------------------------------------------------------- */
 /* Initialize option structure by defaults */
 static struct options *opts_init(void)
@@ -253,13 +381,28 @@ static struct options *opts_init(void)
 	opts->debug = 0; /* daemonize by default */
 	opts->pidfile = strdup(BIRQ_PIDFILE);
 	opts->pxm = NULL;
+	opts->consumers = NULL;
+	opts->root = NULL;
+	opts->record = NULL;
+	opts->replay = NULL;
+	opts->stats = NULL;
+	opts->metrics = NULL;
+	opts->control = NULL;
+	opts->events = NULL;
+	opts->dry_run = NULL;
+	opts->apply_plan = NULL;
+	opts->state = NULL;
+	opts->event_level = EVENT_INFO;
+	opts->event_rate = EVENT_DEFAULT_RATE;
 	opts->log_facility = LOG_DAEMON;
 	opts->threshold = BIRQ_DEFAULT_THRESHOLD;
 	opts->load_limit = BIRQ_DEFAULT_LOAD_LIMIT;
 	opts->verbose = 0;
 	opts->ht = 0;
+	opts->rps = 0;
 	opts->long_interval = BIRQ_LONG_INTERVAL;
 	opts->short_interval = BIRQ_SHORT_INTERVAL;
+	opts->cooldown = BIRQ_DEFAULT_COOLDOWN;
 	opts->strategy = BIRQ_CHOOSE_RND;
 
 	return opts;
@@ -273,6 +416,28 @@ static void opts_free(struct options *opts)
 		free(opts->pidfile);
 	if (opts->pxm)
 		free(opts->pxm);
+	if (opts->consumers)
+		free(opts->consumers);
+	if (opts->root)
+		free(opts->root);
+	if (opts->record)
+		free(opts->record);
+	if (opts->replay)
+		free(opts->replay);
+	if (opts->stats)
+		free(opts->stats);
+	if (opts->metrics)
+		free(opts->metrics);
+	if (opts->control)
+		free(opts->control);
+	if (opts->events)
+		free(opts->events);
+	if (opts->dry_run)
+		free(opts->dry_run);
+	if (opts->apply_plan)
+		free(opts->apply_plan);
+	if (opts->state)
+		free(opts->state);
 	free(opts);
 }
 
@@ -280,7 +445,7 @@ static void opts_free(struct options *opts)
 /* Parse command line options */
 static int opts_parse(int argc, char *argv[], struct options *opts)
 {
-	static const char *shortopts = "hp:dO:t:l:vri:I:s:x:";
+	static const char *shortopts = "hp:dO:t:l:vrRi:I:s:x:u:k:D:w:W:o:m:C:e:L:E:n:a:S:";
 #ifdef HAVE_GETOPT_H
 	static const struct option longopts[] = {
 		{"help",		0, NULL, 'h'},
@@ -291,10 +456,25 @@ static int opts_parse(int argc, char *argv[], struct options *opts)
 		{"load-limit",		1, NULL, 't'},
 		{"verbose",		0, NULL, 'v'},
 		{"ht",			0, NULL, 'r'},
+		{"rps",			0, NULL, 'R'},
 		{"short-interval",	1, NULL, 'i'},
 		{"long-interval",	1, NULL, 'i'},
 		{"strategy",		1, NULL, 's'},
 		{"pxm",			1, NULL, 'x'},
+		{"consumers",		1, NULL, 'u'},
+		{"cooldown",		1, NULL, 'k'},
+		{"root",		1, NULL, 'D'},
+		{"record",		1, NULL, 'w'},
+		{"replay",		1, NULL, 'W'},
+		{"stats",		1, NULL, 'o'},
+		{"metrics",		1, NULL, 'm'},
+		{"control",		1, NULL, 'C'},
+		{"events",		1, NULL, 'e'},
+		{"event-level",		1, NULL, 'L'},
+		{"event-rate",		1, NULL, 'E'},
+		{"dry-run",		1, NULL, 'n'},
+		{"apply-plan",		1, NULL, 'a'},
+		{"state",		1, NULL, 'S'},
 		{NULL,			0, NULL, 0}
 	};
 #endif
@@ -319,6 +499,77 @@ static int opts_parse(int argc, char *argv[], struct options *opts)
 				free(opts->pxm);
 			opts->pxm = strdup(optarg);
 			break;
+		case 'u':
+			if (opts->consumers)
+				free(opts->consumers);
+			opts->consumers = strdup(optarg);
+			break;
+		case 'D':
+			if (opts->root)
+				free(opts->root);
+			opts->root = strdup(optarg);
+			break;
+		case 'w':
+			if (opts->record)
+				free(opts->record);
+			opts->record = strdup(optarg);
+			break;
+		case 'W':
+			if (opts->replay)
+				free(opts->replay);
+			opts->replay = strdup(optarg);
+			break;
+		case 'o':
+			if (opts->stats)
+				free(opts->stats);
+			opts->stats = strdup(optarg);
+			break;
+		case 'm':
+			if (opts->metrics)
+				free(opts->metrics);
+			opts->metrics = strdup(optarg);
+			break;
+		case 'C':
+			if (opts->control)
+				free(opts->control);
+			opts->control = strdup(optarg);
+			break;
+		case 'e':
+			if (opts->events)
+				free(opts->events);
+			opts->events = strdup(optarg);
+			break;
+		case 'n':
+			if (opts->dry_run)
+				free(opts->dry_run);
+			opts->dry_run = strdup(optarg);
+			break;
+		case 'a':
+			if (opts->apply_plan)
+				free(opts->apply_plan);
+			opts->apply_plan = strdup(optarg);
+			break;
+		case 'S':
+			if (opts->state)
+				free(opts->state);
+			opts->state = strdup(optarg);
+			break;
+		case 'L':
+			if (event_level(optarg, &opts->event_level) < 0) {
+				fprintf(stderr, "Error: Illegal event level %s.\n", optarg);
+				help(-1, argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'E':
+			{
+			char *endptr;
+			unsigned long int val;
+			val = strtoul(optarg, &endptr, 10);
+			if (endptr != optarg)
+				opts->event_rate = val;
+			}
+			break;
 		case 'd':
 			opts->debug = 1;
 			break;
@@ -328,6 +579,9 @@ static int opts_parse(int argc, char *argv[], struct options *opts)
 		case 'r':
 			opts->ht = 1;
 			break;
+		case 'R':
+			opts->rps = 1;
+			break;
 		case 'O':
 			if (lub_log_facility(optarg, &(opts->log_facility))) {
 				fprintf(stderr, "Error: Illegal syslog facility %s.\n", optarg);
@@ -383,14 +637,21 @@ static int opts_parse(int argc, char *argv[], struct options *opts)
 				opts->long_interval = val;
 			}
 			break;
+		case 'k':
+			{
+			char *endptr;
+			unsigned long int val;
+			val = strtoul(optarg, &endptr, 10);
+			if ((endptr == optarg) || *endptr) {
+				fprintf(stderr, "Error: Illegal cooldown value %s.\n", optarg);
+				help(-1, argv[0]);
+				exit(-1);
+			}
+			opts->cooldown = val;
+			}
+			break;
 		case 's':
-			if (!strcmp(optarg, "max"))
-				opts->strategy = BIRQ_CHOOSE_MAX;
-			else if (!strcmp(optarg, "min"))
-				opts->strategy = BIRQ_CHOOSE_MIN;
-			else if (!strcmp(optarg, "rnd"))
-				opts->strategy = BIRQ_CHOOSE_RND;
-			else {
+			if (balance_strategy(optarg, &opts->strategy) < 0) {
 				fprintf(stderr, "Error: Illegal strategy value %s.\n", optarg);
 				help(-1, argv[0]);
 				exit(-1);
@@ -445,8 +706,23 @@ static void help(int status, const char *argv0)
 		printf("\t-d, --debug Debug mode. Don't daemonize.\n");
 		printf("\t-v, --verbose Be verbose.\n");
 		printf("\t-r, --ht Enable Hyper Threading.\n");
+		printf("\t-R, --rps Use RPS for network IRQs overloading CPU alone.\n");
 		printf("\t-p <path>, --pid=<path> File to save daemon's PID to.\n");
 		printf("\t-x <path>, --pxm=<path> Proximity config file.\n");
+		printf("\t-u <path>, --consumers=<path> Config of applications consuming IRQs data.\n");
+		printf("\t-D <path>, --root=<path> Root directory for procfs and sysfs.\n");
+		printf("\t-w <path>, --record=<path> Record balancing cycles to trace file.\n");
+		printf("\t-W <path>, --replay=<path> Replay trace file offline and check decisions.\n");
+		printf("\t-o <path>, --stats=<path> File to dump self-overhead statistics to on SIGUSR1. Default is stdout.\n");
+		printf("\t-m <path>, --metrics=<path> Prometheus textfile to rewrite after each cycle.\n");
+		printf("\t-C <path>, --control=<path> Unix socket for runtime control commands.\n");
+		printf("\t-e <path>, --events=<path> Structured event log (JSON lines).\n");
+		printf("\t-L <level>, --event-level=<level> Max level of logged events (error/warning/info/debug). Default is info.\n");
+		printf("\t-E <num>, --event-rate=<num> Max number of logged events per second. 0 - unlimited. Default is %u.\n",
+			EVENT_DEFAULT_RATE);
+		printf("\t-n <path>, --dry-run=<path> Don't change affinity. Write moves to plan file.\n");
+		printf("\t-a <path>, --apply-plan=<path> Validate and apply plan file then exit.\n");
+		printf("\t-S <path>, --state=<path> State file to restore on start and to save periodically and on exit.\n");
 		printf("\t-O, --facility Syslog facility. Default is DAEMON.\n");
 		printf("\t-t <float>, --threshold=<float> Threshold to consider CPU is overloaded, in percents. Default threhold is %.2f.\n",
 			BIRQ_DEFAULT_THRESHOLD);
@@ -455,5 +731,7 @@ static void help(int status, const char *argv0)
 		printf("\t-i <sec>, --short-interval=<sec> Short iteration interval.\n");
 		printf("\t-I <sec>, --long-interval=<sec> Long iteration interval.\n");
 		printf("\t-s <strategy>, --strategy=<strategy> Strategy to choose IRQ to move (min/max/rnd).\n");
+		printf("\t-k <ms>, --cooldown=<ms> Don't move IRQ again while cooldown. Default is %u ms.\n",
+			BIRQ_DEFAULT_COOLDOWN);
 	}
 }
@@ -16,4 +16,11 @@
 /* Load limit. Don't move IRQs to CPUs loaded more than this limit. */
 #define BIRQ_DEFAULT_LOAD_LIMIT 95.0
 
+/* Don't move IRQ again while cooldown after previous move, in ms. */
+#define BIRQ_DEFAULT_COOLDOWN 5000
+
+/* Interval to save state file, in seconds. The state is saved
+   on exit too. */
+#define BIRQ_STATE_INTERVAL 60
+
 #endif
@@ -0,0 +1,562 @@
+/*
+ * birq-bench
+ *
+ * Microbenchmarks for the per-cycle hot paths of balancer.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#include "lub/list.h"
+#include "cpumask.h"
+#include "hexio.h"
+#include "irq.h"
+#include "cpu.h"
+#include "statistics.h"
+#include "balance.h"
+#include "cycle.h"
+#include "sim.h"
+#include "overhead.h"
+
+#ifndef VERSION
+#define VERSION "1.2.0"
+#endif
+
+#define BENCH_DEFAULT_TIME 200 /* Minimal time of each benchmark, ms */
+#define BENCH_MAX_ITERS (1 << 24)
+#define BENCH_KEYS 1024 /* Number of precomputed search keys */
+#define BENCH_IRQS_PER_DEV 32 /* Number of IRQs per simulated device */
+#define BENCH_CPUS_PER_NODE 64
+#define BENCH_APPLY_IRQS 100 /* Number of IRQs moved by one rebalance */
+
+/*--------------------------------------------------------- */
+typedef void (*bench_fn)(void *arg);
+
+static unsigned int min_time = BENCH_DEFAULT_TIME;
+static const char *filter = NULL;
+static int stdout_fd = -1;
+
+static void help(int status, const char *argv0);
+
+/*--------------------------------------------------------- */
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*--------------------------------------------------------- */
+/* The balancer's output is not interesting */
+static void quiet(int on)
+{
+	fflush(stdout);
+	if (on) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		stdout_fd = dup(STDOUT_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		close(null_fd);
+	} else if (stdout_fd >= 0) {
+		dup2(stdout_fd, STDOUT_FILENO);
+		close(stdout_fd);
+		stdout_fd = -1;
+	}
+}
+
+/*--------------------------------------------------------- */
+static int bench_enabled(const char *name)
+{
+	return !filter || strstr(name, filter);
+}
+
+/*--------------------------------------------------------- */
+/* Run function while total time is less than min_time. The number
+   of iterations is doubled each time. */
+static void bench_run(const char *name, unsigned int cpus,
+	unsigned int irqs, bench_fn fn, void *arg)
+{
+	unsigned long iters = 1;
+	unsigned long long elapsed;
+	unsigned long long allocated;
+
+	while (1) {
+		unsigned long i;
+		unsigned long long start;
+
+		quiet(1);
+		allocated = overhead_allocs();
+		start = now_ns();
+		for (i = 0; i < iters; i++)
+			fn(arg);
+		elapsed = now_ns() - start;
+		allocated = overhead_allocs() - allocated;
+		quiet(0);
+		if ((elapsed >= (unsigned long long)min_time * 1000000) ||
+			(iters >= BENCH_MAX_ITERS))
+			break;
+		iters *= 2;
+	}
+
+	printf("bench=%s cpus=%u irqs=%u iters=%lu ns_op=%.1f "
+		"allocs_op=%.2f\n", name, cpus, irqs, iters,
+		(double)elapsed / iters, (double)allocated / iters);
+	fflush(stdout);
+}
+
+/*--------------------------------------------------------- */
+/* In-memory CPU and IRQ lists. Each IRQ is bound to single CPU. */
+struct bench_lists_s {
+	lub_list_t *cpus;
+	lub_list_t *irqs;
+	cpumask_t mask;
+	unsigned int keys[BENCH_KEYS];
+	unsigned int key;
+	unsigned int cpu_num;
+	lub_list_node_t *moved; /* Last IRQ moved by link bench */
+	cpu_t *index[NR_CPUS]; /* CPUs by ID */
+};
+typedef struct bench_lists_s bench_lists_t;
+
+static bench_lists_t *lists_new(unsigned int cpu_num, unsigned int irq_num)
+{
+	bench_lists_t *l;
+	unsigned int i;
+
+	l = malloc(sizeof(*l));
+	l->cpus = lub_list_new(cpu_list_compare);
+	l->irqs = lub_list_new(irq_list_compare);
+	cpus_init(l->mask);
+	cpus_setall(l->mask);
+	for (i = 0; i < cpu_num; i++) {
+		cpu_t *cpu = cpu_list_add_id(l->cpus, i);
+		cpu->load = (float)(rand() % 10000) / 100;
+	}
+	for (i = 0; i < irq_num; i++) {
+		irq_t *irq = irq_list_add(l->irqs, i + 1);
+		cpus_clear(irq->affinity);
+		cpu_set(i % cpu_num, irq->affinity);
+	}
+	for (i = 0; i < BENCH_KEYS; i++)
+		l->keys[i] = rand() % irq_num + 1;
+	l->key = 0;
+	l->cpu_num = cpu_num;
+	l->moved = NULL;
+	cpu_list_index(l->cpus, l->index);
+	link_irqs_to_cpus(l->index);
+
+	return l;
+}
+
+static void lists_free(bench_lists_t *l)
+{
+	irq_list_free(l->irqs);
+	cpu_list_free(l->cpus);
+	cpus_free(l->mask);
+	free(l);
+}
+
+static void bench_irq_list_search(void *arg)
+{
+	bench_lists_t *l = arg;
+
+	irq_list_search(l->irqs, l->keys[l->key++ % BENCH_KEYS]);
+}
+
+static void bench_choose_cpu(void *arg)
+{
+	bench_lists_t *l = arg;
+
+	choose_cpu(l->cpus, &l->mask, NULL, 95.0);
+}
+
+static void bench_link_irqs_to_cpus(void *arg)
+{
+	bench_lists_t *l = arg;
+	irq_t *irq;
+	unsigned int cpu;
+
+	/* Only changed IRQs are relinked. So move next IRQ to another
+	   CPU like external affinity change. */
+	if (!l->moved || !(l->moved = lub_list_iterator_next(l->moved)))
+		l->moved = lub_list_iterator_init(l->irqs);
+	irq = (irq_t *)lub_list_node__get_data(l->moved);
+	cpu = first_cpu(irq->affinity);
+	cpu_clear(cpu, irq->affinity);
+	cpu_set((cpu + 1) % l->cpu_num, irq->affinity);
+	irq_changed(irq);
+	link_irqs_to_cpus(l->index);
+}
+/*--------------------------------------------------------- */
+/* Hex masks like /proc/irq/<IRQ>/smp_affinity and CPU lists like
+   /proc/irq/<IRQ>/smp_affinity_list */
+struct bench_hex_s {
+	BIT_ARRAY *bits;
+	char *buf;
+	size_t len;
+	char *list;
+	size_t list_len;
+};
+typedef struct bench_hex_s bench_hex_t;
+
+static void bench_bitmask_parse_user(void *arg)
+{
+	bench_hex_t *h = arg;
+
+	bitmask_parse_user(h->buf, h->len, h->bits);
+}
+
+static void bench_bitmask_scnprintf(void *arg)
+{
+	bench_hex_t *h = arg;
+
+	bitmask_scnprintf(h->buf, h->len + 1, h->bits);
+}
+
+static void bench_bitmask_parse_list(void *arg)
+{
+	bench_hex_t *h = arg;
+
+	bitmask_parse_list(h->list, h->list_len, h->bits);
+}
+
+static void bench_bitmask_scnlistprintf(void *arg)
+{
+	bench_hex_t *h = arg;
+
+	bitmask_scnlistprintf(h->list, h->list_len + 1, h->bits);
+}
+
+static void run_hex(unsigned int nbits)
+{
+	bench_hex_t h;
+	unsigned int i;
+
+	h.bits = bit_array_create(nbits);
+	for (i = 0; i < nbits; i += 3)
+		bit_array_set_bit(h.bits, i);
+	h.len = nbits / 4 + nbits / 32 + 1;
+	h.buf = malloc(h.len + 1);
+	h.len = bitmask_scnprintf(h.buf, h.len + 1, h.bits);
+	h.list_len = bitmask_scnlistprintf(NULL, 0, h.bits);
+	h.list = malloc(h.list_len + 1);
+	bitmask_scnlistprintf(h.list, h.list_len + 1, h.bits);
+
+	if (bench_enabled("bitmask_parse_user"))
+		bench_run("bitmask_parse_user", nbits, 0,
+			bench_bitmask_parse_user, &h);
+	if (bench_enabled("bitmask_scnprintf"))
+		bench_run("bitmask_scnprintf", nbits, 0,
+			bench_bitmask_scnprintf, &h);
+	if (bench_enabled("bitmask_parse_list"))
+		bench_run("bitmask_parse_list", nbits, 0,
+			bench_bitmask_parse_list, &h);
+	if (bench_enabled("bitmask_scnlistprintf"))
+		bench_run("bitmask_scnlistprintf", nbits, 0,
+			bench_bitmask_scnlistprintf, &h);
+
+	free(h.list);
+	free(h.buf);
+	bit_array_free(h.bits);
+}
+
+/*--------------------------------------------------------- */
+/* Full-size cpumask operations */
+struct bench_mask_s {
+	cpumask_t a;
+	cpumask_t b;
+	cpumask_t dst;
+	unsigned int weight; /* Result. Else the call can be optimized out. */
+};
+typedef struct bench_mask_s bench_mask_t;
+
+static void bench_cpus_weight(void *arg)
+{
+	bench_mask_t *m = arg;
+
+	m->weight = cpus_weight(m->a);
+}
+
+static void bench_cpus_and(void *arg)
+{
+	bench_mask_t *m = arg;
+
+	cpus_and(m->dst, m->a, m->b);
+}
+
+static void run_mask(void)
+{
+	bench_mask_t m;
+	unsigned int i;
+
+	cpus_init(m.a);
+	cpus_init(m.b);
+	cpus_init(m.dst);
+	for (i = 0; i < NR_CPUS; i++) {
+		if (rand() % 2)
+			cpu_set(i, m.a);
+		if (rand() % 2)
+			cpu_set(i, m.b);
+	}
+	if (bench_enabled("cpus_weight"))
+		bench_run("cpus_weight", NR_CPUS, 0, bench_cpus_weight, &m);
+	if (bench_enabled("cpus_and"))
+		bench_run("cpus_and", NR_CPUS, 0, bench_cpus_and, &m);
+	cpus_free(m.a);
+	cpus_free(m.b);
+	cpus_free(m.dst);
+}
+
+/*--------------------------------------------------------- */
+/* Parsing of procfs/sysfs. The synthetic tree is generated by
+   simulator. */
+struct bench_tree_s {
+	cycle_t *cycle;
+	unsigned long long now;
+	lub_list_t *apply; /* IRQs to write affinity for */
+};
+typedef struct bench_tree_s bench_tree_t;
+
+static void bench_scan_irqs(void *arg)
+{
+	bench_tree_t *t = arg;
+	lub_list_node_t *node;
+
+	scan_irqs(t->cycle->irqs, t->cycle->balance_irqs, t->cycle->pxms);
+	while ((node = lub_list__get_tail(t->cycle->balance_irqs))) {
+		lub_list_del(t->cycle->balance_irqs, node);
+		lub_list_node_free(node);
+	}
+}
+
+static void bench_gather_statistics(void *arg)
+{
+	bench_tree_t *t = arg;
+
+	t->now += 1000;
+	gather_statistics(t->cycle->cpus, t->cycle->irqs, t->now);
+}
+
+/* Startup discovery of CPUs and NUMA nodes */
+static void bench_cycle_scan(void *arg)
+{
+	cycle_t *cycle = cycle_new();
+
+	cycle_scan(cycle, NULL);
+	cycle_free(cycle);
+}
+
+/* Rebalance of BENCH_APPLY_IRQS IRQs */
+static void bench_apply_affinity(void *arg)
+{
+	bench_tree_t *t = arg;
+
+	apply_affinity(t->apply);
+}
+
+static int run_tree(unsigned int cpu_num, unsigned int irq_num)
+{
+	sim_t *sim;
+	bench_tree_t t;
+	unsigned int i;
+
+	if (!bench_enabled("scan_irqs") && !bench_enabled("gather_statistics") &&
+		!bench_enabled("apply_affinity") && !bench_enabled("cycle_scan"))
+		return 0;
+
+	sim = sim_new();
+	sim->cpu_num = cpu_num;
+	for (i = 0; i < cpu_num; i += BENCH_CPUS_PER_NODE) {
+		sim_node_t *node = &sim->nodes[sim->node_num];
+		unsigned int j;
+		node->id = sim->node_num++;
+		cpus_init(node->cpumask);
+		cpus_clear(node->cpumask);
+		for (j = i; (j < i + BENCH_CPUS_PER_NODE) && (j < cpu_num); j++)
+			cpu_set(j, node->cpumask);
+	}
+	for (i = 0; i < irq_num; i++) {
+		unsigned int dev = i / BENCH_IRQS_PER_DEV;
+		char pci_addr[32];
+		char desc[32];
+		sim_irq_t *irq;
+		snprintf(pci_addr, sizeof(pci_addr), "0000:%02x:%02x.0",
+			dev / 32 + 1, dev % 32);
+		snprintf(desc, sizeof(desc), "eth%u-rx-%u",
+			dev, i % BENCH_IRQS_PER_DEV);
+		irq = sim_add_irq(sim, i + 32, pci_addr, desc);
+		irq->node = dev % sim->node_num;
+		irq->cpu = i % cpu_num;
+		irq->rate = 1000;
+	}
+	if (sim_setup(sim) < 0) {
+		sim_free(sim);
+		return -1;
+	}
+	sim_step(sim, 0, 1);
+
+	/* Initial scan */
+	quiet(1);
+	t.cycle = cycle_new();
+	t.now = SIM_START_TIME;
+	cycle_scan(t.cycle, NULL);
+	bench_scan_irqs(&t);
+	link_irqs_to_cpus(t.cycle->cpu_index);
+	bench_gather_statistics(&t);
+	quiet(0);
+
+	if (bench_enabled("cycle_scan"))
+		bench_run("cycle_scan", cpu_num, 0, bench_cycle_scan, NULL);
+	if (bench_enabled("scan_irqs"))
+		bench_run("scan_irqs", cpu_num, irq_num, bench_scan_irqs, &t);
+	if (bench_enabled("gather_statistics"))
+		bench_run("gather_statistics", cpu_num, irq_num,
+			bench_gather_statistics, &t);
+	if (bench_enabled("apply_affinity")) {
+		lub_list_node_t *iter;
+		lub_list_node_t *node;
+		unsigned int num = 0;
+		t.apply = lub_list_new(irq_list_compare);
+		for (iter = lub_list_iterator_init(t.cycle->irqs);
+			iter && (num < BENCH_APPLY_IRQS);
+			iter = lub_list_iterator_next(iter), num++)
+			lub_list_add(t.apply, lub_list_node__get_data(iter));
+		bench_run("apply_affinity", cpu_num, num,
+			bench_apply_affinity, &t);
+		while ((node = lub_list__get_tail(t.apply))) {
+			lub_list_del(t.apply, node);
+			lub_list_node_free(node);
+		}
+		lub_list_free(t.apply);
+	}
+
+	cycle_free(t.cycle);
+	sim_cleanup(sim);
+	sim_free(sim);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+int main(int argc, char **argv)
+{
+	static const char *shortopts = "ht:b:";
+#ifdef HAVE_GETOPT_H
+	static const struct option longopts[] = {
+		{"help",		0, NULL, 'h'},
+		{"time",		1, NULL, 't'},
+		{"bench",		1, NULL, 'b'},
+		{NULL,			0, NULL, 0}
+	};
+#endif
+	static const unsigned int hex_sizes[] = {64, 256, 1024, 4096};
+	static const unsigned int list_cpus[] = {64, 256, 1024, 4096};
+	static const unsigned int list_irqs[] = {1024, 16384};
+	static const unsigned int tree_sizes[][2] = {
+		{64, 1024}, {256, 4096}, {4096, 1024}};
+	unsigned int i, j;
+
+	while(1) {
+		int opt;
+#ifdef HAVE_GETOPT_H
+		opt = getopt_long(argc, argv, shortopts, longopts, NULL);
+#else
+		opt = getopt(argc, argv, shortopts);
+#endif
+		if (-1 == opt)
+			break;
+		switch (opt) {
+		case 't':
+			min_time = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			filter = optarg;
+			break;
+		case 'h':
+			help(0, argv[0]);
+			return 0;
+		default:
+			help(-1, argv[0]);
+			return -1;
+		}
+	}
+
+	srand(1);
+
+	for (i = 0; i < sizeof(hex_sizes) / sizeof(hex_sizes[0]); i++)
+		run_hex(hex_sizes[i]);
+	run_mask();
+
+	for (i = 0; i < sizeof(list_irqs) / sizeof(list_irqs[0]); i++) {
+		for (j = 0; j < sizeof(list_cpus) / sizeof(list_cpus[0]); j++) {
+			bench_lists_t *l;
+			if (!bench_enabled("irq_list_search") &&
+				!bench_enabled("choose_cpu") &&
+				!bench_enabled("link_irqs_to_cpus"))
+				break;
+			l = lists_new(list_cpus[j], list_irqs[i]);
+			/* The search doesn't depend on number of CPUs */
+			if ((j == 0) && bench_enabled("irq_list_search"))
+				bench_run("irq_list_search", 0, list_irqs[i],
+					bench_irq_list_search, l);
+			/* The choose doesn't depend on number of IRQs */
+			if ((i == 0) && bench_enabled("choose_cpu"))
+				bench_run("choose_cpu", list_cpus[j], 0,
+					bench_choose_cpu, l);
+			if (bench_enabled("link_irqs_to_cpus"))
+				bench_run("link_irqs_to_cpus", list_cpus[j],
+					list_irqs[i], bench_link_irqs_to_cpus, l);
+			lists_free(l);
+		}
+	}
+
+	for (i = 0; i < sizeof(tree_sizes) / sizeof(tree_sizes[0]); i++) {
+		if (run_tree(tree_sizes[i][0], tree_sizes[i][1]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Print help message */
+static void help(int status, const char *argv0)
+{
+	const char *name = NULL;
+
+	if (!argv0)
+		return;
+
+	/* Find the basename */
+	name = strrchr(argv0, '/');
+	if (name)
+		name++;
+	else
+		name = argv0;
+
+	if (status != 0) {
+		fprintf(stderr, "Try `%s -h' for more information.\n",
+			name);
+	} else {
+		printf("Version : %s\n", VERSION);
+		printf("Usage   : %s [options]\n", name);
+		printf("Microbenchmarks for balancer's hot paths.\n");
+		printf("Options :\n");
+		printf("\t-h, --help Print this help.\n");
+		printf("\t-t <ms>, --time=<ms> Minimal time of each benchmark. Default is %u ms.\n",
+			BENCH_DEFAULT_TIME);
+		printf("\t-b <name>, --bench=<name> Run benchmarks with names containing this string only.\n");
+	}
+}
@@ -0,0 +1,306 @@
+/*
+ * birq-sim
+ *
+ * Run the real balancing cycle against simulated system.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#include "balance.h"
+#include "cycle.h"
+#include "sim.h"
+#include "trace.h"
+
+#ifndef VERSION
+#define VERSION "1.2.0"
+#endif
+
+static void help(int status, const char *argv0);
+
+static int stdout_fd = -1;
+
+/*--------------------------------------------------------- */
+/* The balancer's output is not interesting in quiet mode */
+static void quiet(int on)
+{
+	fflush(stdout);
+	if (on) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		stdout_fd = dup(STDOUT_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		close(null_fd);
+	} else if (stdout_fd >= 0) {
+		dup2(stdout_fd, STDOUT_FILENO);
+		close(stdout_fd);
+		stdout_fd = -1;
+	}
+}
+
+/*--------------------------------------------------------- */
+/* Run each strategy over each scenario several times with
+   different seeds. The averaged results are printed. */
+static int compare(sim_t *tmpl, cycle_t *tmpl_cycle,
+	char **scenarios, int num, unsigned int runs)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		char *name = strrchr(scenarios[i], '/');
+		char *ext;
+		int strategy;
+
+		name = strdup(name ? name + 1 : scenarios[i]);
+		if ((ext = strstr(name, ".sim")))
+			*ext = '\0';
+
+		for (strategy = 0; strategy < BIRQ_CHOOSE_NUM; strategy++) {
+			double moves = 0, converge_cycle = 0, converge_time = 0;
+			double ratio = 0, final_max_load = 0, time_above = 0;
+			unsigned int r;
+
+			for (r = 0; r < runs; r++) {
+				sim_t *sim = sim_new();
+				cycle_t *cycle = cycle_new();
+				int res;
+
+				sim->short_interval = tmpl->short_interval;
+				sim->long_interval = tmpl->long_interval;
+				sim->seed = tmpl->seed + r;
+				cycle->threshold = tmpl_cycle->threshold;
+				cycle->load_limit = tmpl_cycle->load_limit;
+				cycle->cooldown = tmpl_cycle->cooldown;
+				cycle->rps = tmpl_cycle->rps;
+				cycle->strategy = strategy;
+				if ((res = sim_parse_scenario(sim, scenarios[i])) == 0) {
+					quiet(1);
+					res = sim_run(sim, cycle);
+					quiet(0);
+				}
+				if (res < 0) {
+					cycle_free(cycle);
+					sim_free(sim);
+					free(name);
+					return -1;
+				}
+				moves += sim->moves;
+				converge_cycle += sim->converge_cycle;
+				converge_time += sim->converge_time;
+				ratio += sim->ratio;
+				final_max_load += sim->final_max_load;
+				time_above += sim->time_above;
+				cycle_free(cycle);
+				sim_free(sim);
+			}
+
+			printf("scenario=%s strategy=%s runs=%u moves=%.1f "
+				"converge_cycle=%.1f converge_time=%.1f "
+				"ratio=%.3f final_max_load=%.2f time_above=%.1f\n",
+				name, balance_strategy_name(strategy), runs,
+				moves / runs, converge_cycle / runs,
+				converge_time / runs, ratio / runs,
+				final_max_load / runs, time_above / runs);
+			fflush(stdout);
+		}
+		free(name);
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+int main(int argc, char **argv)
+{
+	static const char *shortopts = "ht:l:s:c:i:I:S:D:w:kqvran:";
+#ifdef HAVE_GETOPT_H
+	static const struct option longopts[] = {
+		{"help",		0, NULL, 'h'},
+		{"threshold",		1, NULL, 't'},
+		{"load-limit",		1, NULL, 'l'},
+		{"strategy",		1, NULL, 's'},
+		{"cooldown",		1, NULL, 'c'},
+		{"short-interval",	1, NULL, 'i'},
+		{"long-interval",	1, NULL, 'I'},
+		{"seed",		1, NULL, 'S'},
+		{"root",		1, NULL, 'D'},
+		{"record",		1, NULL, 'w'},
+		{"keep",		0, NULL, 'k'},
+		{"quiet",		0, NULL, 'q'},
+		{"verbose",		0, NULL, 'v'},
+		{"rps",			0, NULL, 'r'},
+		{"all",			0, NULL, 'a'},
+		{"runs",		1, NULL, 'n'},
+		{NULL,			0, NULL, 0}
+	};
+#endif
+	sim_t *sim;
+	cycle_t *cycle;
+	char *record = NULL;
+	int all = 0;
+	unsigned int runs = 1;
+	int retval = -1;
+
+	sim = sim_new();
+	cycle = cycle_new();
+	sim->trace = stdout;
+
+	while(1) {
+		int opt;
+#ifdef HAVE_GETOPT_H
+		opt = getopt_long(argc, argv, shortopts, longopts, NULL);
+#else
+		opt = getopt(argc, argv, shortopts);
+#endif
+		if (-1 == opt)
+			break;
+		switch (opt) {
+		case 't':
+			cycle->threshold = strtof(optarg, NULL);
+			break;
+		case 'l':
+			cycle->load_limit = strtof(optarg, NULL);
+			break;
+		case 's':
+			if (balance_strategy(optarg, &cycle->strategy) < 0) {
+				fprintf(stderr, "Error: Illegal strategy value %s.\n", optarg);
+				help(-1, argv[0]);
+				goto err;
+			}
+			break;
+		case 'c':
+			cycle->cooldown = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			sim->short_interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'I':
+			sim->long_interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			sim->seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'D':
+			free(sim->root);
+			sim->root = strdup(optarg);
+			sim->keep = 1;
+			break;
+		case 'w':
+			record = optarg;
+			break;
+		case 'k':
+			sim->keep = 1;
+			break;
+		case 'q':
+			sim->quiet = 1;
+			break;
+		case 'v':
+			cycle->verbose = 1;
+			balance_verbose(1);
+			break;
+		case 'r':
+			cycle->rps = 1;
+			break;
+		case 'a':
+			all = 1;
+			break;
+		case 'n':
+			runs = strtoul(optarg, NULL, 10);
+			if (!runs)
+				runs = 1;
+			break;
+		case 'h':
+			help(0, argv[0]);
+			retval = 0;
+			goto err;
+		default:
+			help(-1, argv[0]);
+			goto err;
+		}
+	}
+	if (optind >= argc) {
+		help(-1, argv[0]);
+		goto err;
+	}
+	if (all) {
+		retval = compare(sim, cycle, argv + optind, argc - optind, runs);
+		goto err;
+	}
+	if (sim_parse_scenario(sim, argv[optind]) < 0)
+		goto err;
+	if (record && !(cycle->trace = trace_open(record, cycle))) {
+		fprintf(stderr, "Error: Can't open trace %s\n", record);
+		goto err;
+	}
+
+	if (sim->quiet) {
+		quiet(1);
+		sim->trace = NULL;
+	}
+	retval = sim_run(sim, cycle);
+	quiet(0);
+	if (!retval)
+		sim_show(sim, stdout);
+	if (!retval && sim->keep)
+		fprintf(stderr, "Fake root: %s\n", sim->root);
+
+err:
+	cycle_free(cycle);
+	sim_free(sim);
+
+	return retval;
+}
+
+/*--------------------------------------------------------- */
+/* Print help message */
+static void help(int status, const char *argv0)
+{
+	const char *name = NULL;
+
+	if (!argv0)
+		return;
+
+	/* Find the basename */
+	name = strrchr(argv0, '/');
+	if (name)
+		name++;
+	else
+		name = argv0;
+
+	if (status != 0) {
+		fprintf(stderr, "Try `%s -h' for more information.\n",
+			name);
+	} else {
+		printf("Version : %s\n", VERSION);
+		printf("Usage   : %s [options] <scenario>\n", name);
+		printf("          %s -a [options] <scenario> [<scenario> ...]\n", name);
+		printf("Run IRQ balancing on simulated system.\n");
+		printf("Options :\n");
+		printf("\t-h, --help Print this help.\n");
+		printf("\t-q, --quiet Print results only.\n");
+		printf("\t-v, --verbose Be verbose.\n");
+		printf("\t-t <float>, --threshold=<float> Threshold to consider CPU is overloaded, in percents.\n");
+		printf("\t-l <float>, --load-limit=<float> Don't move IRQs to CPUs loaded more than this limit, in percents.\n");
+		printf("\t-s <strategy>, --strategy=<strategy> Strategy to choose IRQ to move (min/max/rnd).\n");
+		printf("\t-c <ms>, --cooldown=<ms> Don't move IRQ again while cooldown.\n");
+		printf("\t-i <sec>, --short-interval=<sec> Short iteration interval.\n");
+		printf("\t-I <sec>, --long-interval=<sec> Long iteration interval.\n");
+		printf("\t-S <num>, --seed=<num> Seed for random choose.\n");
+		printf("\t-D <path>, --root=<path> Generate fake procfs/sysfs within this directory and keep it.\n");
+		printf("\t-w <path>, --record=<path> Record balancing cycles to trace file.\n");
+		printf("\t-k, --keep Don't remove generated fake procfs/sysfs.\n");
+		printf("\t-r, --rps Use RPS for network IRQs overloading CPU alone.\n");
+		printf("\t-a, --all Compare all strategies over the scenarios.\n");
+		printf("\t-n <num>, --runs=<num> Number of runs with different seeds for each strategy.\n");
+	}
+}
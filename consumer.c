@@ -0,0 +1,485 @@
+/* consumer.c
+ * Co-locate IRQs with the applications consuming their data.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <limits.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "lub/list.h"
+#include "cpu.h"
+#include "irq.h"
+#include "path.h"
+#include "consumer.h"
+
+/* The last-run CPU is 39th field of /proc/<pid>/stat */
+#define STAT_PROCESSOR_FIELD 39
+/* Buffer for /proc/<pid>/status */
+#define STATUS_FILE_MAX (NR_CPUS + 4096)
+
+static const char *type_names[] = {
+	"pid",
+	"comm",
+	"cgroup"
+};
+
+static consumer_t * consumer_new(const char *pattern, consumer_type_e type,
+	const char *arg)
+{
+	consumer_t *new;
+
+	if (!(new = malloc(sizeof(*new))))
+		return NULL;
+	new->pattern = strdup(pattern);
+	new->type = type;
+	new->arg = strdup(arg);
+	new->procs = 0;
+	new->pids = NULL;
+	new->pids_num = 0;
+	new->age = CONSUMER_RESCAN; /* Walk /proc on first update */
+	cpus_init(new->run);
+	cpus_init(new->allowed);
+	cpus_init(new->prefer);
+	cpus_clear(new->run);
+	cpus_clear(new->allowed);
+	cpus_clear(new->prefer);
+
+	return new;
+}
+
+static void consumer_free(consumer_t *consumer)
+{
+	if (!consumer)
+		return;
+	free(consumer->pattern);
+	free(consumer->arg);
+	free(consumer->pids);
+	cpus_free(consumer->run);
+	cpus_free(consumer->allowed);
+	cpus_free(consumer->prefer);
+	free(consumer);
+}
+
+int consumer_list_free(lub_list_t *consumers)
+{
+	lub_list_node_t *iter;
+	while ((iter = lub_list__get_head(consumers))) {
+		consumer_t *consumer;
+		consumer = (consumer_t *)lub_list_node__get_data(iter);
+		consumer_free(consumer);
+		lub_list_del(consumers, iter);
+		lub_list_node_free(iter);
+	}
+	lub_list_free(consumers);
+	return 0;
+}
+
+/* Show consumer information */
+static void show_consumer_info(consumer_t *consumer)
+{
+	char run[NR_CPUS + 1];
+	char prefer[NR_CPUS + 1];
+
+	cpulist_scnprintf(run, sizeof(run), consumer->run);
+	cpulist_scnprintf(prefer, sizeof(prefer), consumer->prefer);
+	run[sizeof(run) - 1] = '\0';
+	prefer[sizeof(prefer) - 1] = '\0';
+	printf("Consumer: %s %s %s procs %u run %s prefer %s\n",
+		consumer->pattern, type_names[consumer->type], consumer->arg,
+		consumer->procs, run, prefer);
+}
+
+/* Show consumer list */
+int show_consumers(lub_list_t *consumers)
+{
+	lub_list_node_t *iter;
+	for (iter = lub_list_iterator_init(consumers); iter;
+		iter = lub_list_iterator_next(iter)) {
+		consumer_t *consumer;
+		consumer = (consumer_t *)lub_list_node__get_data(iter);
+		show_consumer_info(consumer);
+	}
+	return 0;
+}
+
+/* Get last-run CPU and allowed CPUs of process. The procfd is
+   opened /proc directory. Returns -1 if process is gone. */
+static int consumer_add_proc(consumer_t *consumer, int procfd,
+	const char *pid)
+{
+	char name[PATH_MAX];
+	char buf[STATUS_FILE_MAX];
+	char *str;
+	char *saveptr = NULL;
+	char *endptr;
+	unsigned long cpu;
+	unsigned int field;
+	cpumask_t allowed;
+
+	snprintf(name, sizeof(name), "%s/stat", pid);
+	name[sizeof(name) - 1] = '\0';
+	if (path_read_at(procfd, name, buf, sizeof(buf)) < 0)
+		return -1;
+	/* The comm can contain spaces and brackets */
+	if (!(str = strrchr(buf, ')')))
+		return -1;
+	str = strtok_r(str + 1, " ", &saveptr);
+	for (field = 3; str && (field < STAT_PROCESSOR_FIELD); field++)
+		str = strtok_r(NULL, " ", &saveptr);
+	if (!str)
+		return -1;
+	cpu = strtoul(str, &endptr, 10);
+	if ((endptr == str) || (cpu >= NR_CPUS))
+		return -1;
+	cpu_set(cpu, consumer->run);
+	consumer->procs++;
+
+	snprintf(name, sizeof(name), "%s/status", pid);
+	name[sizeof(name) - 1] = '\0';
+	if (path_read_at(procfd, name, buf, sizeof(buf)) < 0)
+		return 0;
+	if (!(str = strstr(buf, "\nCpus_allowed_list:")))
+		return 0;
+	str += strlen("\nCpus_allowed_list:");
+	str += strspn(str, " \t");
+	str[strcspn(str, "\n")] = '\0';
+	cpus_init(allowed);
+	if (cpulist_parse(str, strlen(str), allowed) == 0)
+		cpus_or(consumer->allowed, consumer->allowed, allowed);
+	cpus_free(allowed);
+
+	return 0;
+}
+
+/* Get processes of cgroup from cgroup.procs file */
+static int consumer_scan_cgroup(consumer_t *consumer, int procfd)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	char *line = NULL;
+	size_t size = 0;
+
+	path_build(path, sizeof(path), "%s/%s/cgroup.procs",
+		SYSFS_CGROUP_PATH, consumer->arg);
+	path[sizeof(path) - 1] = '\0';
+	if (!(file = fopen(path, "r")))
+		return -1;
+	while (getline(&line, &size, file) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		consumer_add_proc(consumer, procfd, line);
+	}
+	free(line);
+	fclose(file);
+
+	return 0;
+}
+
+/* Read comm of process. Returns -1 if process is gone. */
+static int consumer_read_comm(int procfd, const char *pid, char *comm,
+	size_t size)
+{
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), "%s/comm", pid);
+	name[sizeof(name) - 1] = '\0';
+	if (path_read_at(procfd, name, comm, size) < 0)
+		return -1;
+	comm[strcspn(comm, "\n")] = '\0';
+
+	return 0;
+}
+
+/* Get the cached processes of comm consumer. Returns -1 if some
+   process is gone or doesn't match anymore (PID is reused). */
+static int consumer_scan_cached(consumer_t *consumer, int procfd)
+{
+	unsigned int i;
+
+	for (i = 0; i < consumer->pids_num; i++) {
+		char pid[16];
+		char comm[64];
+
+		snprintf(pid, sizeof(pid), "%u", consumer->pids[i]);
+		if (consumer_read_comm(procfd, pid, comm, sizeof(comm)) < 0)
+			return -1;
+		if (fnmatch(consumer->arg, comm, 0))
+			return -1;
+		if (consumer_add_proc(consumer, procfd, pid) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Walk through /proc once for all consumers specified by comm. The
+   matched processes are cached. */
+static int consumer_scan_comm(lub_list_t *consumers)
+{
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *dent;
+	lub_list_node_t *iter;
+
+	for (iter = lub_list_iterator_init(consumers); iter;
+		iter = lub_list_iterator_next(iter)) {
+		consumer_t *consumer;
+		consumer = (consumer_t *)lub_list_node__get_data(iter);
+		if (consumer->type != CONSUMER_COMM)
+			continue;
+		consumer->procs = 0;
+		consumer->pids_num = 0;
+		consumer->age = 0;
+		cpus_clear(consumer->run);
+		cpus_clear(consumer->allowed);
+	}
+
+	path_build(path, sizeof(path), "%s", PROC_PATH);
+	path[sizeof(path) - 1] = '\0';
+	if (!(dir = opendir(path)))
+		return -1;
+	while ((dent = readdir(dir))) {
+		char comm[64];
+
+		if (!isdigit(dent->d_name[0]))
+			continue;
+		if (consumer_read_comm(dirfd(dir), dent->d_name,
+			comm, sizeof(comm)) < 0)
+			continue;
+		for (iter = lub_list_iterator_init(consumers); iter;
+			iter = lub_list_iterator_next(iter)) {
+			consumer_t *consumer;
+			consumer = (consumer_t *)lub_list_node__get_data(iter);
+			if (consumer->type != CONSUMER_COMM)
+				continue;
+			if (fnmatch(consumer->arg, comm, 0))
+				continue;
+			if (consumer_add_proc(consumer, dirfd(dir),
+				dent->d_name) < 0)
+				continue;
+			consumer->pids = realloc(consumer->pids,
+				(consumer->pids_num + 1) * sizeof(*consumer->pids));
+			assert(consumer->pids);
+			consumer->pids[consumer->pids_num++] =
+				strtoul(dent->d_name, NULL, 10);
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/* Search for CPU by ID. The second threads of Hyper Threading
+   can be absent in CPU list. Then the sibling is used. */
+static cpu_t * consumer_cpu_search(lub_list_t *cpus, unsigned int id)
+{
+	lub_list_node_t *iter;
+	cpu_t *cpu;
+
+	if ((cpu = cpu_list_search(cpus, id)))
+		return cpu;
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu = (cpu_t *)lub_list_node__get_data(iter);
+		if (cpu_isset(id, cpu->siblings))
+			return cpu;
+	}
+
+	return NULL;
+}
+
+/* The preferred CPUs share last level cache with consumer but
+   belong to another core. So IRQ handler doesn't fight with consumer
+   for the core. If consumer is pinned then its allowed CPUs are
+   avoided too if possible. */
+static void consumer_prefer(consumer_t *consumer, lub_list_t *cpus)
+{
+	cpumask_t near;
+	cpumask_t busy;
+	unsigned int id;
+
+	cpus_clear(consumer->prefer);
+	if (cpus_empty(consumer->run))
+		return;
+	cpus_init(near);
+	cpus_init(busy);
+	cpus_clear(near);
+	cpus_clear(busy);
+	for (id = first_cpu(consumer->run); id < NR_CPUS;
+		id = next_cpu(id, consumer->run)) {
+		cpu_t *cpu;
+		cpu_set(id, busy);
+		if (!(cpu = consumer_cpu_search(cpus, id)))
+			continue;
+		cpus_or(near, near, cpu->llc);
+		cpus_or(busy, busy, cpu->siblings);
+	}
+	cpus_andnot(consumer->prefer, near, busy);
+	/* Don't use CPUs the consumer is allowed to run on */
+	cpus_andnot(busy, consumer->prefer, consumer->allowed);
+	if (!cpus_empty(busy))
+		cpus_copy(consumer->prefer, busy);
+	cpus_free(near);
+	cpus_free(busy);
+}
+
+/* Find consumer for IRQ. The longest pattern wins. */
+static consumer_t * consumer_search(lub_list_t *consumers, irq_t *irq)
+{
+	lub_list_node_t *iter;
+	consumer_t *found = NULL;
+	size_t maxlen = 0;
+
+	for (iter = lub_list_iterator_init(consumers); iter;
+		iter = lub_list_iterator_next(iter)) {
+		consumer_t *consumer;
+		size_t len;
+
+		consumer = (consumer_t *)lub_list_node__get_data(iter);
+		if (!(irq->desc && strstr(irq->desc, consumer->pattern)) &&
+			!(irq->pci_addr && strstr(irq->pci_addr,
+			consumer->pattern)))
+			continue;
+		len = strlen(consumer->pattern);
+		if (maxlen >= len)
+			continue;
+		maxlen = len;
+		found = consumer;
+	}
+
+	return found;
+}
+
+/* Find out where the consumers run and set preferred CPUs
+   for their IRQs. The local CPUs of IRQ are required anyway. */
+int consumer_update(lub_list_t *consumers, lub_list_t *cpus,
+	lub_list_t *irqs)
+{
+	lub_list_node_t *iter;
+	int procfd;
+	int rescan = 0;
+
+	if ((procfd = path_open_dir("%s", PROC_PATH)) < 0)
+		return -1;
+	for (iter = lub_list_iterator_init(consumers); iter;
+		iter = lub_list_iterator_next(iter)) {
+		consumer_t *consumer;
+		consumer = (consumer_t *)lub_list_node__get_data(iter);
+		consumer->procs = 0;
+		cpus_clear(consumer->run);
+		cpus_clear(consumer->allowed);
+		if (consumer->type == CONSUMER_PID)
+			consumer_add_proc(consumer, procfd, consumer->arg);
+		else if (consumer->type == CONSUMER_CGROUP)
+			consumer_scan_cgroup(consumer, procfd);
+		else if ((consumer_scan_cached(consumer, procfd) < 0) ||
+			(++consumer->age >= CONSUMER_RESCAN))
+			rescan = 1;
+	}
+	close(procfd);
+	if (rescan)
+		consumer_scan_comm(consumers);
+
+	for (iter = lub_list_iterator_init(consumers); iter;
+		iter = lub_list_iterator_next(iter)) {
+		consumer_t *consumer;
+		consumer = (consumer_t *)lub_list_node__get_data(iter);
+		consumer_prefer(consumer, cpus);
+	}
+
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		consumer_t *consumer;
+		if (!(consumer = consumer_search(consumers, irq))) {
+			cpus_clear(irq->consumer_cpus);
+			continue;
+		}
+		cpus_and(irq->consumer_cpus, consumer->prefer,
+			irq->local_cpus);
+	}
+
+	return 0;
+}
+
+int parse_consumer_config(const char *fname, lub_list_t *consumers)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t size = 0;
+	char *saveptr = NULL;
+	unsigned int ln = 0; /* Line number */
+
+	if (!fname)
+		return -1;
+	file = fopen(fname, "r");
+	if (!file)
+		return -1;
+
+	while (!feof(file)) {
+		char *str = NULL;
+		char *pattern = NULL;
+		char *cmd = NULL;
+		char *arg = NULL;
+		consumer_t *consumer;
+		consumer_type_e type;
+
+		ln++; /* Next line */
+		if (getline(&line, &size, file) <= 0)
+			continue;
+		/* Find comments */
+		str = strchr(line, '#');
+		if (str)
+			*str = '\0';
+		/* Find \n */
+		str = strchr(line, '\n');
+		if (str)
+			*str = '\0';
+		/* Get IRQ pattern */
+		pattern = strtok_r(line, " ", &saveptr);
+		if (!pattern)
+			continue;
+		/* Get consumer type */
+		cmd = strtok_r(NULL, " ", &saveptr);
+		/* Get PID, comm or cgroup */
+		arg = strtok_r(NULL, " ", &saveptr);
+		if (!cmd || !arg) {
+			fprintf(stderr, "Warning: Illegal line %u in %s\n",
+				ln, fname);
+			continue;
+		}
+
+		if (!strcasecmp(cmd, "pid")) {
+			type = CONSUMER_PID;
+			if (arg[strspn(arg, "0123456789")] != '\0') {
+				fprintf(stderr, "Warning: Wrong PID in "
+					"line %u in %s\n", ln, fname);
+				continue;
+			}
+		} else if (!strcasecmp(cmd, "comm")) {
+			type = CONSUMER_COMM;
+		} else if (!strcasecmp(cmd, "cgroup")) {
+			type = CONSUMER_CGROUP;
+		} else {
+			fprintf(stderr, "Warning: Illegal command %u in %s\n",
+				ln, fname);
+			continue;
+		}
+
+		/* Add new entry to consumer list */
+		if ((consumer = consumer_new(pattern, type, arg)))
+			lub_list_add(consumers, consumer);
+	}
+
+	fclose(file);
+	free(line);
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _consumer_h
+#define _consumer_h
+
+#include "lub/list.h"
+#include "cpumask.h"
+
+typedef enum {
+	CONSUMER_PID,
+	CONSUMER_COMM,
+	CONSUMER_CGROUP
+} consumer_type_e;
+
+/* Application consuming the data of IRQs matched by pattern */
+struct consumer_s {
+	char *pattern; /* Substring of IRQ description or PCI address */
+	consumer_type_e type;
+	char *arg; /* PID, comm glob pattern or cgroup path */
+	unsigned int procs; /* Number of found processes */
+	cpumask_t run; /* Last-run CPUs of consumer's processes */
+	cpumask_t allowed; /* Cpus_allowed_list of consumer's processes */
+	cpumask_t prefer; /* Same LLC as consumer but another core */
+	unsigned int *pids; /* Cached processes matched by comm */
+	unsigned int pids_num;
+	unsigned int age; /* Cycles since last /proc walk */
+};
+typedef struct consumer_s consumer_t;
+
+#define PROC_PATH "/proc"
+/* The /proc is walked for comm consumers when some cached process is
+   gone or changed its name, and once per CONSUMER_RESCAN cycles to
+   find new processes. */
+#define CONSUMER_RESCAN 10
+#define SYSFS_CGROUP_PATH "/sys/fs/cgroup"
+
+int consumer_list_free(lub_list_t *consumers);
+int show_consumers(lub_list_t *consumers);
+int parse_consumer_config(const char *fname, lub_list_t *consumers);
+int consumer_update(lub_list_t *consumers, lub_list_t *cpus,
+	lub_list_t *irqs);
+
+#endif
@@ -0,0 +1,377 @@
+/* control.c
+ * Runtime control socket. The commands are text lines. Each command
+ * gets a reply ended by "OK" or "ERR <reason>" line. The client sockets
+ * are non-blocking, the replies are queued and sent from the poll loop:
+ *   set <param> <value> - Change balancing parameter
+ *   rebalance - Run balancing cycle immediately
+ *   pin <irq> <cpu> - Bind IRQ to CPU and don't move it anymore
+ *   unpin <irq> - Return IRQ under balancer's control
+ *   reload-pxm - Parse proximity config file again
+ *   dump - Show parameters, CPUs, IRQs and self-overhead statistics
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <assert.h>
+
+#include "lub/list.h"
+#include "irq.h"
+#include "cpu.h"
+#include "balance.h"
+#include "overhead.h"
+#include "cycle.h"
+#include "control.h"
+
+/*--------------------------------------------------------- */
+control_t *control_open(const char *path, const char *pxm)
+{
+	control_t *control;
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd;
+	int i;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return NULL;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	/* Only owner can control the daemon */
+	mask = umask(0077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		umask(mask);
+		close(fd);
+		return NULL;
+	}
+	umask(mask);
+	if (listen(fd, CONTROL_MAX_CLIENTS) < 0) {
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+
+	control = malloc(sizeof(*control));
+	assert(control);
+	memset(control, 0, sizeof(*control));
+	control->fd = fd;
+	control->path = strdup(path);
+	control->pxm = pxm ? strdup(pxm) : NULL;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+		control->clients[i].fd = -1;
+
+	return control;
+}
+
+/*--------------------------------------------------------- */
+static void client_close(control_client_t *client)
+{
+	close(client->fd);
+	client->fd = -1;
+	client->len = 0;
+	free(client->out);
+	client->out = NULL;
+	client->out_len = 0;
+	client->eof = 0;
+}
+
+/*--------------------------------------------------------- */
+/* Queue the reply. Returns -1 if client's queue is overflowed. */
+static int client_queue(control_client_t *client, const char *buf,
+	size_t len)
+{
+	if (client->out_len + len > CONTROL_OUT_MAX)
+		return -1;
+	client->out = realloc(client->out, client->out_len + len);
+	assert(client->out);
+	memcpy(client->out + client->out_len, buf, len);
+	client->out_len += len;
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Send queued replies as much as socket accepts. The closed peer
+   doesn't raise SIGPIPE. Returns -1 on error. */
+static int client_flush(control_client_t *client)
+{
+	ssize_t n;
+
+	while (client->out_len) {
+		n = send(client->fd, client->out, client->out_len,
+			MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			return -1;
+		}
+		client->out_len -= n;
+		memmove(client->out, client->out + n, client->out_len);
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+void control_close(control_t *control)
+{
+	int i;
+
+	if (!control)
+		return;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (control->clients[i].fd >= 0)
+			client_close(&control->clients[i]);
+	}
+	close(control->fd);
+	unlink(control->path);
+	free(control->path);
+	free(control->pxm);
+	free(control);
+}
+
+/*--------------------------------------------------------- */
+static int cmd_set(cycle_t *cycle, char **saveptr)
+{
+	char *param = strtok_r(NULL, " \t", saveptr);
+	char *value = strtok_r(NULL, " \t", saveptr);
+	char *endptr;
+
+	if (!param || !value)
+		return -1;
+
+	if (!strcmp(param, "threshold") || !strcmp(param, "load-limit")) {
+		float val = strtof(value, &endptr);
+		if ((endptr == value) || (val < 0) || (val > 100.00))
+			return -1;
+		if (!strcmp(param, "threshold")) {
+			if (cycle->load_limit > val)
+				return -1;
+			cycle->threshold = val;
+		} else {
+			if (val > cycle->threshold)
+				return -1;
+			cycle->load_limit = val;
+		}
+	} else if (!strcmp(param, "strategy")) {
+		if (balance_strategy(value, &cycle->strategy) < 0)
+			return -1;
+	} else {
+		unsigned long val = strtoul(value, &endptr, 10);
+		if (endptr == value)
+			return -1;
+		if (!strcmp(param, "short-interval"))
+			cycle->short_interval = val;
+		else if (!strcmp(param, "long-interval"))
+			cycle->long_interval = val;
+		else if (!strcmp(param, "cooldown") && !*endptr)
+			cycle->cooldown = val;
+		else
+			return -1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static void cmd_dump(cycle_t *cycle, FILE *out)
+{
+	lub_list_node_t *iter;
+
+	fprintf(out, "threshold=%.2f load_limit=%.2f strategy=%s "
+		"cooldown=%u short_interval=%u long_interval=%u "
+		"cycles=%llu moves=%llu\n",
+		cycle->threshold, cycle->load_limit,
+		balance_strategy_name(cycle->strategy), cycle->cooldown,
+		cycle->short_interval, cycle->long_interval,
+		cycle->cycles, cycle->moves_total);
+	for (iter = lub_list_iterator_init(cycle->cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		fprintf(out, "cpu=%u package=%u core=%u load=%.2f "
+			"total_load=%.2f irqs=%u\n",
+			cpu->id, cpu->package_id, cpu->core_id, cpu->load,
+			cpu->total_load, ilist_len(&cpu->irqs));
+	}
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		fprintf(out, "irq=%u cpu=%d rate=%llu moves=%u pinned=%d "
+			"blacklisted=%d errno=%d desc=%s\n",
+			irq->irq, irq->cpu ? (int)irq->cpu->id : -1, irq->rate,
+			irq->moves, irq->pinned, irq->blacklisted,
+			irq->blacklisted ? irq->blacklist_errno : 0,
+			irq->desc ? irq->desc : "");
+	}
+	overhead_dump(cycle->overhead, out);
+}
+
+/*--------------------------------------------------------- */
+/* Execute command. The reply is written to out. */
+static void command(control_t *control, cycle_t *cycle, char *line,
+	FILE *out)
+{
+	char *saveptr = NULL;
+	char *cmd;
+	const char *err = NULL;
+
+	if (!(cmd = strtok_r(line, " \t\r", &saveptr)))
+		return;
+
+	if (!strcmp(cmd, "set")) {
+		if (cmd_set(cycle, &saveptr) < 0)
+			err = "Illegal parameter or value";
+	} else if (!strcmp(cmd, "rebalance")) {
+		control->rebalance = 1;
+	} else if (!strcmp(cmd, "pin") || !strcmp(cmd, "unpin")) {
+		char *num = strtok_r(NULL, " \t\r", &saveptr);
+		char *cpu = strtok_r(NULL, " \t\r", &saveptr);
+		irq_t *irq = NULL;
+		if (num)
+			irq = irq_list_search(cycle->irqs,
+				strtoul(num, NULL, 10));
+		if (!irq)
+			err = "Unknown IRQ";
+		else if (!strcmp(cmd, "unpin"))
+			err = unpin_irq(irq) < 0 ? "IRQ is not pinned" : NULL;
+		else if (!cpu || (pin_irq(cycle->cpus, irq,
+			strtoul(cpu, NULL, 10)) < 0))
+			err = "Can't pin IRQ to CPU";
+	} else if (!strcmp(cmd, "reload-pxm")) {
+		if (!control->pxm)
+			err = "No proximity config file";
+		else if (cycle_reload_pxm(cycle, control->pxm) < 0)
+			err = "Can't parse proximity config file";
+	} else if (!strcmp(cmd, "dump")) {
+		cmd_dump(cycle, out);
+	} else {
+		err = "Unknown command";
+	}
+
+	if (err)
+		fprintf(out, "ERR %s\n", err);
+	else
+		fprintf(out, "OK\n");
+}
+
+/*--------------------------------------------------------- */
+/* Read available data and execute complete command lines. The
+   replies are queued. Returns -1 if client must be closed. */
+static int client_read(control_t *control, control_client_t *client,
+	cycle_t *cycle)
+{
+	ssize_t n;
+	char *eol;
+	FILE *out;
+	char *reply = NULL;
+	size_t reply_len = 0;
+	int ret;
+
+	n = read(client->fd, client->buf + client->len,
+		sizeof(client->buf) - client->len - 1);
+	if (n < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+			(errno == EINTR)) ? 0 : -1;
+	if (n == 0) {
+		client->eof = 1;
+		return 0;
+	}
+	client->len += n;
+	client->buf[client->len] = '\0';
+
+	if (!(out = open_memstream(&reply, &reply_len)))
+		return -1;
+	while ((eol = strchr(client->buf, '\n'))) {
+		*eol = '\0';
+		command(control, cycle, client->buf, out);
+		client->len -= eol + 1 - client->buf;
+		memmove(client->buf, eol + 1, client->len + 1);
+	}
+	/* Too long line */
+	if (client->len >= sizeof(client->buf) - 1) {
+		fprintf(out, "ERR Too long command\n");
+		client->len = 0;
+	}
+	fclose(out);
+	ret = client_queue(client, reply, reply_len);
+	free(reply);
+
+	return ret;
+}
+
+/*--------------------------------------------------------- */
+/* Wait for commands up to timeout, ms. Returns 1 if immediate
+   balancing cycle is requested and 0 else. */
+int control_wait(control_t *control, cycle_t *cycle, int timeout)
+{
+	struct pollfd fds[CONTROL_MAX_CLIENTS + 1];
+	int i;
+
+	if (!control) {
+		poll(NULL, 0, timeout);
+		return 0;
+	}
+
+	fds[0].fd = control->fd;
+	fds[0].events = POLLIN;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		fds[i + 1].fd = control->clients[i].fd;
+		fds[i + 1].events = control->clients[i].eof ? 0 : POLLIN;
+		if (control->clients[i].out_len)
+			fds[i + 1].events |= POLLOUT;
+		fds[i + 1].revents = 0;
+	}
+	if (poll(fds, CONTROL_MAX_CLIENTS + 1, timeout) <= 0)
+		return 0;
+
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		control_client_t *client = &control->clients[i];
+		short revents = fds[i + 1].revents;
+		if ((client->fd < 0) || !revents)
+			continue;
+		if (!client->eof && (revents & (POLLIN | POLLHUP | POLLERR)) &&
+			(client_read(control, client, cycle) < 0)) {
+			client_close(client);
+			continue;
+		}
+		if ((client_flush(client) < 0) ||
+			(client->eof && !client->out_len))
+			client_close(client);
+	}
+
+	if (fds[0].revents & POLLIN) {
+		int fd = accept4(control->fd, NULL, NULL,
+			SOCK_CLOEXEC | SOCK_NONBLOCK);
+		if (fd >= 0) {
+			for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+				if (control->clients[i].fd < 0)
+					break;
+			}
+			if (i < CONTROL_MAX_CLIENTS) {
+				control->clients[i].fd = fd;
+				control->clients[i].len = 0;
+			} else {
+				close(fd);
+			}
+		}
+	}
+
+	i = control->rebalance;
+	control->rebalance = 0;
+
+	return i;
+}
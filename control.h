@@ -0,0 +1,35 @@
+#ifndef _control_h
+#define _control_h
+
+#include "cycle.h"
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_BUF_SIZE 256
+/* Maximal size of unsent replies. The client that doesn't read
+   the replies is dropped. */
+#define CONTROL_OUT_MAX (4 * 1024 * 1024)
+
+struct control_client_s {
+	int fd; /* -1 if slot is free */
+	char buf[CONTROL_BUF_SIZE]; /* Incomplete command line */
+	size_t len;
+	char *out; /* Unsent replies */
+	size_t out_len;
+	int eof; /* Peer has finished sending. Close after replies. */
+};
+typedef struct control_client_s control_client_t;
+
+struct control_s {
+	int fd; /* Listening socket */
+	char *path; /* Socket file */
+	char *pxm; /* Proximity config file to reload */
+	control_client_t clients[CONTROL_MAX_CLIENTS];
+	int rebalance; /* Immediate cycle is requested */
+};
+typedef struct control_s control_t;
+
+control_t *control_open(const char *path, const char *pxm);
+void control_close(control_t *control);
+int control_wait(control_t *control, cycle_t *cycle, int timeout);
+
+#endif
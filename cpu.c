@@ -10,11 +10,15 @@
 #include <limits.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "lub/list.h"
 #include "cpumask.h"
 #include "cpu.h"
 #include "irq.h"
+#include "numa.h"
+#include "path.h"
 
 int cpu_list_compare(const void *first, const void *second)
 {
@@ -27,7 +31,7 @@ int cpu_list_compare_len(const void *first, const void *second)
 {
 	const cpu_t *f = (const cpu_t *)first;
 	const cpu_t *s = (const cpu_t *)second;
-	return (lub_list_len(f->irqs) - lub_list_len(s->irqs));
+	return (ilist_len(&f->irqs) - ilist_len(&s->irqs));
 }
 
 static cpu_t * cpu_new(unsigned int id)
@@ -39,59 +43,64 @@ static cpu_t * cpu_new(unsigned int id)
 	new->id = id;
 	new->old_load_all = 0;
 	new->old_load_irq = 0;
+	new->old_load_busy = 0;
+	new->total_load = 0;
 	new->old_load = 0;
 	new->load = 0;
-	new->irqs = lub_list_new(irq_list_compare);
+	history_init(&new->history);
+	ilist_init(&new->irqs);
 	cpus_init(new->cpumask);
 	cpus_clear(new->cpumask);
 	cpu_set(new->id, new->cpumask);
+	cpus_init(new->siblings);
+	cpus_copy(new->siblings, new->cpumask);
+	cpus_init(new->llc);
+	cpus_copy(new->llc, new->cpumask);
+	new->node = -1;
+	new->affinity = NULL;
+	new->affinity_list = NULL;
 
 	return new;
 }
 
 static void cpu_free(cpu_t *cpu)
 {
-	lub_list_node_t *node;
-
-	while ((node = lub_list__get_tail(cpu->irqs))) {
-		lub_list_del(cpu->irqs, node);
-		lub_list_node_free(node);
-	}
-	lub_list_free(cpu->irqs);
+	ilist_clear(&cpu->irqs);
 	cpus_free(cpu->cpumask);
+	cpus_free(cpu->siblings);
+	cpus_free(cpu->llc);
+	free(cpu->affinity);
+	free(cpu->affinity_list);
 	free(cpu);
 }
 
-/* Search for CPU with specified package and core IDs.
-   The second CPU with the same IDs is a thread of Hyper Threading.
-   We don't want to use HT for IRQ balancing. */
-static cpu_t * cpu_list_search_ht(lub_list_t *cpus,
-	unsigned int package_id, unsigned int core_id,
-	cpumask_t *thread_siblings)
+/* The string to write to smp_affinity to bind IRQ to this CPU.
+   It's formatted on first use only. */
+const char *cpu_affinity_str(cpu_t *cpu)
 {
-	lub_list_node_t *iter;
+	char buf[NR_CPUS + 1];
 
-	/* Check if current CPU has thread siblings */
-	/* The CPUs without thread siblings has no hyper
-	   threading. For example some AMD processors has
-	   two CPUs with the same package and core ids but
-	   has no thread siblings. Don't consider such CPUs as
-	   a hyper threading. */
-	if (cpus_weight(*thread_siblings) < 2)
-		return NULL;
+	if (cpu->affinity)
+		return cpu->affinity;
+	cpumask_scnprintf(buf, sizeof(buf), cpu->cpumask);
+	buf[sizeof(buf) - 1] = '\0';
+	cpu->affinity = strdup(buf);
 
-	for (iter = lub_list_iterator_init(cpus); iter;
-		iter = lub_list_iterator_next(iter)) {
-		cpu_t *cpu;
-		cpu = (cpu_t *)lub_list_node__get_data(iter);
-		if (cpu->package_id != package_id)
-			continue;
-		if (cpu->core_id != core_id)
-			continue;
-		return cpu;
-	}
+	return cpu->affinity;
+}
 
-	return NULL;
+/* The same for smp_affinity_list. It's just CPU number. */
+const char *cpu_affinity_list(cpu_t *cpu)
+{
+	char buf[16];
+
+	if (cpu->affinity_list)
+		return cpu->affinity_list;
+	cpulist_scnprintf(buf, sizeof(buf), cpu->cpumask);
+	buf[sizeof(buf) - 1] = '\0';
+	cpu->affinity_list = strdup(buf);
+
+	return cpu->affinity_list;
 }
 
 cpu_t * cpu_list_search(lub_list_t *cpus, unsigned int id)
@@ -117,6 +126,47 @@ static cpu_t * cpu_list_add(lub_list_t *cpus, cpu_t *cpu)
 	return cpu;
 }
 
+/* Add CPU with specified ID. The topology is unknown. */
+cpu_t * cpu_list_add_id(lub_list_t *cpus, unsigned int id)
+{
+	cpu_t *cpu = cpu_list_search(cpus, id);
+
+	if (cpu)
+		return cpu;
+	if (!(cpu = cpu_new(id)))
+		return NULL;
+	cpu->package_id = 0;
+	cpu->core_id = id;
+
+	return cpu_list_add(cpus, cpu);
+}
+
+/* Build index of listed CPUs by ID. The array has NR_CPUS entries.
+   The not listed thread siblings (second threads of Hyper Threading)
+   point to the listed thread. Must be rebuilt on CPU list change. */
+void cpu_list_index(lub_list_t *cpus, cpu_t **index)
+{
+	lub_list_node_t *iter;
+	unsigned int id;
+
+	memset(index, 0, NR_CPUS * sizeof(*index));
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		if (cpu->id < NR_CPUS)
+			index[cpu->id] = cpu;
+	}
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		for (id = first_cpu(cpu->siblings); id < NR_CPUS;
+			id = next_cpu(id, cpu->siblings)) {
+			if (!index[id])
+				index[id] = cpu;
+		}
+	}
+}
+
 int cpu_list_free(lub_list_t *cpus)
 {
 	lub_list_node_t *iter;
@@ -135,9 +185,13 @@ int cpu_list_free(lub_list_t *cpus)
 static void show_cpu_info(cpu_t *cpu)
 {
 	char buf[NR_CPUS + 1];
+	char llc[NR_CPUS + 1];
 	cpumask_scnprintf(buf, sizeof(buf), cpu->cpumask);
 	buf[sizeof(buf) - 1] = '\0';
-	printf("CPU %d package %d core %d mask %s\n", cpu->id, cpu->package_id, cpu->core_id, buf);
+	cpulist_scnprintf(llc, sizeof(llc), cpu->llc);
+	llc[sizeof(llc) - 1] = '\0';
+	printf("CPU %d package %d core %d node %d mask %s llc %s\n", cpu->id,
+		cpu->package_id, cpu->core_id, cpu->node, buf, llc);
 }
 
 /* Show CPU list */
@@ -153,75 +207,283 @@ int show_cpus(lub_list_t *cpus)
 	return 0;
 }
 
-/* Search for CPUs */
-int scan_cpus(lub_list_t *cpus, int ht)
+/* Read mask file relative to directory fd. The list file is
+   preferred. The hex file can be NULL. */
+static int read_mask_at(int dirfd, const char *list, const char *hex,
+	cpumask_t *mask)
 {
-	FILE *fd;
-	char path[PATH_MAX];
-	unsigned int id;
-	unsigned int package_id;
-	unsigned int core_id;
-	cpu_t *new;
-	char *str = NULL;
-	size_t sz;
-	cpumask_t thread_siblings;
-	cpus_init(thread_siblings);
-
-	for (id = 0; id < NR_CPUS; id++) {
-		snprintf(path, sizeof(path), "%s/cpu%d", SYSFS_CPU_PATH, id);
-		path[sizeof(path) - 1] = '\0';
-		if (access(path, F_OK))
+	char buf[CPU_FILE_MAX];
+	ssize_t len;
+
+	if ((len = path_read_at(dirfd, list, buf, sizeof(buf))) >= 0)
+		return cpulist_parse(buf, len, *mask);
+	if (hex && ((len = path_read_at(dirfd, hex, buf, sizeof(buf))) >= 0))
+		return cpumask_parse_user(buf, len, *mask);
+
+	return -1;
+}
+
+static int read_id_at(int dirfd, const char *name, unsigned int *id)
+{
+	char buf[32];
+	char *endptr;
+
+	if (path_read_at(dirfd, name, buf, sizeof(buf)) < 0)
+		return -1;
+	*id = strtoul(buf, &endptr, 10);
+
+	return (endptr == buf) ? -1 : 0;
+}
+
+/* Read CPU's topology. The files are opened relative to CPU's sysfs
+   directory. Returns new CPU or NULL. */
+static cpu_t * cpu_read(int sysfd, unsigned int id)
+{
+	char name[64];
+	cpu_t *cpu;
+	int dirfd;
+	int i;
+
+	snprintf(name, sizeof(name), "cpu%u", id);
+	if ((dirfd = openat(sysfd, name,
+		O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return NULL;
+	if (!(cpu = cpu_new(id))) {
+		close(dirfd);
+		return NULL;
+	}
+	if ((read_id_at(dirfd, "topology/physical_package_id",
+		&cpu->package_id) < 0) ||
+		(read_id_at(dirfd, "topology/core_id", &cpu->core_id) < 0)) {
+		close(dirfd);
+		cpu_free(cpu);
+		return NULL;
+	}
+	if (read_mask_at(dirfd, "topology/thread_siblings_list",
+		"topology/thread_siblings", &cpu->siblings) < 0)
+		cpus_copy(cpu->siblings, cpu->cpumask);
+	/* The last level cache has the highest index */
+	for (i = CPU_CACHE_INDEX_MAX; i >= 0; i--) {
+		snprintf(name, sizeof(name), "cache/index%d/shared_cpu_list", i);
+		if (!read_mask_at(dirfd, name, NULL, &cpu->llc))
 			break;
+	}
+	if (i < 0)
+		cpus_copy(cpu->llc, cpu->siblings);
+	close(dirfd);
 
-		/* Try to get package_id */
-		snprintf(path, sizeof(path),
-			"%s/cpu%d/topology/physical_package_id",
-			SYSFS_CPU_PATH, id);
-		path[sizeof(path) - 1] = '\0';
-		if (!(fd = fopen(path, "r")))
-			continue;
-		if (fscanf(fd, "%u", &package_id) < 0) {
-			fclose(fd);
-			continue;
+	return cpu;
+}
+
+/* Add read CPU to the list. The present mask contains CPUs of the
+   list. The second thread of Hyper Threading is not added if ht is 0:
+   the CPU is a second thread if any of its thread siblings is already
+   in the list. The CPUs without thread siblings has no hyper
+   threading. For example some AMD processors has two CPUs with the
+   same package and core ids but has no thread siblings. Don't consider
+   such CPUs as a hyper threading. Returns added CPU or NULL. */
+static cpu_t * cpu_list_insert(lub_list_t *cpus, lub_list_t *numas,
+	cpu_t *cpu, cpumask_t *present, int ht)
+{
+	lub_list_node_t *iter;
+
+	if (cpu_isset(cpu->id, *present) ||
+		(!ht && cpus_intersects(cpu->siblings, *present))) {
+		cpu_free(cpu);
+		return NULL;
+	}
+	cpu_set(cpu->id, *present);
+	for (iter = lub_list_iterator_init(numas); iter;
+		iter = lub_list_iterator_next(iter)) {
+		numa_t *numa = (numa_t *)lub_list_node__get_data(iter);
+		if (cpu_isset(cpu->id, numa->cpumap)) {
+			cpu->node = numa->id;
+			break;
 		}
-		fclose(fd);
+	}
+	lub_list_add(cpus, cpu);
 
-		/* Try to get core_id */
-		snprintf(path, sizeof(path), "%s/cpu%d/topology/core_id",
-			SYSFS_CPU_PATH, id);
-		path[sizeof(path) - 1] = '\0';
-		if (!(fd = fopen(path, "r")))
+	return cpu;
+}
+
+static void cpu_list_present(lub_list_t *cpus, cpumask_t *present)
+{
+	lub_list_node_t *iter;
+
+	cpus_clear(*present);
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		cpu_set(cpu->id, *present);
+	}
+}
+
+/* Read CPU's topology and add it to the list. Returns added CPU
+   or NULL. */
+cpu_t * scan_cpu(lub_list_t *cpus, lub_list_t *numas, unsigned int id,
+	int ht)
+{
+	cpumask_t present;
+	cpu_t *cpu;
+	int sysfd;
+
+	if ((sysfd = path_open_dir("%s", SYSFS_CPU_PATH)) < 0)
+		return NULL;
+	cpu = cpu_read(sysfd, id);
+	close(sysfd);
+	if (!cpu)
+		return NULL;
+	cpus_init(present);
+	cpu_list_present(cpus, &present);
+	cpu = cpu_list_insert(cpus, numas, cpu, &present, ht);
+	cpus_free(present);
+
+	return cpu;
+}
+
+/* Read online CPUs from /sys/devices/system/cpu/online */
+int cpu_online_read(cpumask_t *online)
+{
+	char path[PATH_MAX];
+
+	path_build(path, sizeof(path), "%s/online", SYSFS_CPU_PATH);
+
+	return cpumask_read(path, NULL, *online);
+}
+
+/* The topology of CPUs is read by worker threads */
+struct cpu_scan_s {
+	int sysfd;
+	unsigned int *ids;
+	cpu_t **cpus; /* Read CPUs. NULL if can't read */
+	unsigned int num;
+	unsigned int next; /* Next CPU to read */
+	int ht;
+	cpumask_t skip; /* Second threads of read CPUs. Not needed if !ht */
+};
+typedef struct cpu_scan_s cpu_scan_t;
+
+static void *cpu_scan_worker(void *arg)
+{
+	cpu_scan_t *scan = (cpu_scan_t *)arg;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED)) <
+		scan->num) {
+		unsigned int id = scan->ids[i];
+		cpu_t *cpu;
+		if (!scan->ht && cpu_isset_atomic(id, scan->skip)) {
+			scan->cpus[i] = NULL;
 			continue;
-		if (fscanf(fd, "%u", &core_id) < 0) {
-			fclose(fd);
+		}
+		if (!(cpu = cpu_read(scan->sysfd, id))) {
+			scan->cpus[i] = NULL;
 			continue;
 		}
-		fclose(fd);
-
-		/* Get thread siblings */
-		cpus_clear(thread_siblings);
-		cpu_set(id, thread_siblings);
-		snprintf(path, sizeof(path), "%s/cpu%d/topology/thread_siblings",
-			SYSFS_CPU_PATH, id);
-		path[sizeof(path) - 1] = '\0';
-		if ((fd = fopen(path, "r"))) {
-			if (getline(&str, &sz, fd) >= 0)
-				cpumask_parse_user(str, strlen(str), thread_siblings);
-			fclose(fd);
+		scan->cpus[i] = cpu;
+		/* The siblings with greater IDs are second threads */
+		if (!scan->ht && (cpus_weight(cpu->siblings) > 1)) {
+			cpumask_t higher;
+			cpus_init(higher);
+			cpus_copy(higher, cpu->siblings);
+			for (id = first_cpu(higher); id <= cpu->id;
+				id = next_cpu(id, higher))
+				cpu_clear(id, higher);
+			cpus_or_atomic(scan->skip, higher);
+			cpus_free(higher);
 		}
+	}
 
-		/* Don't use second thread of Hyper Threading */
-		if (!ht && cpu_list_search_ht(cpus, package_id, core_id,
-			&thread_siblings))
-			continue;
+	return NULL;
+}
+
+/* Search for online CPUs. The possible CPUs are used if there is no
+   online file. The old kernels have no these files so the cpuN
+   directories are searched. The sysfs reads are slow on big hosts so
+   they are spread among worker threads. The CPUs are added to the list
+   in order of IDs. */
+int scan_cpus(lub_list_t *cpus, lub_list_t *numas, int ht)
+{
+	pthread_t threads[CPU_SCAN_WORKERS];
+	cpu_scan_t scan;
+	cpumask_t online;
+	unsigned int id;
+	unsigned int i;
+	int workers = 0;
+
+	if ((scan.sysfd = path_open_dir("%s", SYSFS_CPU_PATH)) < 0)
+		return -1;
+	cpus_init(online);
+	if ((read_mask_at(scan.sysfd, "online", NULL, &online) < 0) &&
+		(read_mask_at(scan.sysfd, "possible", NULL, &online) < 0)) {
+		cpus_clear(online);
+		for (id = 0; id < NR_CPUS; id++) {
+			char name[32];
+			snprintf(name, sizeof(name), "cpu%u", id);
+			if (faccessat(scan.sysfd, name, F_OK, 0))
+				break;
+			cpu_set(id, online);
+		}
+	}
+
+	scan.num = cpus_weight(online);
+	scan.ids = malloc(scan.num * sizeof(*scan.ids));
+	scan.cpus = malloc(scan.num * sizeof(*scan.cpus));
+	if (!scan.ids || !scan.cpus) {
+		free(scan.ids);
+		free(scan.cpus);
+		close(scan.sysfd);
+		cpus_free(online);
+		return -1;
+	}
+	i = 0;
+	for (id = first_cpu(online); id < NR_CPUS; id = next_cpu(id, online))
+		scan.ids[i++] = id;
+	scan.next = 0;
+	scan.ht = ht;
+	cpus_init(scan.skip);
+	cpus_clear(scan.skip);
+	if (scan.num >= CPU_SCAN_PARALLEL_MIN) {
+		for (; workers < CPU_SCAN_WORKERS; workers++) {
+			if (pthread_create(&threads[workers], NULL,
+				cpu_scan_worker, &scan) != 0)
+				break;
+		}
+	}
+	cpu_scan_worker(&scan);
+	while (workers--)
+		pthread_join(threads[workers], NULL);
+	close(scan.sysfd);
 
-		new = cpu_new(id);
-		new->package_id = package_id;
-		new->core_id = core_id;
-		cpu_list_add(cpus, new);
+	/* Build the list in single pass. The online mask is reused as
+	   mask of CPUs in the list. */
+	cpu_list_present(cpus, &online);
+	for (i = 0; i < scan.num; i++) {
+		if (scan.cpus[i])
+			cpu_list_insert(cpus, numas, scan.cpus[i], &online, ht);
 	}
-	cpus_free(thread_siblings);
-	free(str);
+	free(scan.ids);
+	free(scan.cpus);
+	cpus_free(scan.skip);
+	cpus_free(online);
 
 	return 0;
 }
+
+/* Remove offline CPU from the list. The IRQs linked to CPU are
+   unlinked. */
+void cpu_list_remove(lub_list_t *cpus, cpu_t *cpu)
+{
+	lub_list_node_t *node;
+
+	while (cpu->irqs.head) {
+		irq_t *irq = ilist_entry(cpu->irqs.head, irq_t, cpu_link);
+		ilist_del(&irq->cpu_link);
+		irq->cpu = NULL;
+	}
+	if ((node = lub_list_search(cpus, cpu))) {
+		lub_list_del(cpus, node);
+		lub_list_node_free(node);
+	}
+	cpu_free(cpu);
+}
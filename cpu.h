@@ -3,31 +3,54 @@
 
 #include "lub/list.h"
 #include "cpumask.h"
+#include "history.h"
+#include "ilist.h"
 
 struct cpu_s {
 	unsigned int id; /* Logical processor ID */
 	unsigned int package_id;
 	unsigned int core_id;
 	cpumask_t cpumask; /* Mask with one bit set - current CPU. */
+	cpumask_t siblings; /* Thread siblings including current CPU */
+	cpumask_t llc; /* CPUs sharing last level cache with current CPU */
+	int node; /* NUMA node ID. -1 if unknown */
+	char *affinity; /* Cached smp_affinity string of cpumask */
+	char *affinity_list; /* Cached smp_affinity_list string of cpumask */
 	unsigned long long old_load_all; /* Previous whole load from /proc/stat */
 	unsigned long long old_load_irq; /* Previous IRQ, softIRQ load */
+	unsigned long long old_load_busy; /* Previous non-idle load */
 	float old_load; /* Previous CPU load in percents. */
 	float load; /* Current CPU load in percents. */
-	lub_list_t *irqs; /* List of IRQs belong to this CPU. */
+	float total_load; /* Current non-idle CPU load in percents. */
+	history_t history; /* History of CPU load */
+	ilist_t irqs; /* IRQs belong to this CPU. Sorted by IRQ number. */
 };
 typedef struct cpu_s cpu_t;
 
 /* System CPU info */
 #define SYSFS_CPU_PATH "/sys/devices/system/cpu"
 
+#define CPU_FILE_MAX (NR_CPUS + 64) /* Buffer for CPU mask files */
+#define CPU_CACHE_INDEX_MAX 3 /* The highest cache/indexN to search LLC */
+#define CPU_SCAN_WORKERS 4 /* Number of threads to read topology */
+#define CPU_SCAN_PARALLEL_MIN 64 /* Less CPUs are read serially */
+
 /* CPU IDs compare function */
 int cpu_list_compare(const void *first, const void *second);
 int cpu_list_compare_len(const void *first, const void *second);
 
 /* CPU list functions */
 int cpu_list_free(lub_list_t *cpus);
-int scan_cpus(lub_list_t *cpus, int ht);
+int scan_cpus(lub_list_t *cpus, lub_list_t *numas, int ht);
+cpu_t * scan_cpu(lub_list_t *cpus, lub_list_t *numas, unsigned int id,
+	int ht);
+int cpu_online_read(cpumask_t *online);
+void cpu_list_remove(lub_list_t *cpus, cpu_t *cpu);
 int show_cpus(lub_list_t *cpus);
 cpu_t * cpu_list_search(lub_list_t *cpus, unsigned int id);
+cpu_t * cpu_list_add_id(lub_list_t *cpus, unsigned int id);
+void cpu_list_index(lub_list_t *cpus, cpu_t **index);
+const char *cpu_affinity_str(cpu_t *cpu);
+const char *cpu_affinity_list(cpu_t *cpu);
 
 #endif
@@ -1,9 +1,19 @@
 #ifndef CPUMASK_H
 #define CPUMASK_H
 
+/* The max number of CPUs is set by configure (--with-nr-cpus). All the
+   cpumasks have the same fixed width so the operations below are the
+   loops over fixed number of 64-bit words. */
+#ifndef NR_CPUS
 #define NR_CPUS 4096
+#endif
+#if (NR_CPUS <= 0) || (NR_CPUS % 64)
+#error "NR_CPUS must be positive multiple of 64"
+#endif
+#define CPUMASK_WORDS (NR_CPUS / 64)
 
 #include <stdlib.h>
+#include <string.h>
 #include "bit_array.h"
 #include "hexio.h"
 
@@ -12,42 +22,209 @@ typedef struct {
 } cpumask_t;
 extern cpumask_t _unused_cpumask_arg_;
 
+static inline int __cpu_isset(unsigned int cpu, const BIT_ARRAY *src)
+{
+	if (cpu >= NR_CPUS)
+		return 0;
+	return (src->words[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+static inline void __cpu_set(unsigned int cpu, BIT_ARRAY *dst)
+{
+	if (cpu < NR_CPUS)
+		dst->words[cpu / 64] |= (word_t)1 << (cpu % 64);
+}
+
+static inline void __cpu_clear(unsigned int cpu, BIT_ARRAY *dst)
+{
+	if (cpu < NR_CPUS)
+		dst->words[cpu / 64] &= ~((word_t)1 << (cpu % 64));
+}
+
+/* Atomic versions for the mask shared by threads */
+static inline int __cpu_isset_atomic(unsigned int cpu, const BIT_ARRAY *src)
+{
+	if (cpu >= NR_CPUS)
+		return 0;
+	return (__atomic_load_n(&src->words[cpu / 64], __ATOMIC_RELAXED) >>
+		(cpu % 64)) & 1;
+}
+
+static inline void __cpus_or_atomic(BIT_ARRAY *dst, const BIT_ARRAY *src)
+{
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++) {
+		if (src->words[i])
+			__atomic_fetch_or(&dst->words[i], src->words[i],
+				__ATOMIC_RELAXED);
+	}
+}
+
+static inline void __cpus_and(BIT_ARRAY *dst, const BIT_ARRAY *src1,
+	const BIT_ARRAY *src2)
+{
+	word_t *d = dst->words;
+	const word_t *a = src1->words;
+	const word_t *b = src2->words;
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++)
+		d[i] = a[i] & b[i];
+}
+
+static inline void __cpus_or(BIT_ARRAY *dst, const BIT_ARRAY *src1,
+	const BIT_ARRAY *src2)
+{
+	word_t *d = dst->words;
+	const word_t *a = src1->words;
+	const word_t *b = src2->words;
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++)
+		d[i] = a[i] | b[i];
+}
+
+static inline void __cpus_xor(BIT_ARRAY *dst, const BIT_ARRAY *src1,
+	const BIT_ARRAY *src2)
+{
+	word_t *d = dst->words;
+	const word_t *a = src1->words;
+	const word_t *b = src2->words;
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++)
+		d[i] = a[i] ^ b[i];
+}
+
+static inline void __cpus_andnot(BIT_ARRAY *dst, const BIT_ARRAY *src1,
+	const BIT_ARRAY *src2)
+{
+	word_t *d = dst->words;
+	const word_t *a = src1->words;
+	const word_t *b = src2->words;
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++)
+		d[i] = a[i] & ~b[i];
+}
+
+static inline void __cpus_complement(BIT_ARRAY *dst, const BIT_ARRAY *src)
+{
+	word_t *d = dst->words;
+	const word_t *a = src->words;
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++)
+		d[i] = ~a[i];
+}
+
+static inline int __cpus_intersects(const BIT_ARRAY *src1,
+	const BIT_ARRAY *src2)
+{
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++) {
+		if (src1->words[i] & src2->words[i])
+			return 1;
+	}
+	return 0;
+}
+
+static inline int __cpus_empty(const BIT_ARRAY *src)
+{
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++) {
+		if (src->words[i])
+			return 0;
+	}
+	return 1;
+}
+
+static inline int __cpus_full(const BIT_ARRAY *src)
+{
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++) {
+		if (~src->words[i])
+			return 0;
+	}
+	return 1;
+}
+
+/* Without hardware popcount (-mpopcnt, -march=native) the builtin
+   is libgcc call. The inline bit counting is faster then. */
+static inline unsigned int __word_weight(word_t w)
+{
+#ifdef __POPCNT__
+	return __builtin_popcountll(w);
+#else
+	w = w - ((w >> 1) & 0x5555555555555555ULL);
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (w * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+static inline unsigned int __cpus_weight(const BIT_ARRAY *src)
+{
+	const word_t *a = src->words;
+	unsigned int weight = 0;
+	int i;
+	for (i = 0; i < CPUMASK_WORDS; i++)
+		weight += __word_weight(a[i]);
+	return weight;
+}
+
+/* Returns NR_CPUS if no CPUs are found */
+static inline int __next_cpu(int n, const BIT_ARRAY *src)
+{
+	int i;
+	word_t w;
+
+	if (++n >= NR_CPUS)
+		return NR_CPUS;
+	i = n / 64;
+	w = src->words[i] & (~(word_t)0 << (n % 64));
+	while (!w) {
+		if (++i >= CPUMASK_WORDS)
+			return NR_CPUS;
+		w = src->words[i];
+	}
+	return i * 64 + __builtin_ctzll(w);
+}
+
 #define cpus_init(dst) ((dst).bits = bit_array_create(NR_CPUS))
 #define cpus_free(dst) bit_array_free((dst).bits)
-#define cpus_copy(dst, src) bit_array_copy_all((dst).bits, (src).bits)
+#define cpus_copy(dst, src) memcpy((dst).bits->words, (src).bits->words, \
+	CPUMASK_WORDS * sizeof(word_t))
 
-#define cpu_set(cpu, dst) bit_array_set_bit((dst).bits, cpu)
-#define cpu_clear(cpu, dst) bit_array_clear_bit((dst).bits, cpu)
+#define cpu_set(cpu, dst) __cpu_set((cpu), (dst).bits)
+#define cpu_clear(cpu, dst) __cpu_clear((cpu), (dst).bits)
 
-#define cpus_setall(dst) bit_array_set_all((dst).bits)
-#define cpus_clear(dst) bit_array_clear_all((dst).bits)
+#define cpus_setall(dst) memset((dst).bits->words, 0xff, \
+	CPUMASK_WORDS * sizeof(word_t))
+#define cpus_clear(dst) memset((dst).bits->words, 0, \
+	CPUMASK_WORDS * sizeof(word_t))
 
-#define cpu_isset(cpu, cpumask) bit_array_get_bit((cpumask).bits, cpu)
+#define cpu_isset(cpu, cpumask) __cpu_isset((cpu), (cpumask).bits)
+#define cpu_isset_atomic(cpu, cpumask) __cpu_isset_atomic((cpu), (cpumask).bits)
+#define cpus_or_atomic(dst, src) __cpus_or_atomic((dst).bits, (src).bits)
 
-#define cpus_and(dst, src1, src2) bit_array_and((dst).bits, (src1).bits, (src2).bits)
-#define cpus_or(dst, src1, src2) bit_array_or((dst).bits, (src1).bits, (src2).bits)
-#define cpus_xor(dst, src1, src2) bit_array_xor((dst).bits, (src1).bits, (src2).bits)
-#define cpus_complement(dst, src) bit_array_not((dst).bits, (src).bits)
+#define cpus_and(dst, src1, src2) __cpus_and((dst).bits, (src1).bits, (src2).bits)
+#define cpus_or(dst, src1, src2) __cpus_or((dst).bits, (src1).bits, (src2).bits)
+#define cpus_xor(dst, src1, src2) __cpus_xor((dst).bits, (src1).bits, (src2).bits)
+#define cpus_andnot(dst, src1, src2) __cpus_andnot((dst).bits, (src1).bits, (src2).bits)
+#define cpus_complement(dst, src) __cpus_complement((dst).bits, (src).bits)
 
-#define cpus_equal(src1, src2) (bit_array_cmp((src1).bits, (src2).bits) == 0)
-#define cpus_empty(src) (bit_array_num_bits_set((src).bits) == 0)
-#define cpus_full(src) (bit_array_num_bits_cleared((src).bits) == 0)
-#define cpus_weight(cpumask) bit_array_num_bits_set((cpumask).bits)\
+#define cpus_equal(src1, src2) (memcmp((src1).bits->words, (src2).bits->words, \
+	CPUMASK_WORDS * sizeof(word_t)) == 0)
+#define cpus_intersects(src1, src2) __cpus_intersects((src1).bits, (src2).bits)
+#define cpus_empty(src) __cpus_empty((src).bits)
+#define cpus_full(src) __cpus_full((src).bits)
+#define cpus_weight(cpumask) __cpus_weight((cpumask).bits)
 
 #define cpus_shift_right(dst, n) bit_array_shift_right((dst).bits, n, 0)
 #define cpus_shift_left(dst, n) bit_array_shift_left((dst).bits, n, 0)
 
-static inline int __first_cpu(const cpumask_t srcp)
-{
-	bit_index_t res = bit_array_length(srcp.bits);
-	bit_array_find_first_set_bit(srcp.bits, &res);
-        return res;
-}
-
-#define first_cpu(src) __first_cpu((src))
-int __next_cpu(int n, const cpumask_t *srcp);
-#define next_cpu(n, src) __next_cpu((n), (src))
+#define first_cpu(src) __next_cpu(-1, (src).bits)
+#define next_cpu(n, src) __next_cpu((n), (src).bits)
 
 #define cpumask_scnprintf(buf, len, src) bitmask_scnprintf((buf), (len), (src).bits)
 #define cpumask_parse_user(ubuf, ulen, dst) bitmask_parse_user((ubuf), (ulen), (dst).bits)
+#define cpulist_scnprintf(buf, len, src) bitmask_scnlistprintf((buf), (len), (src).bits)
+#define cpulist_parse(buf, len, dst) bitmask_parse_list((buf), (len), (dst).bits)
+#define cpumask_read(list, hex, dst) bitmask_read((list), (hex), (dst).bits)
 #endif /* CPUMASK_H */
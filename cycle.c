@@ -0,0 +1,318 @@
+/* cycle.c
+ * Balancing cycle.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "birq.h"
+#include "lub/list.h"
+#include "irq.h"
+#include "numa.h"
+#include "cpu.h"
+#include "statistics.h"
+#include "balance.h"
+#include "pxm.h"
+#include "consumer.h"
+#include "cycle.h"
+#include "event.h"
+#include "plan.h"
+#include "affinity.h"
+
+cycle_t *cycle_new(void)
+{
+	cycle_t *cycle;
+
+	cycle = malloc(sizeof(*cycle));
+	assert(cycle);
+	cycle->irqs = lub_list_new(irq_list_compare);
+	cycle->balance_irqs = lub_list_new(irq_list_compare);
+	cycle->cpus = lub_list_new(cpu_list_compare);
+	cpu_list_index(cycle->cpus, cycle->cpu_index);
+	cycle->numas = lub_list_new(numa_list_compare);
+	cycle->pxms = lub_list_new(NULL);
+	cycle->consumers = lub_list_new(NULL);
+	cpus_init(cycle->online);
+	cpus_clear(cycle->online);
+	cycle->threshold = BIRQ_DEFAULT_THRESHOLD;
+	cycle->load_limit = BIRQ_DEFAULT_LOAD_LIMIT;
+	cycle->strategy = BIRQ_CHOOSE_RND;
+	cycle->cooldown = BIRQ_DEFAULT_COOLDOWN;
+	cycle->short_interval = BIRQ_SHORT_INTERVAL;
+	cycle->long_interval = BIRQ_LONG_INTERVAL;
+	cycle->rps = 0;
+	cycle->ht = 0;
+	cycle->verbose = 0;
+	cycle->trace = NULL;
+	cycle->plan = NULL;
+	cycle->overhead = overhead_new();
+	cycle->cycles = 0;
+	cycle->moves = 0;
+	cycle->moves_total = 0;
+
+	return cycle;
+}
+
+void cycle_free(cycle_t *cycle)
+{
+	if (!cycle)
+		return;
+	irq_list_free(cycle->irqs);
+	lub_list_free(cycle->balance_irqs);
+	cpu_list_free(cycle->cpus);
+	numa_list_free(cycle->numas);
+	pxm_list_free(cycle->pxms);
+	consumer_list_free(cycle->consumers);
+	cpus_free(cycle->online);
+	trace_close(cycle->trace);
+	free(cycle->plan);
+	overhead_free(cycle->overhead);
+	affinity_pool_free();
+	free(cycle);
+}
+
+/* Scan system topology and parse proximity file */
+int cycle_scan(cycle_t *cycle, const char *pxm)
+{
+	/* Scan NUMA nodes */
+	scan_numas(cycle->numas);
+	if (cycle->verbose)
+		show_numas(cycle->numas);
+
+	/* Scan CPUs */
+	scan_cpus(cycle->cpus, cycle->numas, cycle->ht);
+	cpu_list_index(cycle->cpus, cycle->cpu_index);
+	cpu_online_read(&cycle->online);
+	if (cycle->verbose)
+		show_cpus(cycle->cpus);
+
+	/* Parse proximity file */
+	if (pxm)
+		parse_pxm_config(pxm, cycle->pxms, cycle->numas);
+	if (cycle->verbose)
+		show_pxms(cycle->pxms);
+
+	return 0;
+}
+
+/* Parse proximity file again and refresh local CPUs of IRQs */
+int cycle_reload_pxm(cycle_t *cycle, const char *pxm)
+{
+	pxm_list_free(cycle->pxms);
+	cycle->pxms = lub_list_new(NULL);
+	if (pxm && (parse_pxm_config(pxm, cycle->pxms, cycle->numas) < 0))
+		return -1;
+	if (cycle->verbose)
+		show_pxms(cycle->pxms);
+
+	return irq_list_rescan_local(cycle->irqs, cycle->pxms);
+}
+
+/* CPU is gone offline. The kernel moves away its IRQs. Balance
+   them again. */
+void cycle_cpu_offline(cycle_t *cycle, cpu_t *cpu)
+{
+	lub_list_node_t *iter;
+	ilist_link_t *link;
+
+	printf("Remove CPU%u\n", cpu->id);
+	event_log(EVENT_INFO, "cpu_remove", "\"cpu\":%u,\"irqs\":%u",
+		cpu->id, ilist_len(&cpu->irqs));
+	ilist_for_each(link, &cpu->irqs) {
+		irq_t *irq = ilist_entry(link, irq_t, cpu_link);
+		/* Relink by the affinity set by kernel */
+		irq_changed(irq);
+		if ((irq->move == IRQ_MOVE_PENDING) &&
+			(irq->move_cpu == cpu->id))
+			irq->move = IRQ_MOVE_NONE;
+		if (!irq_movable(irq) || irq->blacklisted)
+			continue;
+		if (!lub_list_search(cycle->balance_irqs, irq))
+			lub_list_add(cycle->balance_irqs, irq);
+	}
+	for (iter = lub_list_iterator_init(cycle->numas); iter;
+		iter = lub_list_iterator_next(iter)) {
+		numa_t *numa = (numa_t *)lub_list_node__get_data(iter);
+		cpu_clear(cpu->id, numa->cpumap);
+	}
+	cpu_list_remove(cycle->cpus, cpu);
+}
+
+/* CPU is come online. The kernel shows online CPUs only in node's
+   cpulist and device's local_cpulist. So the IRQs local to CPU's
+   node get new CPU too. */
+static void cycle_cpu_online(cycle_t *cycle, cpu_t *cpu)
+{
+	lub_list_node_t *iter;
+	numa_t *numa;
+
+	printf("Add CPU%u\n", cpu->id);
+	event_log(EVENT_INFO, "cpu_add", "\"cpu\":%u", cpu->id);
+	if (!(numa = numa_cpu_node(cycle->numas, cpu->id)))
+		return;
+	cpu->node = numa->id;
+	if (cpu_isset(cpu->id, numa->cpumap))
+		return;
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		if (cpus_intersects(irq->local_cpus, numa->cpumap))
+			cpu_set(cpu->id, irq->local_cpus);
+	}
+	cpu_set(cpu->id, numa->cpumap);
+}
+
+/* Track CPU hotplug. The /sys/devices/system/cpu/online is read on
+   each cycle. Only the CPUs changed their state are scanned. The
+   online sibling of removed CPU is scanned too because it was skipped
+   as second thread of Hyper Threading. Returns number of changed CPUs. */
+static int cycle_hotplug(cycle_t *cycle)
+{
+	lub_list_node_t *iter;
+	cpumask_t online;
+	cpumask_t added;
+	unsigned int id;
+	int changed = 0;
+
+	cpus_init(online);
+	if ((cpu_online_read(&online) < 0) ||
+		cpus_equal(online, cycle->online)) {
+		cpus_free(online);
+		return 0;
+	}
+	cpus_init(added);
+	cpus_andnot(added, online, cycle->online);
+
+	iter = lub_list_iterator_init(cycle->cpus);
+	while (iter) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		iter = lub_list_iterator_next(iter);
+		if (cpu_isset(cpu->id, online))
+			continue;
+		cpus_or(added, added, cpu->siblings);
+		cycle_cpu_offline(cycle, cpu);
+		changed++;
+	}
+
+	cpus_and(added, added, online);
+	for (id = first_cpu(added); id < NR_CPUS; id = next_cpu(id, added)) {
+		cpu_t *cpu;
+		if (cpu_list_search(cycle->cpus, id))
+			continue;
+		if (!(cpu = scan_cpu(cycle->cpus, cycle->numas, id,
+			cycle->ht)))
+			continue;
+		cycle_cpu_online(cycle, cpu);
+		changed++;
+	}
+	if (changed)
+		cpu_list_index(cycle->cpus, cycle->cpu_index);
+	cpus_copy(cycle->online, online);
+	cpus_free(added);
+	cpus_free(online);
+
+	return changed;
+}
+
+/* One balancing iteration. Returns 1 if some IRQs were balanced
+   (i.e. short interval is needed) and 0 else. */
+int cycle_run(cycle_t *cycle, unsigned long long now)
+{
+	lub_list_node_t *node;
+	unsigned int seed = 0;
+
+	overhead_start(cycle->overhead, OVERHEAD_CYCLE);
+	cycle->cycles++;
+	cycle->moves = 0;
+
+	/* Rescan PCI devices for new IRQs. */
+	overhead_start(cycle->overhead, OVERHEAD_SCAN_IRQS);
+	scan_irqs(cycle->irqs, cycle->balance_irqs, cycle->pxms);
+	overhead_stop(cycle->overhead, OVERHEAD_SCAN_IRQS);
+	/* Check the moves made by previous cycles */
+	overhead_start(cycle->overhead, OVERHEAD_VERIFY_MOVES);
+	verify_moves(cycle->cpus, cycle->irqs, now);
+	overhead_stop(cycle->overhead, OVERHEAD_VERIFY_MOVES);
+	/* Add and remove CPUs gone online or offline */
+	overhead_start(cycle->overhead, OVERHEAD_HOTPLUG);
+	cycle_hotplug(cycle);
+	overhead_stop(cycle->overhead, OVERHEAD_HOTPLUG);
+	if (cycle->verbose)
+		irq_list_show(cycle->irqs);
+	/* Link IRQs to CPUs due to real current smp affinity. */
+	overhead_start(cycle->overhead, OVERHEAD_LINK_IRQS);
+	link_irqs_to_cpus(cycle->cpu_index);
+	overhead_stop(cycle->overhead, OVERHEAD_LINK_IRQS);
+
+	/* Gather statistics on CPU load and number of interrupts. */
+	overhead_start(cycle->overhead, OVERHEAD_GATHER);
+	gather_statistics(cycle->cpus, cycle->irqs, now);
+	overhead_stop(cycle->overhead, OVERHEAD_GATHER);
+	if (cycle->verbose)
+		show_statistics(cycle->cpus, cycle->verbose);
+	/* Spread single-IRQ hotspots using RPS. */
+	if (cycle->rps)
+		balance_rps(cycle->cpus, cycle->irqs, cycle->threshold,
+			cycle->load_limit);
+	/* Random choice must be reproducible while replay of trace. */
+	if (cycle->trace) {
+		seed = rand();
+		srand(seed);
+	}
+	/* Choose IRQ to move to another CPU. */
+	overhead_start(cycle->overhead, OVERHEAD_CHOOSE);
+	choose_irqs_to_move(cycle->cpus, cycle->balance_irqs,
+		cycle->threshold, cycle->strategy, cycle->cooldown, now);
+	/* Move IRQs closer to the applications consuming their data */
+	if (lub_list_len(cycle->consumers) != 0) {
+		consumer_update(cycle->consumers, cycle->cpus, cycle->irqs);
+		if (cycle->verbose)
+			show_consumers(cycle->consumers);
+		choose_consumer_irqs(cycle->cpus, cycle->irqs,
+			cycle->balance_irqs, cycle->load_limit,
+			cycle->cooldown, now);
+	}
+	overhead_stop(cycle->overhead, OVERHEAD_CHOOSE);
+
+	/* Choose new CPU for IRQs need to be balanced. */
+	if (lub_list_len(cycle->balance_irqs) != 0) {
+		overhead_start(cycle->overhead, OVERHEAD_BALANCE);
+		cycle->moves = balance(cycle->cpus, cycle->balance_irqs,
+			cycle->load_limit, cycle->cooldown, now);
+		cycle->moves_total += cycle->moves;
+		overhead_stop(cycle->overhead, OVERHEAD_BALANCE);
+	}
+	/* Record cycle inputs and decisions */
+	if (cycle->trace)
+		trace_write_cycle(cycle->trace, cycle, now, seed);
+	event_log(EVENT_DEBUG, "cycle", "\"cycle\":%llu,\"moves\":%u",
+		cycle->cycles, cycle->moves);
+
+	/* If nothing to balance */
+	if (lub_list_len(cycle->balance_irqs) == 0) {
+		overhead_stop(cycle->overhead, OVERHEAD_CYCLE);
+		return 0;
+	}
+
+	/* Write new values to /proc/irq/<IRQ>/smp_affinity. The dry-run
+	   writes them to plan file. The real affinity is not changed so
+	   the next cycle starts from real state again. */
+	overhead_start(cycle->overhead, OVERHEAD_APPLY);
+	if (cycle->plan) {
+		if (plan_write(cycle, cycle->plan) < 0)
+			fprintf(stderr, "Warning: Can't write plan %s.\n",
+				cycle->plan);
+	} else {
+		apply_affinity(cycle->balance_irqs);
+	}
+	overhead_stop(cycle->overhead, OVERHEAD_APPLY);
+	/* Free list of balanced IRQs */
+	while ((node = lub_list__get_tail(cycle->balance_irqs))) {
+		lub_list_del(cycle->balance_irqs, node);
+		lub_list_node_free(node);
+	}
+	overhead_stop(cycle->overhead, OVERHEAD_CYCLE);
+
+	return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef _cycle_h
+#define _cycle_h
+
+#include "lub/list.h"
+#include "cpumask.h"
+#include "balance.h"
+#include "trace.h"
+#include "overhead.h"
+
+/* Balancing context. The data structures and parameters
+   used by balancing cycle. */
+struct cycle_s {
+	lub_list_t *irqs; /* All found IRQs */
+	lub_list_t *balance_irqs; /* IRQs need to be balanced */
+	lub_list_t *cpus; /* All found CPUs */
+	cpu_t *cpu_index[NR_CPUS]; /* CPUs by ID. See cpu_list_index() */
+	lub_list_t *numas; /* All found NUMA nodes */
+	lub_list_t *pxms; /* Proximity list */
+	lub_list_t *consumers; /* Applications consuming IRQs data */
+	cpumask_t online; /* Online CPUs. To track CPU hotplug */
+	float threshold;
+	float load_limit;
+	birq_choose_strategy_e strategy;
+	unsigned int cooldown; /* Don't move IRQ again while cooldown, ms */
+	unsigned int short_interval; /* Interval after balancing, s */
+	unsigned int long_interval; /* Interval when nothing to balance, s */
+	int rps; /* Use RPS for single-IRQ hotspots */
+	int ht; /* Use second threads of Hyper Threading */
+	int verbose;
+	trace_t *trace; /* Record cycles to trace if not NULL */
+	char *plan; /* Dry-run. Write moves to plan file, not to smp_affinity */
+	overhead_t *overhead; /* Self-overhead statistics */
+	unsigned long long cycles; /* Number of finished cycles */
+	unsigned int moves; /* Number of moves within the last cycle */
+	unsigned long long moves_total;
+};
+typedef struct cycle_s cycle_t;
+
+cycle_t *cycle_new(void);
+void cycle_free(cycle_t *cycle);
+int cycle_scan(cycle_t *cycle, const char *pxm);
+int cycle_run(cycle_t *cycle, unsigned long long now);
+int cycle_reload_pxm(cycle_t *cycle, const char *pxm);
+void cycle_cpu_offline(cycle_t *cycle, cpu_t *cpu);
+
+#endif
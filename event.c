@@ -0,0 +1,264 @@
+/* event.c
+ * Structured asynchronous event log. The balancing thread is the only
+ * producer and the writer thread is the only consumer of the ring
+ * buffer so the ring is synchronized by head and tail indexes only.
+ * The event is dropped if ring is full or rate limit is exceeded.
+ * The idle writer sleeps on condition variable. The producer signals
+ * it when the ring goes non-empty only, so the mutex is rarely taken.
+ * Each event is the JSON line like:
+ * {"ts":1700000000.123,"level":"info","event":"move","irq":40,...}
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "event.h"
+
+struct event_s {
+	unsigned long long ts; /* Realtime, ms */
+	event_level_e level;
+	const char *type; /* Static string */
+	char data[EVENT_DATA_SIZE]; /* JSON fields */
+};
+typedef struct event_s event_t;
+
+struct event_log_s {
+	FILE *file;
+	event_level_e level; /* Max level to log */
+	unsigned int rate; /* Max events per second. 0 - unlimited */
+	event_t ring[EVENT_RING_SIZE];
+	unsigned long long head; /* Written by producer */
+	unsigned long long tail; /* Written by consumer */
+	unsigned long long dropped; /* Written by producer */
+	unsigned long long reported; /* Dropped events reported by consumer */
+	/* Rate limit. Used by producer only. */
+	unsigned long long window; /* Current second */
+	unsigned int count; /* Events within current second */
+	pthread_t thread;
+	pthread_mutex_t mutex; /* Protects stop and the writer's wait */
+	pthread_cond_t cond;
+	int sleeping; /* The writer waits for the events */
+	int stop;
+};
+typedef struct event_log_s event_log_t;
+
+static event_log_t *events = NULL;
+
+static const char *level_names[EVENT_LEVEL_NUM] = {
+	"error",
+	"warning",
+	"info",
+	"debug"
+};
+
+/*--------------------------------------------------------- */
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*--------------------------------------------------------- */
+/* Write all available events. Returns number of written events. */
+static unsigned int drain(event_log_t *ev)
+{
+	unsigned long long head = __atomic_load_n(&ev->head, __ATOMIC_ACQUIRE);
+	unsigned long long tail = ev->tail;
+	unsigned long long dropped;
+	unsigned int num = 0;
+
+	for (; tail != head; tail++, num++) {
+		event_t *e = &ev->ring[tail & (EVENT_RING_SIZE - 1)];
+		fprintf(ev->file, "{\"ts\":%llu.%03llu,\"level\":\"%s\","
+			"\"event\":\"%s\"%s%s}\n",
+			e->ts / 1000, e->ts % 1000, level_names[e->level],
+			e->type, e->data[0] ? "," : "", e->data);
+	}
+	__atomic_store_n(&ev->tail, tail, __ATOMIC_RELEASE);
+
+	dropped = __atomic_load_n(&ev->dropped, __ATOMIC_RELAXED);
+	if (dropped != ev->reported) {
+		unsigned long long ts = now_ms();
+		fprintf(ev->file, "{\"ts\":%llu.%03llu,\"level\":\"warning\","
+			"\"event\":\"dropped\",\"count\":%llu}\n",
+			ts / 1000, ts % 1000, dropped - ev->reported);
+		ev->reported = dropped;
+		num++;
+	}
+	if (num)
+		fflush(ev->file);
+
+	return num;
+}
+
+/*--------------------------------------------------------- */
+static void *writer(void *arg)
+{
+	event_log_t *ev = (event_log_t *)arg;
+
+	pthread_mutex_lock(&ev->mutex);
+	while (!ev->stop) {
+		pthread_mutex_unlock(&ev->mutex);
+		drain(ev);
+		pthread_mutex_lock(&ev->mutex);
+		/* The producer checks sleeping flag after new head is
+		   published. So the head is checked again after the
+		   flag is set to not miss the wakeup. */
+		__atomic_store_n(&ev->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!ev->stop &&
+			(__atomic_load_n(&ev->head, __ATOMIC_SEQ_CST) == ev->tail))
+			pthread_cond_wait(&ev->cond, &ev->mutex);
+		__atomic_store_n(&ev->sleeping, 0, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&ev->mutex);
+	drain(ev);
+
+	return NULL;
+}
+
+/*--------------------------------------------------------- */
+/* Wake up the writer if it sleeps */
+static void wakeup(event_log_t *ev)
+{
+	if (!__atomic_load_n(&ev->sleeping, __ATOMIC_SEQ_CST))
+		return;
+	pthread_mutex_lock(&ev->mutex);
+	pthread_cond_signal(&ev->cond);
+	pthread_mutex_unlock(&ev->mutex);
+}
+
+/*--------------------------------------------------------- */
+int event_open(const char *fname, event_level_e level, unsigned int rate)
+{
+	event_log_t *ev;
+
+	if (events)
+		return -1;
+	if (!(ev = calloc(1, sizeof(*ev))))
+		return -1;
+	if (!(ev->file = fopen(fname, "a"))) {
+		free(ev);
+		return -1;
+	}
+	ev->level = level;
+	ev->rate = rate;
+	pthread_mutex_init(&ev->mutex, NULL);
+	pthread_cond_init(&ev->cond, NULL);
+	if (pthread_create(&ev->thread, NULL, writer, ev) != 0) {
+		pthread_cond_destroy(&ev->cond);
+		pthread_mutex_destroy(&ev->mutex);
+		fclose(ev->file);
+		free(ev);
+		return -1;
+	}
+	events = ev;
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Stop writer thread. The queued events are written. */
+void event_close(void)
+{
+	if (!events)
+		return;
+	pthread_mutex_lock(&events->mutex);
+	events->stop = 1;
+	pthread_cond_signal(&events->cond);
+	pthread_mutex_unlock(&events->mutex);
+	pthread_join(events->thread, NULL);
+	pthread_cond_destroy(&events->cond);
+	pthread_mutex_destroy(&events->mutex);
+	fclose(events->file);
+	free(events);
+	events = NULL;
+}
+
+/*--------------------------------------------------------- */
+int event_level(const char *str, event_level_e *level)
+{
+	int i;
+
+	for (i = 0; i < EVENT_LEVEL_NUM; i++) {
+		if (!strcmp(str, level_names[i])) {
+			*level = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*--------------------------------------------------------- */
+/* Queue event. The fmt is for additional JSON fields
+   like "\"irq\":%u". The errors are never rate limited. */
+void event_log(event_level_e level, const char *type, const char *fmt, ...)
+{
+	event_log_t *ev = events;
+	unsigned long long head;
+	unsigned long long ts;
+	event_t *e;
+	va_list ap;
+
+	if (!ev || (level > ev->level))
+		return;
+
+	ts = now_ms();
+	if (ev->rate && (level != EVENT_ERROR)) {
+		if (ts / 1000 != ev->window) {
+			ev->window = ts / 1000;
+			ev->count = 0;
+		}
+		if (ev->count >= ev->rate) {
+			__atomic_add_fetch(&ev->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		ev->count++;
+	}
+
+	head = ev->head;
+	if (head - __atomic_load_n(&ev->tail, __ATOMIC_ACQUIRE) >=
+		EVENT_RING_SIZE) {
+		__atomic_add_fetch(&ev->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	e = &ev->ring[head & (EVENT_RING_SIZE - 1)];
+	e->ts = ts;
+	e->level = level;
+	e->type = type;
+	va_start(ap, fmt);
+	vsnprintf(e->data, sizeof(e->data), fmt, ap);
+	va_end(ap);
+	__atomic_store_n(&ev->head, head + 1, __ATOMIC_SEQ_CST);
+	wakeup(ev);
+}
+
+/*--------------------------------------------------------- */
+/* Escape string to use it as JSON string value */
+const char *event_str(char *buf, size_t size, const char *str)
+{
+	size_t len = 0;
+
+	if (!str)
+		str = "";
+	for (; *str && (len + 7 < size); str++) {
+		unsigned char c = (unsigned char)*str;
+		if ((c == '"') || (c == '\\')) {
+			buf[len++] = '\\';
+			buf[len++] = c;
+		} else if (c < 0x20) {
+			len += snprintf(buf + len, size - len, "\\u%04x", c);
+		} else {
+			buf[len++] = c;
+		}
+	}
+	buf[len] = '\0';
+
+	return buf;
+}
@@ -0,0 +1,29 @@
+#ifndef _event_h
+#define _event_h
+
+#include <stddef.h>
+
+/* Structured log of balancing events. The events are written as
+   JSON lines by separate thread. The balancing code never blocks:
+   the event is put to the lock-free ring buffer or dropped. */
+
+typedef enum {
+	EVENT_ERROR,
+	EVENT_WARNING,
+	EVENT_INFO,
+	EVENT_DEBUG,
+	EVENT_LEVEL_NUM
+} event_level_e;
+
+#define EVENT_RING_SIZE 1024 /* Must be power of 2 */
+#define EVENT_DATA_SIZE 240 /* Max length of event's fields */
+#define EVENT_DEFAULT_RATE 1000 /* Events per second */
+
+int event_open(const char *fname, event_level_e level, unsigned int rate);
+void event_close(void);
+int event_level(const char *str, event_level_e *level);
+void event_log(event_level_e level, const char *type, const char *fmt, ...)
+	__attribute__ ((format (printf, 3, 4)));
+const char *event_str(char *buf, size_t size, const char *str);
+
+#endif
@@ -7,105 +7,252 @@
 #include "bit_array.h"
 #include "hexio.h"
 
+/* Value of hex digit plus one. Zero for non hex characters. */
+static const uint8_t hex_val[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+/*
+ * Checks that all the HEXCHARSZ characters are hex digits
+ */
+static inline int hex_chunk(const unsigned char *p)
+{
+	return hex_val[p[0]] && hex_val[p[1]] && hex_val[p[2]] &&
+		hex_val[p[3]] && hex_val[p[4]] && hex_val[p[5]] &&
+		hex_val[p[6]] && hex_val[p[7]];
+}
+
+/*
+ * Puts 32-bit chunk as 8 hex digits
+ */
+static inline void put_chunk(char *p, uint32_t val)
+{
+	int i;
+
+	for (i = HEXCHARSZ - 1; i >= 0; i--) {
+		p[i] = hex_digits[val & 0xf];
+		val >>= 4;
+	}
+}
+
+/*
+ * Formats bitmap as comma-separated 32-bit hex chunks like the
+ * kernel does. The leading zero chunks are skipped. Returns length
+ * of full string.
+ */
 int bitmask_scnprintf(char *buf, size_t buflen, const BIT_ARRAY *bmp)
 {
 	int i = HOW_MANY(bmp->num_of_bits, HEXCHUNKSZ) - 1;
-	int len = 0;
-	uint32_t val;
-	buf[0] = 0;
+	size_t len = 0;
+	char chunk[HEXCHARSZ + 1];
+
+	while ((i > 0) && !bit_array_get_word32(bmp, i * HEXCHUNKSZ))
+		i--;
 
 	for (; i >= 0; i--) {
-		val = bit_array_get_word32(bmp, i * HEXCHUNKSZ);
-		if (val != 0 || len != 0 || i == 0 )
-			len += snprintf(buf + len, MAX(buflen - len, 0),
-				len ? ",%0*x" : "%0*x", HEXCHARSZ, val);
+		uint32_t val = bit_array_get_word32(bmp, i * HEXCHUNKSZ);
+		size_t n = len ? HEXCHARSZ + 1 : HEXCHARSZ;
+		/* Write directly if there is space for whole chunk */
+		if (len + n < buflen) {
+			if (len)
+				buf[len] = ',';
+			put_chunk(buf + len + n - HEXCHARSZ, val);
+		} else if (len + 1 < buflen) {
+			chunk[0] = ',';
+			put_chunk(chunk + n - HEXCHARSZ, val);
+			memcpy(buf + len, chunk, buflen - len - 1);
+		}
+		len += n;
 	}
+	if (buflen)
+		buf[MIN(len, buflen - 1)] = '\0';
+
 	return len;
 }
 
 /*
- * Converts one hex digit to int
+ * Parses comma-separated 32-bit hex chunks. The trailing whitespaces
+ * are allowed. The first pass validates string and finds its end. The
+ * second one decodes chunks from the end i.e. from the least
+ * significant chunk. The bitmap is not changed in case of error.
+ * Returns 0 or -1 in case of error
  */
-int hex_to_dec(char c)
+int bitmask_parse_user(const char *buf, size_t buflen, BIT_ARRAY *bmp)
 {
-	if (c >= '0' && c <= '9')
-		return c - '0';
-	else if (c >= 'a' && c <= 'f')
-		return c - 'a' + 10;
-	else if (c >= 'A' && c <= 'F')
-		return c - 'A' + 10;
-	else
+	const unsigned char *str = (const unsigned char *)buf;
+	size_t nwords = HOW_MANY(bit_array_length(bmp), HEXCHUNKSZ);
+	size_t chunks = 1;
+	size_t lead = 0; /* Number of leading zero chunks */
+	unsigned int digits = 0; /* Significant digits of current chunk */
+	size_t end;
+	size_t pos;
+	size_t k;
+
+	for (end = 0; end < buflen; end++) {
+		unsigned char c = str[end];
+		if (hex_val[c]) {
+			if (!digits && (c == '0'))
+				continue;
+			if (++digits > HEXCHARSZ)
+				return -1;
+		} else if (c == ',') {
+			if (!digits && (lead == chunks - 1))
+				lead++;
+			chunks++;
+			digits = 0;
+		} else {
+			break;
+		}
+	}
+	for (pos = end; (pos < buflen) && str[pos]; pos++) {
+		if (!isspace(str[pos]))
+			return -1;
+	}
+	/* The most significant non-zero chunk must fit the bitmap */
+	if (!digits && (lead == chunks - 1))
+		lead++;
+	if (chunks - lead > nwords)
 		return -1;
+
+	bit_array_clear_all(bmp);
+	for (pos = end, k = 0; k < chunks - lead; k++) {
+		uint32_t val = 0;
+		unsigned int shift = 0;
+		/* The kernel's chunks are always 8 digits long. The fast
+		   path is for the whole 8-digit chunk only. */
+		if ((pos >= HEXCHARSZ) && ((pos == HEXCHARSZ) ||
+			(str[pos - HEXCHARSZ - 1] == ',')) &&
+			hex_chunk(str + pos - HEXCHARSZ)) {
+			const unsigned char *p = str + pos - HEXCHARSZ;
+			val = ((uint32_t)(hex_val[p[0]] - 1) << 28) |
+				((uint32_t)(hex_val[p[1]] - 1) << 24) |
+				((uint32_t)(hex_val[p[2]] - 1) << 20) |
+				((uint32_t)(hex_val[p[3]] - 1) << 16) |
+				((uint32_t)(hex_val[p[4]] - 1) << 12) |
+				((uint32_t)(hex_val[p[5]] - 1) << 8) |
+				((uint32_t)(hex_val[p[6]] - 1) << 4) |
+				(uint32_t)(hex_val[p[7]] - 1);
+			pos -= HEXCHARSZ;
+		}
+		for (; pos && (str[pos - 1] != ','); pos--, shift += 4) {
+			if (shift < HEXCHUNKSZ)
+				val |= (uint32_t)(hex_val[str[pos - 1]] - 1) << shift;
+		}
+		/* Two chunks per 64-bit word of bitmap */
+		bmp->words[k / 2] |= (word_t)val << (HEXCHUNKSZ * (k % 2));
+		if (pos)
+			pos--; /* Skip comma */
+	}
+
+	return 0;
 }
 
 /*
- * Returns 32-bit token or -1 in case of error
+ * Formats bitmap as CPU list like "0-15,64-79". The empty bitmap
+ * gives empty string. Returns length of full string.
  */
-int64_t next_chunk(const char **buf, size_t *buflen)
+int bitmask_scnlistprintf(char *buf, size_t buflen, const BIT_ARRAY *bmp)
 {
-	uint32_t chunk = 0;
-	int h;
-	while (*buflen) {
-		if (**buf == '\0' || **buf == ',') {
-			(*buf)++, (*buflen)--;
-			return chunk;
-		}
-		
-		if (isspace(**buf)) {
-			while (isspace(**buf) && *buflen)
-				(*buf)++, (*buflen)--;
-			if (buflen && **buf != '\0')
-				return -1;
-			else
-				return chunk;
-		}
-
-		h = hex_to_dec(**buf);
-		if (h < 0)
-			return -1;
+	bit_index_t nbits = bit_array_length(bmp);
+	bit_index_t pos = 0;
+	bit_index_t first, last;
+	int len = 0;
 
-		if (chunk > CHUNK_MASK >> 4)
-			return -1;
+	if (buflen)
+		buf[0] = 0;
 
-		chunk = (chunk << 4) | h;
-		(*buf)++, (*buflen)--;
+	while ((pos < nbits) && bit_array_find_next_set_bit(bmp, pos, &first)) {
+		if ((first + 1 >= nbits) ||
+			!bit_array_find_next_clear_bit(bmp, first + 1, &last))
+			last = nbits;
+		last--;
+		len += snprintf(buf + MIN((size_t)len, buflen),
+			buflen > (size_t)len ? buflen - len : 0,
+			(first == last) ? "%s%llu" : "%s%llu-%llu",
+			len ? "," : "", (unsigned long long)first,
+			(unsigned long long)last);
+		pos = last + 1;
 	}
-	return chunk;
+	return len;
 }
 
-int count_chunks(const char *buf, size_t buflen)
+/*
+ * Parses CPU list like "0-3,8,10-11" in single pass. The trailing
+ * whitespaces are allowed. Returns 0 or -1 in case of error
+ */
+int bitmask_parse_list(const char *buf, size_t buflen, BIT_ARRAY *bmp)
 {
-	int chunks = 0;
-	int64_t chunk;
-	while (buflen && *buf != '\0') {
-		if ((chunk = next_chunk(&buf, &buflen)) >= 0)
-			chunks++;
-		else
+	bit_index_t nbits = bit_array_length(bmp);
+	const char *end = buf + buflen;
+	uint64_t first, last;
+
+	bit_array_clear_all(bmp);
+
+	while ((buf < end) && *buf && !isspace(*buf)) {
+		if (!isdigit(*buf))
+			return -1;
+		for (first = 0; (buf < end) && isdigit(*buf); buf++) {
+			first = first * 10 + (*buf - '0');
+			if (first >= nbits)
+				return -1;
+		}
+		last = first;
+		if ((buf < end) && (*buf == '-')) {
+			buf++;
+			if ((buf >= end) || !isdigit(*buf))
+				return -1;
+			for (last = 0; (buf < end) && isdigit(*buf); buf++) {
+				last = last * 10 + (*buf - '0');
+				if (last >= nbits)
+					return -1;
+			}
+			if (last < first)
+				return -1;
+		}
+		bit_array_set_region(bmp, first, last - first + 1);
+		if ((buf < end) && (*buf == ','))
+			buf++;
+	}
+	for (; (buf < end) && *buf; buf++) {
+		if (!isspace(*buf))
 			return -1;
 	}
-	return chunks;
+	return 0;
 }
 
 /*
+ * Reads mask from file. The CPU list file (like smp_affinity_list) is
+ * preferred. The hex file (like smp_affinity) is used if list file
+ * doesn't exist. Any of file names can be NULL.
  * Returns 0 or -1 in case of error
  */
-int bitmask_parse_user(const char *buf, size_t buflen, BIT_ARRAY *bmp)
+int bitmask_read(const char *list_fname, const char *hex_fname,
+	BIT_ARRAY *bmp)
 {
-	int nchunks = 0;
-	int64_t chunk;
+	FILE *f = NULL;
+	char *str = NULL;
+	size_t sz = 0;
+	ssize_t len;
+	int list = 0;
+	int ret = -1;
 
-	nchunks = count_chunks(buf, buflen);
-	if (nchunks < 0)
+	if (list_fname && (f = fopen(list_fname, "r")))
+		list = 1;
+	else if (!hex_fname || !(f = fopen(hex_fname, "r")))
 		return -1;
-
-	bit_array_clear_all(bmp);
-
-	while (nchunks) {
-		chunk = next_chunk(&buf, &buflen);
-		if (chunk < 0)
-			return -1;
-		nchunks--;
-		bit_array_set_word32(bmp, nchunks * HEXCHUNKSZ, (uint32_t)chunk);
+	if ((len = getline(&str, &sz, f)) >= 0) {
+		if (list)
+			ret = bitmask_parse_list(str, len, bmp);
+		else
+			ret = bitmask_parse_user(str, len, bmp);
 	}
-	return 0;
+	free(str);
+	fclose(f);
+
+	return ret;
 }
@@ -9,8 +9,15 @@
 #ifndef MAX
 	#define MAX(x,y) ((x) > (y) ? (x) : (y))
 #endif
+#ifndef MIN
+	#define MIN(x,y) ((x) < (y) ? (x) : (y))
+#endif
 
 int bitmask_scnprintf(char *buf, size_t buflen, const BIT_ARRAY *bmp);
 int bitmask_parse_user(const char *buf, size_t buflen, BIT_ARRAY *bmp);
+int bitmask_scnlistprintf(char *buf, size_t buflen, const BIT_ARRAY *bmp);
+int bitmask_parse_list(const char *buf, size_t buflen, BIT_ARRAY *bmp);
+int bitmask_read(const char *list_fname, const char *hex_fname,
+	BIT_ARRAY *bmp);
 
 #endif
@@ -0,0 +1,261 @@
+/*
+ * hexio_test
+ *
+ * Round-trip test of hex mask parser and formatter. The results are
+ * compared with the original simple implementation (ref_* functions).
+ * The strings are random with kernel's 8-digit chunks and with short
+ * chunks of arbitrary width.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "bit_array.h"
+#include "hexio.h"
+
+#define TEST_ITERS 20000
+#define TEST_BUF_SIZE (NR_CPUS / HEXCHUNKSZ * (HEXCHARSZ + 1) + 16)
+
+static unsigned int failures = 0;
+
+/*--------------------------------------------------------- */
+/* The original implementation */
+static int ref_scnprintf(char *buf, size_t buflen, const BIT_ARRAY *bmp)
+{
+	int i = HOW_MANY(bmp->num_of_bits, HEXCHUNKSZ) - 1;
+	int len = 0;
+	uint32_t val;
+	buf[0] = 0;
+
+	for (; i >= 0; i--) {
+		val = bit_array_get_word32(bmp, i * HEXCHUNKSZ);
+		if (val != 0 || len != 0 || i == 0 )
+			len += snprintf(buf + len, MAX(buflen - len, 0),
+				len ? ",%0*x" : "%0*x", HEXCHARSZ, val);
+	}
+	return len;
+}
+
+static int ref_hex_to_dec(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else
+		return -1;
+}
+
+static int64_t ref_next_chunk(const char **buf, size_t *buflen)
+{
+	uint32_t chunk = 0;
+	int h;
+	while (*buflen) {
+		if (**buf == '\0' || **buf == ',') {
+			(*buf)++, (*buflen)--;
+			return chunk;
+		}
+
+		if (isspace(**buf)) {
+			while (isspace(**buf) && *buflen)
+				(*buf)++, (*buflen)--;
+			if (buflen && **buf != '\0')
+				return -1;
+			else
+				return chunk;
+		}
+
+		h = ref_hex_to_dec(**buf);
+		if (h < 0)
+			return -1;
+
+		if (chunk > CHUNK_MASK >> 4)
+			return -1;
+
+		chunk = (chunk << 4) | h;
+		(*buf)++, (*buflen)--;
+	}
+	return chunk;
+}
+
+static int ref_count_chunks(const char *buf, size_t buflen)
+{
+	int chunks = 0;
+	int64_t chunk;
+	while (buflen && *buf != '\0') {
+		if ((chunk = ref_next_chunk(&buf, &buflen)) >= 0)
+			chunks++;
+		else
+			return -1;
+	}
+	return chunks;
+}
+
+/* The original parser doesn't check the bitmap length. The caller
+   checks it by ref_count_chunks(). */
+static int ref_parse_user(const char *buf, size_t buflen, BIT_ARRAY *bmp)
+{
+	int nchunks = 0;
+	int64_t chunk;
+
+	nchunks = ref_count_chunks(buf, buflen);
+	if (nchunks < 0)
+		return -1;
+
+	bit_array_clear_all(bmp);
+
+	while (nchunks) {
+		chunk = ref_next_chunk(&buf, &buflen);
+		if (chunk < 0)
+			return -1;
+		nchunks--;
+		bit_array_set_word32(bmp, nchunks * HEXCHUNKSZ, (uint32_t)chunk);
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static void fail(const char *what, const char *str, size_t nbits)
+{
+	fprintf(stderr, "FAIL: %s: \"%s\" nbits=%zu\n", what, str, nbits);
+	failures++;
+}
+
+/*--------------------------------------------------------- */
+/* Parse string by both parsers and compare the results. The strings
+   with more chunks than bitmap has are skipped. */
+static void check_parse(const char *str, size_t nbits)
+{
+	BIT_ARRAY *bmp;
+	BIT_ARRAY *ref;
+	int res, ref_res;
+
+	if (ref_count_chunks(str, strlen(str)) > HOW_MANY(nbits, HEXCHUNKSZ))
+		return;
+	bmp = bit_array_create(nbits);
+	ref = bit_array_create(nbits);
+
+	res = bitmask_parse_user(str, strlen(str), bmp);
+	ref_res = ref_parse_user(str, strlen(str), ref);
+	if (res != ref_res)
+		fail("parse result", str, nbits);
+	else if (!res && bit_array_cmp(bmp, ref))
+		fail("parse value", str, nbits);
+	bit_array_free(bmp);
+	bit_array_free(ref);
+}
+
+/*--------------------------------------------------------- */
+/* Format random bitmap by both formatters, parse it back. */
+static void check_format(size_t nbits)
+{
+	BIT_ARRAY *bmp = bit_array_create(nbits);
+	BIT_ARRAY *back = bit_array_create(nbits);
+	char buf[TEST_BUF_SIZE];
+	char ref_buf[TEST_BUF_SIZE];
+	int len, ref_len;
+
+	/* Sparse bitmaps have zero chunks */
+	bit_array_random(bmp, (float)(rand() % 100) / 1000);
+	len = bitmask_scnprintf(buf, sizeof(buf), bmp);
+	ref_len = ref_scnprintf(ref_buf, sizeof(ref_buf), bmp);
+	if ((len != ref_len) || strcmp(buf, ref_buf))
+		fail("format", ref_buf, nbits);
+	if (bitmask_parse_user(buf, len, back) || bit_array_cmp(bmp, back))
+		fail("round-trip", buf, nbits);
+	check_parse(buf, nbits);
+	bit_array_free(bmp);
+	bit_array_free(back);
+}
+
+/*--------------------------------------------------------- */
+/* Random string of chunks with arbitrary width (0-10 digits incl.
+   leading zeros). The trailing comma is not generated: the original
+   parser ignores it and the new one treats it as empty chunk. */
+static void random_mask(char *buf, size_t chunks)
+{
+	static const char digits[] = "0123456789abcdefABCDEF";
+	size_t len = 0;
+	size_t i;
+
+	for (i = 0; i < chunks; i++) {
+		unsigned int width;
+		unsigned int j;
+		if (i)
+			buf[len++] = ',';
+		switch (rand() % 4) {
+		case 0:
+			width = HEXCHARSZ;
+			break;
+		case 1:
+			width = rand() % 3;
+			break;
+		default:
+			width = rand() % (HEXCHARSZ + 3);
+			break;
+		}
+		if (!width && (i == chunks - 1) && i)
+			width = 1;
+		for (j = 0; j < width; j++) {
+			if ((j < 2) && !(rand() % 3))
+				buf[len++] = '0';
+			else
+				buf[len++] = digits[rand() % (sizeof(digits) - 1)];
+		}
+	}
+	if (!(rand() % 4))
+		buf[len++] = '\n';
+	/* Illegal character */
+	if (len && !(rand() % 20))
+		buf[rand() % len] = 'x';
+	buf[len] = '\0';
+}
+
+/*--------------------------------------------------------- */
+int main(void)
+{
+	static const size_t widths[] = {32, 64, 96, 128, 256, NR_CPUS};
+	static const char *fixed[] = {
+		"3,000001",
+		",1,34567",
+		"1,2345678",
+		"12345678",
+		"0,00000000,ffffffff",
+		"ffffffff,0",
+		"1,,2",
+		"00000000000000001",
+		"",
+		"\n",
+		NULL
+	};
+	char buf[TEST_BUF_SIZE];
+	unsigned int i;
+	unsigned int w;
+
+	srand(1);
+	for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		for (i = 0; fixed[i]; i++)
+			check_parse(fixed[i], widths[w]);
+	}
+	for (i = 0; i < TEST_ITERS; i++) {
+		size_t nbits = widths[rand() % (sizeof(widths) / sizeof(widths[0]))];
+		size_t nwords = HOW_MANY(nbits, HEXCHUNKSZ);
+		check_format(nbits);
+		random_mask(buf, 1 + rand() % (nwords < 8 ? nwords : 8));
+		check_parse(buf, nbits);
+	}
+
+	if (failures) {
+		fprintf(stderr, "%u failures\n", failures);
+		return 1;
+	}
+	printf("hexio: OK\n");
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+/* history.c
+ * Short history of samples and periodicity detection.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+void history_init(history_t *history)
+{
+	memset(history, 0, sizeof(*history));
+}
+
+/* Get sample. The ago=0 is the latest sample. */
+float history_get(const history_t *history, unsigned int ago)
+{
+	if (ago >= history->num)
+		return 0;
+	return history->val[(history->pos + HISTORY_LEN - 1 - ago) % HISTORY_LEN];
+}
+
+static float history_mean(const history_t *history)
+{
+	unsigned int i;
+	float sum = 0;
+
+	if (history->num == 0)
+		return 0;
+	for (i = 0; i < history->num; i++)
+		sum += history->val[i];
+
+	return sum / history->num;
+}
+
+/* Search for the period using autocorrelation. The lag with maximal
+   autocorrelation is a period. The period must be seen twice at least.
+   Returns 0 if history is not periodic. */
+unsigned int history_period(const history_t *history)
+{
+	float mean;
+	float var = 0;
+	float max_acf = HISTORY_MIN_ACF;
+	unsigned int period = 0;
+	unsigned int lag;
+	unsigned int i;
+
+	if (history->num < HISTORY_MIN_LEN)
+		return 0;
+
+	mean = history_mean(history);
+	for (i = 0; i < history->num; i++) {
+		float d = history_get(history, i) - mean;
+		var += d * d;
+	}
+	if (var == 0) /* Constant value */
+		return 0;
+
+	/* Lag 1 is not a period. It's a slow changing value. */
+	for (lag = 2; lag <= history->num / 2; lag++) {
+		float acf = 0;
+		for (i = 0; i + lag < history->num; i++)
+			acf += (history_get(history, i) - mean) *
+				(history_get(history, i + lag) - mean);
+		/* Normalize to number of summands */
+		acf = acf * history->num / (history->num - lag) / var;
+		if (acf > max_acf) {
+			max_acf = acf;
+			period = lag;
+		}
+	}
+
+	return period;
+}
+
+/* The latest sample is a periodic burst. The history is periodic,
+   the sample one period ago was burst too and the high values
+   don't last the whole period. */
+static int history_detect_burst(const history_t *history)
+{
+	unsigned int period;
+	unsigned int i;
+	unsigned int high = 0;
+	float mean;
+
+	if (!(period = history_period(history)))
+		return 0;
+	mean = history_mean(history);
+	if (history_get(history, 0) <= mean)
+		return 0;
+	if (history_get(history, period) <= mean)
+		return 0;
+	for (i = 0; i < period; i++) {
+		if (history_get(history, i) > mean)
+			high++;
+	}
+	/* Sustained load is not a burst */
+	if (high * 2 > period)
+		return 0;
+
+	return 1;
+}
+
+static void history_push(history_t *history, float val)
+{
+	history->val[history->pos] = val;
+	history->pos = (history->pos + 1) % HISTORY_LEN;
+	if (history->num < HISTORY_LEN)
+		history->num++;
+}
+
+/* Add value measured since the previous value till now. The val is
+   a value per time unit (load, rate). The value is spread over the
+   samples of HISTORY_STEP ms. The burst detection is done here once
+   per new sample. */
+void history_add(history_t *history, float val, unsigned long long now)
+{
+	unsigned long long t = history->last;
+	int pushed = 0;
+
+	/* The first value has unknown start. The long pause (time jump)
+	   breaks the history. */
+	if (!history->started || (now < history->last) ||
+		(now - history->last > HISTORY_LEN * HISTORY_STEP)) {
+		history_init(history);
+		history->started = 1;
+		history->last = now;
+		history->start = now;
+		return;
+	}
+	while (t < now) {
+		unsigned long long end = history->start + HISTORY_STEP;
+		if (end > now)
+			end = now;
+		history->acc += val * (end - t);
+		t = end;
+		if (end - history->start < HISTORY_STEP)
+			break;
+		history_push(history, history->acc / HISTORY_STEP);
+		history->acc = 0;
+		history->start = end;
+		pushed = 1;
+	}
+	history->last = now;
+	if (pushed)
+		history->burst = history_detect_burst(history);
+}
+
+/* Burst state of the latest sample */
+int history_burst(const history_t *history)
+{
+	return history->burst;
+}
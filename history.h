@@ -0,0 +1,34 @@
+#ifndef _history_h
+#define _history_h
+
+/* Number of stored samples. The longest detected period is
+   the half of history length. */
+#define HISTORY_LEN 32
+/* Time covered by one sample, ms. The balancing cycles have different
+   length (short and long intervals) so the values are resampled to
+   fixed time step. Then the period is measured in time, not in cycles. */
+#define HISTORY_STEP 2000
+/* Minimal number of samples to search for period */
+#define HISTORY_MIN_LEN 8
+/* Minimal autocorrelation value to consider the history as periodic */
+#define HISTORY_MIN_ACF 0.6
+
+struct history_s {
+	float val[HISTORY_LEN]; /* Ring buffer of samples */
+	unsigned int pos; /* Position of next sample */
+	unsigned int num; /* Number of stored samples */
+	int started; /* The previous value is known */
+	unsigned long long last; /* Time of previous value, ms */
+	unsigned long long start; /* Start of incomplete sample, ms */
+	float acc; /* Value multiplied by time within incomplete sample */
+	int burst; /* The latest sample is a periodic burst */
+};
+typedef struct history_s history_t;
+
+void history_init(history_t *history);
+void history_add(history_t *history, float val, unsigned long long now);
+float history_get(const history_t *history, unsigned int ago);
+unsigned int history_period(const history_t *history);
+int history_burst(const history_t *history);
+
+#endif
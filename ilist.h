@@ -0,0 +1,106 @@
+#ifndef _ilist_h
+#define _ilist_h
+
+#include <stddef.h>
+
+/* Intrusive doubly linked list. The link is embedded into the item's
+   structure so adding and removing of item doesn't allocate memory.
+   The item can be a member of single list per embedded link. */
+
+typedef struct ilist_s ilist_t;
+typedef struct ilist_link_s ilist_link_t;
+
+struct ilist_link_s {
+	ilist_link_t *prev;
+	ilist_link_t *next;
+	ilist_t *list; /* List the item belongs to. NULL if none */
+};
+
+struct ilist_s {
+	ilist_link_t *head;
+	ilist_link_t *tail;
+	unsigned int len;
+};
+
+/* Get item by its embedded link */
+#define ilist_entry(link, type, member) \
+	((type *)((char *)(link) - offsetof(type, member)))
+
+#define ilist_for_each(link, ilist) \
+	for ((link) = (ilist)->head; (link); (link) = (link)->next)
+
+static inline void ilist_init(ilist_t *list)
+{
+	list->head = NULL;
+	list->tail = NULL;
+	list->len = 0;
+}
+
+static inline void ilist_link_init(ilist_link_t *link)
+{
+	link->prev = NULL;
+	link->next = NULL;
+	link->list = NULL;
+}
+
+static inline unsigned int ilist_len(const ilist_t *list)
+{
+	return list->len;
+}
+
+/* Insert link after pos. The NULL pos means list head. */
+static inline void ilist_insert_after(ilist_t *list, ilist_link_t *pos,
+	ilist_link_t *link)
+{
+	link->prev = pos;
+	link->next = pos ? pos->next : list->head;
+	if (link->next)
+		link->next->prev = link;
+	else
+		list->tail = link;
+	if (pos)
+		pos->next = link;
+	else
+		list->head = link;
+	link->list = list;
+	list->len++;
+}
+
+static inline void ilist_add_tail(ilist_t *list, ilist_link_t *link)
+{
+	ilist_insert_after(list, list->tail, link);
+}
+
+/* Remove link from its list. Does nothing for unlinked item. */
+static inline void ilist_del(ilist_link_t *link)
+{
+	ilist_t *list = link->list;
+
+	if (!list)
+		return;
+	if (link->prev)
+		link->prev->next = link->next;
+	else
+		list->head = link->next;
+	if (link->next)
+		link->next->prev = link->prev;
+	else
+		list->tail = link->prev;
+	list->len--;
+	ilist_link_init(link);
+}
+
+/* Unlink all the items */
+static inline void ilist_clear(ilist_t *list)
+{
+	ilist_link_t *link = list->head;
+
+	while (link) {
+		ilist_link_t *next = link->next;
+		ilist_link_init(link);
+		link = next;
+	}
+	ilist_init(list);
+}
+
+#endif
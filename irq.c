@@ -9,13 +9,20 @@
 #include <dirent.h>
 #include <limits.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "lub/list.h"
 #include "irq.h"
 #include "pxm.h"
+#include "rps.h"
+#include "path.h"
+#include "event.h"
 
 #define STR(str) ( str ? str : "" )
 
+/* IRQs to relink to CPUs by link_irqs_to_cpus() */
+static ilist_t changed = { NULL, NULL, 0 };
+
 int irq_list_compare(const void *first, const void *second)
 {
 	const irq_t *f = (const irq_t *)first;
@@ -32,26 +39,68 @@ static irq_t * irq_new(int num)
 	new->irq = num;
 	new->type = NULL;
 	new->desc = NULL;
+	new->pci_addr = NULL;
 	new->refresh = 1;
 	new->old_intr = 0;
 	new->intr = 0;
+	history_init(&new->history);
 	new->cpu = NULL;
+	ilist_link_init(&new->cpu_link);
 	new->weight = 0;
+	new->rate = 0;
+	new->stat_time = 0;
+	new->last_move = 0;
+	new->moves = 0;
+	new->backoff = 0;
+	new->rate_before = 0;
+	new->rate_after = 0;
+	new->rate_after_pending = 0;
 	cpus_init(new->local_cpus);
 	cpus_init(new->affinity);
 	cpus_setall(new->local_cpus);
+	cpus_init(new->consumer_cpus);
+	cpus_clear(new->consumer_cpus);
+	cpus_init(new->hint);
+	cpus_clear(new->hint);
 	cpus_clear(new->affinity);
+	new->affinity_raw = NULL;
+	ilist_link_init(&new->change_link);
+	ilist_add_tail(&changed, &new->change_link);
 	new->blacklisted = 0;
+	new->blacklist_errno = 0;
+	new->blacklist_time = 0;
+	new->blacklist_count = 0;
+	new->pinned = 0;
+	new->move = IRQ_MOVE_NONE;
+	new->move_cpu = 0;
+	new->move_retries = 0;
+	new->move_time = 0;
+	new->move_base = 0;
+	new->move_cur = 0;
+	new->move_base_valid = 0;
+	new->move_cur_valid = 0;
+	new->rps = NULL;
+	cpus_init(new->rps_cpus);
+	cpus_clear(new->rps_cpus);
 
 	return new;
 }
 
 static void irq_free(irq_t *irq)
 {
+	ilist_del(&irq->cpu_link);
+	ilist_del(&irq->change_link);
+	free(irq->affinity_raw);
 	free(irq->type);
 	free(irq->desc);
+	free(irq->pci_addr);
+	/* Don't leave RPS of disappeared IRQ */
+	rps_disable(irq);
 	cpus_free(irq->local_cpus);
+	cpus_free(irq->consumer_cpus);
+	cpus_free(irq->hint);
 	cpus_free(irq->affinity);
+	cpus_free(irq->rps_cpus);
 	free(irq);
 }
 
@@ -67,7 +116,7 @@ irq_t * irq_list_search(lub_list_t *irqs, unsigned int num)
 	return (irq_t *)lub_list_node__get_data(node);
 }
 
-static irq_t * irq_list_add(lub_list_t *irqs, unsigned int num)
+irq_t * irq_list_add(lub_list_t *irqs, unsigned int num)
 {
 	lub_list_node_t *node;
 	irq_t *new;
@@ -130,10 +179,8 @@ int irq_list_show(lub_list_t *irqs)
 static int parse_local_cpus(lub_list_t *irqs, const char *sysfs_path,
 	unsigned int num, lub_list_t *pxms)
 {
+	char list[PATH_MAX];
 	char path[PATH_MAX];
-	FILE *fd = NULL;
-	char *str = NULL;
-	size_t sz;
 	cpumask_t local_cpus;
 	irq_t *irq = NULL;
 	cpumask_t cpumask;
@@ -146,6 +193,11 @@ static int parse_local_cpus(lub_list_t *irqs, const char *sysfs_path,
 	cpus_init(local_cpus);
 	cpus_init(cpumask);
 
+	/* Remember device address. It's needed to find device's
+	   network queues. */
+	free(irq->pci_addr);
+	irq->pci_addr = strdup(sysfs_path);
+
 	/* Find proximity in config file. */
 	if (!pxm_search(pxms, sysfs_path, &cpumask)) {
 		cpus_copy(irq->local_cpus, cpumask);
@@ -153,22 +205,16 @@ static int parse_local_cpus(lub_list_t *irqs, const char *sysfs_path,
 		goto error;
 	}
 
-	snprintf(path, sizeof(path),
+	path_build(list, sizeof(list),
+		"%s/%s/local_cpulist", SYSFS_PCI_PATH, sysfs_path);
+	path_build(path, sizeof(path),
 		"%s/%s/local_cpus", SYSFS_PCI_PATH, sysfs_path);
-	path[sizeof(path) - 1] = '\0';
-	if (!(fd = fopen(path, "r")))
+	if (cpumask_read(list, path, local_cpus) < 0)
 		goto error;
-	if (getline(&str, &sz, fd) < 0)
-		goto error;
-	cpumask_parse_user(str, strlen(str), local_cpus);
 	cpus_and(irq->local_cpus, irq->local_cpus, local_cpus);
 	ret = 0; /* success */
 
 error:
-	if (fd)
-		fclose(fd);
-	if (str)
-		free(str);
 	cpus_free(local_cpus);
 	cpus_free(cpumask);
 
@@ -187,7 +233,8 @@ static int parse_sysfs(lub_list_t *irqs, lub_list_t *pxms)
 
 	/* Now we can parse PCI devices only */
 	/* Get info from /sys/bus/pci/devices */
-	dir = opendir(SYSFS_PCI_PATH);
+	path_build(path, sizeof(path), "%s", SYSFS_PCI_PATH);
+	dir = opendir(path);
 	if (!dir)
 		return -1;
 	while((dent = readdir(dir))) {
@@ -196,7 +243,7 @@ static int parse_sysfs(lub_list_t *irqs, lub_list_t *pxms)
 			continue;
 
 		/* Search for MSI IRQs. Since linux-3.2 */
-		snprintf(path, sizeof(path),
+		path_build(path, sizeof(path),
 			"%s/%s/msi_irqs", SYSFS_PCI_PATH, dent->d_name);
 		path[sizeof(path) - 1] = '\0';
 		if ((msi = opendir(path))) {
@@ -214,7 +261,7 @@ static int parse_sysfs(lub_list_t *irqs, lub_list_t *pxms)
 		}
 
 		/* Try to get IRQ number from irq file */
-		snprintf(path, sizeof(path),
+		path_build(path, sizeof(path),
 			"%s/%s/irq", SYSFS_PCI_PATH, dent->d_name);
 		path[sizeof(path) - 1] = '\0';
 		if (!(fd = fopen(path, "r")))
@@ -234,32 +281,239 @@ static int parse_sysfs(lub_list_t *irqs, lub_list_t *pxms)
 	return 0;
 }
 
+/* Read current affinity. The parsing is skipped if the file content
+   is the same as on previous read. The changed IRQ is added to the set
+   of IRQs to relink. Returns 1 if affinity is changed, 0 if not and -1
+   in case of error. */
 int irq_get_affinity(irq_t *irq)
 {
 	char path[PATH_MAX];
-	FILE *fd;
+	FILE *f;
 	char *str = NULL;
-	size_t sz;
+	size_t sz = 0;
+	ssize_t len;
+	int list = 1;
+	int ret;
 
 	if (!irq)
 		return -1;
 
-	snprintf(path, sizeof(path),
-		"%s/%u/smp_affinity", PROC_IRQ, irq->irq);
-	path[sizeof(path) - 1] = '\0';
-	if (!(fd = fopen(path, "r")))
+	path_build(path, sizeof(path),
+		"%s/%u/smp_affinity_list", PROC_IRQ, irq->irq);
+	if (!(f = fopen(path, "r"))) {
+		list = 0;
+		path_build(path, sizeof(path),
+			"%s/%u/smp_affinity", PROC_IRQ, irq->irq);
+		if (!(f = fopen(path, "r")))
+			return -1;
+	}
+	len = getline(&str, &sz, f);
+	fclose(f);
+	if (len < 0) {
+		free(str);
 		return -1;
-	if (getline(&str, &sz, fd) < 0) {
-		fclose(fd);
+	}
+	if (irq->affinity_raw && !strcmp(irq->affinity_raw, str)) {
+		free(str);
+		return 0;
+	}
+
+	if (list)
+		ret = cpulist_parse(str, len, irq->affinity);
+	else
+		ret = cpumask_parse_user(str, len, irq->affinity);
+	irq_changed(irq);
+	free(irq->affinity_raw);
+	irq->affinity_raw = NULL;
+	if (ret < 0) {
+		free(str);
 		return -1;
 	}
-	fclose(fd);
-	cpumask_parse_user(str, strlen(str), irq->affinity);
-	free(str);
+	irq->affinity_raw = str;
+
+	return 1;
+}
+
+/* Add IRQ to the set of IRQs to relink. The IRQ is relinked by its
+   current affinity. */
+void irq_changed(irq_t *irq)
+{
+	if (!irq->change_link.list)
+		ilist_add_tail(&changed, &irq->change_link);
+}
+
+/* Take IRQ from the set of changed IRQs. Returns NULL if set is empty. */
+irq_t * irq_changed_pop(void)
+{
+	ilist_link_t *link = changed.head;
+
+	if (!link)
+		return NULL;
+	ilist_del(link);
+
+	return ilist_entry(link, irq_t, change_link);
+}
+
+/* Read affinity hint set by driver. Many NIC drivers spread queues
+   by hint. The zero mask means no hint. */
+int irq_get_hint(irq_t *irq)
+{
+	char path[PATH_MAX];
+
+	path_build(path, sizeof(path),
+		"%s/%u/affinity_hint", PROC_IRQ, irq->irq);
+	if (cpumask_read(NULL, path, irq->hint) < 0) {
+		cpus_clear(irq->hint);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Read effective affinity i.e. CPUs the kernel really routes IRQ to.
+   The file is available since Linux 4.15. */
+int irq_get_effective(irq_t *irq, cpumask_t *cpumask)
+{
+	char list[PATH_MAX];
+	char path[PATH_MAX];
+
+	path_build(list, sizeof(list),
+		"%s/%u/effective_affinity_list", PROC_IRQ, irq->irq);
+	path_build(path, sizeof(path),
+		"%s/%u/effective_affinity", PROC_IRQ, irq->irq);
+
+	return cpumask_read(list, path, *cpumask);
+}
+
+/* The affinity write error can't go away itself. The EIO is returned
+   for managed and per-CPU IRQs. Another errors (EBUSY while driver
+   reset, ENOSPC if no free vectors, EINVAL if CPUs are offline) can be
+   temporary. */
+int irq_error_permanent(int err)
+{
+	switch (err) {
+	case EIO:
+	case EPERM:
+	case EACCES:
+	case EROFS:
+		return 1;
+	default:
+		break;
+	}
 
 	return 0;
 }
 
+/* The pinned and stuck IRQs are not moved by balancer */
+int irq_movable(irq_t *irq)
+{
+	return !irq->pinned && (irq->move != IRQ_MOVE_STUCK);
+}
+
+/* If affinity uses more than one CPU then consider IRQ as new one.
+ * It's not normal state for really non-new IRQs. Don't balance
+ * IRQs with 0 number of interrupts.
+ */
+int irq_need_balance(irq_t *irq)
+{
+	if (!irq_movable(irq))
+		return 0;
+	if (cpus_weight(irq->affinity) <= 1)
+		return 0;
+	if (irq->intr == 0)
+		return 0;
+	return 1;
+}
+
+/* Remove IRQs without refresh flag i.e. disappeared IRQs */
+int irq_list_remove_stale(lub_list_t *irqs)
+{
+	lub_list_node_t *iter;
+
+	iter = lub_list_iterator_init(irqs);
+	while(iter) {
+		irq_t *irq;
+		lub_list_node_t *old_iter;
+		irq = (irq_t *)lub_list_node__get_data(iter);
+		old_iter = iter;
+		iter = lub_list_iterator_next(iter);
+		if (!irq->refresh) {
+			lub_list_del(irqs, old_iter);
+			lub_list_node_free(old_iter);
+			printf("Remove IRQ %3d %s\n", irq->irq, STR(irq->desc));
+			event_log(EVENT_INFO, "irq_remove", "\"irq\":%u",
+				irq->irq);
+			irq_free(irq);
+		} else {
+			/* Drop refresh flag for next iteration */
+			irq->refresh = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* Find local CPUs for all known IRQs again. It's needed when
+   proximity config is changed. */
+int irq_list_rescan_local(lub_list_t *irqs, lub_list_t *pxms)
+{
+	lub_list_node_t *iter;
+
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		cpus_setall(irq->local_cpus);
+	}
+
+	return parse_sysfs(irqs, pxms);
+}
+
+/* Parse header of /proc/interrupts like "CPU0 CPU1 CPU4". The offline
+   CPUs are omitted so columns are mapped to CPU IDs. */
+static unsigned int *parse_header(const char *str, unsigned int *ncols)
+{
+	unsigned int *cols = NULL;
+	const char *p;
+	unsigned int num = 0;
+
+	for (p = str; (p = strstr(p, "CPU")); p += 3)
+		num++;
+	if (num && (cols = malloc(num * sizeof(*cols)))) {
+		num = 0;
+		for (p = str; (p = strstr(p, "CPU")); p += 3)
+			cols[num++] = strtoul(p + 3, NULL, 10);
+	} else {
+		num = 0;
+	}
+	*ncols = num;
+
+	return cols;
+}
+
+/* Number of interrupts on specified CPU from the /proc/interrupts
+   line after IRQ number */
+static int parse_cpu_intr(const char *str, const unsigned int *cols,
+	unsigned int ncols, unsigned int cpu, unsigned long long *intr)
+{
+	unsigned int i;
+	char *endptr;
+
+	if (*str == ':')
+		str++;
+	for (i = 0; i < ncols; i++) {
+		unsigned long long val = strtoull(str, &endptr, 10);
+		if (endptr == str)
+			return -1;
+		if (cols[i] == cpu) {
+			*intr = val;
+			return 0;
+		}
+		str = endptr;
+	}
+
+	return -1;
+}
+
 /* Parse /proc/interrupts to get actual IRQ list */
 int scan_irqs(lub_list_t *irqs, lub_list_t *balance_irqs, lub_list_t *pxms)
 {
@@ -268,17 +522,23 @@ int scan_irqs(lub_list_t *irqs, lub_list_t *balance_irqs, lub_list_t *pxms)
 	char *str = NULL;
 	size_t sz;
 	irq_t *irq;
-	lub_list_node_t *iter;
 	int new_irq_num = 0;
+	char path[PATH_MAX];
+	unsigned int *cols = NULL;
+	unsigned int ncols = 0;
 
-	if (!(fd = fopen(PROC_INTERRUPTS, "r")))
+	path_build(path, sizeof(path), "%s", PROC_INTERRUPTS);
+	if (!(fd = fopen(path, "r")))
 		return -1;
 	while(getline(&str, &sz, fd) >= 0) {
-		char *endptr, *tok;
+		char *endptr, *tok, *desc;
 		int new = 0;
 		num = strtoul(str, &endptr, 10);
-		if (endptr == str)
+		if (endptr == str) {
+			if (!cols)
+				cols = parse_header(str, &ncols);
 			continue;
+		}
 
 		/* Search for IRQ within list of known IRQs */
 		if (!(irq = irq_list_search(irqs, num))) {
@@ -296,9 +556,10 @@ int scan_irqs(lub_list_t *irqs, lub_list_t *balance_irqs, lub_list_t *pxms)
 		 */
 		irq->refresh = 1;
 
-		/* Doesn't refresh info for blacklisted IRQs */
-		if (irq->blacklisted)
-			continue;
+		/* Interrupts on target CPU to verify the move */
+		if (irq->move == IRQ_MOVE_PENDING)
+			irq->move_cur_valid = !parse_cpu_intr(endptr, cols,
+				ncols, irq->move_cpu, &irq->move_cur);
 	
 		/* Find IRQ type - first non-digital and non-space */
 		while (*endptr && !isalpha(*endptr))
@@ -315,8 +576,44 @@ int scan_irqs(lub_list_t *irqs, lub_list_t *balance_irqs, lub_list_t *pxms)
 		tok = endptr; /* It will be device list */
 		while (*endptr && !iscntrl(*endptr))
 			endptr++;
+		desc = strndup(tok, endptr - tok);
+		/* The IRQ number is reused by another device (driver reload
+		   or IRQ restored from state file). Consider it as new one. */
+		if (!new && irq->desc && strcmp(irq->desc, desc)) {
+			new = 1;
+			new_irq_num++;
+			cpus_setall(irq->local_cpus);
+			free(irq->pci_addr);
+			irq->pci_addr = NULL;
+			rps_disable(irq);
+			irq->old_intr = 0;
+			history_init(&irq->history);
+			irq->rate = 0;
+			irq->stat_time = 0;
+			irq->last_move = 0;
+			irq->moves = 0;
+			irq->backoff = 0;
+			irq->rate_before = 0;
+			irq->rate_after = 0;
+			irq->rate_after_pending = 0;
+			irq->blacklisted = 0;
+			irq->blacklist_errno = 0;
+			irq->blacklist_time = 0;
+			irq->blacklist_count = 0;
+			irq->pinned = 0;
+			irq->move = IRQ_MOVE_NONE;
+			irq->move_retries = 0;
+			irq->move_time = 0;
+			irq->move_base_valid = 0;
+			irq->move_cur_valid = 0;
+			irq_changed(irq);
+		}
 		free(irq->desc);
-		irq->desc = strndup(tok, endptr - tok);
+		irq->desc = desc;
+
+		/* Doesn't refresh info for blacklisted IRQs */
+		if (irq->blacklisted)
+			continue;
 
 		/* Always get current smp affinity. It's necessary due to
 		 * problems with arch/driver. The affinity can be old (didn't
@@ -325,42 +622,25 @@ int scan_irqs(lub_list_t *irqs, lub_list_t *balance_irqs, lub_list_t *pxms)
 		irq_get_affinity(irq);
 
 		/* Print info about new IRQ. */
-		if (new)
+		if (new) {
+			char desc[128];
+			irq_get_hint(irq);
 			printf("Add IRQ %3d %s\n", irq->irq, STR(irq->desc));
-
-		/* If affinity uses more than one CPU then consider IRQ as new one.
-		 * It's not normal state for really non-new IRQs.
-		 */
-		if (cpus_weight(irq->affinity) <= 1)
-			continue;
-
-		/* Don't balance IRQs with 0 number of interrupts */
-		if (irq->intr == 0)
-			continue;
+			event_log(EVENT_INFO, "irq_add",
+				"\"irq\":%u,\"desc\":\"%s\"", irq->irq,
+				event_str(desc, sizeof(desc), irq->desc));
+		}
 
 		/* Add IRQs to list of IRQs to balance. */
-		lub_list_add(balance_irqs, irq);
+		if (irq_need_balance(irq))
+			lub_list_add(balance_irqs, irq);
 	}
 	free(str);
+	free(cols);
 	fclose(fd);
 
 	/* Remove disappeared IRQs */
-	iter = lub_list_iterator_init(irqs);
-	while(iter) {
-		irq_t *irq;
-		lub_list_node_t *old_iter;
-		irq = (irq_t *)lub_list_node__get_data(iter);
-		old_iter = iter;
-		iter = lub_list_iterator_next(iter);
-		if (!irq->refresh) {
-			lub_list_del(irqs, old_iter);
-			printf("Remove IRQ %3d %s\n", irq->irq, STR(irq->desc));
-			irq_free(irq);
-		} else {
-			/* Drop refresh flag for next iteration */
-			irq->refresh = 0;
-		}
-	}
+	irq_list_remove_stale(irqs);
 
 	/* No new IRQs were found. It doesn't need to scan sysfs. */
 	if (new_irq_num == 0)
@@ -3,19 +3,57 @@
 
 #include "cpumask.h"
 #include "cpu.h"
+#include "history.h"
+
+/* State of the last affinity change made by birq */
+typedef enum {
+	IRQ_MOVE_NONE,
+	IRQ_MOVE_PENDING, /* Written but not confirmed yet */
+	IRQ_MOVE_MOVED, /* Confirmed by kernel or by interrupts on target */
+	IRQ_MOVE_STUCK /* Kernel doesn't apply the affinity. Don't move it */
+} irq_move_e;
 
 struct irq_s {
 	unsigned int irq; /* IRQ's ID */
 	char *type; /* IRQ type from /proc/interrupts like PCI-MSI-edge */
 	char *desc; /* IRQ text description - device list */
+	char *pci_addr; /* PCI address of IRQ's device. NULL if unknown */
 	int refresh; /* Refresh flag. It !=0 if irq was found while populate */
 	cpumask_t local_cpus; /* Local CPUs for this IRQs */
+	cpumask_t consumer_cpus; /* Preferred CPUs near consumer. Empty if none */
+	cpumask_t hint; /* Driver's /proc/irq/.../affinity_hint. Empty if none */
 	cpumask_t affinity; /* Real current affinity form /proc/irq/.../smp_affinity */
+	char *affinity_raw; /* Content of affinity file. NULL if not read yet */
+	ilist_link_t change_link; /* Link of changed IRQs set */
 	unsigned long long intr; /* Current number of interrupts */
 	unsigned long long old_intr; /* Previous total number of interrupts. */
+	history_t history; /* History of number of interrupts */
 	cpu_t *cpu; /* Current IRQ affinity. Reference to correspondent CPU */
+	ilist_link_t cpu_link; /* Link of CPU's IRQ list */
 	int weight; /* Flag to don't move current IRQ anyway */
+	unsigned long long rate; /* Interrupts per second */
+	unsigned long long stat_time; /* Time of last statistics, ms */
+	unsigned long long last_move; /* Time of last move, ms. 0 - never moved */
+	unsigned int moves; /* Number of moves */
+	unsigned int backoff; /* Cooldown exponent for repeatedly moved IRQ */
+	unsigned long long rate_before; /* Rate before the last move */
+	unsigned long long rate_after; /* Rate after the last move */
+	int rate_after_pending; /* The rate after move is not measured yet */
 	int blacklisted; /* IRQ can be blacklisted when can't change affinity */
+	int blacklist_errno; /* Error of affinity write */
+	unsigned long long blacklist_time; /* Time of blacklisting, ms */
+	unsigned int blacklist_count; /* Number of failures in a row */
+	int pinned; /* IRQ is pinned to its CPU by user. Don't move it */
+	irq_move_e move; /* Verification state of the last move */
+	unsigned int move_cpu; /* Target CPU of the last move */
+	unsigned int move_retries; /* Number of affinity rewrites */
+	unsigned long long move_time; /* Time of affinity write, ms */
+	unsigned long long move_base; /* Interrupts on target CPU at first check */
+	unsigned long long move_cur; /* Current interrupts on target CPU */
+	int move_base_valid;
+	int move_cur_valid; /* The move_cur is got from /proc/interrupts */
+	char *rps; /* Path to rps_cpus file if RPS is enabled by birq */
+	cpumask_t rps_cpus; /* CPUs to process IRQ's softirqs on */
 };
 typedef struct irq_s irq_t;
 
@@ -23,6 +61,20 @@ typedef struct irq_s irq_t;
 #define PROC_INTERRUPTS "/proc/interrupts"
 #define PROC_IRQ "/proc/irq"
 
+/* Move verification. The pending move is rewritten after
+   IRQ_VERIFY_DELAY << retries ms. The IRQ is considered stuck after
+   IRQ_MOVE_RETRIES retries. The stuck IRQ is not moved during
+   IRQ_STUCK_TIMEOUT ms. */
+#define IRQ_VERIFY_DELAY 1000
+#define IRQ_MOVE_RETRIES 3
+#define IRQ_STUCK_TIMEOUT 600000
+
+/* The IRQ blacklisted due to temporary error is retried after
+   IRQ_BLACKLIST_DELAY << (failures - 1) ms. The shift is limited
+   by IRQ_BLACKLIST_MAX_SHIFT. */
+#define IRQ_BLACKLIST_DELAY 5000
+#define IRQ_BLACKLIST_MAX_SHIFT 8
+
 /* Compare function for global IRQ list */
 int irq_list_compare(const void *first, const void *second);
 
@@ -31,6 +83,16 @@ int scan_irqs(lub_list_t *irqs, lub_list_t *balance_irqs, lub_list_t *pxms);
 int irq_list_free(lub_list_t *irqs);
 int irq_list_show(lub_list_t *irqs);
 irq_t * irq_list_search(lub_list_t *irqs, unsigned int num);
+irq_t * irq_list_add(lub_list_t *irqs, unsigned int num);
+int irq_list_remove_stale(lub_list_t *irqs);
+int irq_need_balance(irq_t *irq);
+int irq_movable(irq_t *irq);
+int irq_error_permanent(int err);
+int irq_get_effective(irq_t *irq, cpumask_t *cpumask);
 int irq_get_affinity(irq_t *irq);
+int irq_get_hint(irq_t *irq);
+void irq_changed(irq_t *irq);
+irq_t * irq_changed_pop(void);
+int irq_list_rescan_local(lub_list_t *irqs, lub_list_t *pxms);
 
 #endif
@@ -52,13 +52,52 @@ static inline void lub_list_node_init(lub_list_node_t *this,
 	this->data = data;
 }
 
+/*--------------------------------------------------------- */
+/* The nodes are allocated by slabs. The freed nodes are kept in the
+ * free list and are reused. The slabs are never returned to the system.
+ * Like the lists themselves the pool is not thread safe.
+ */
+#define LUB_LIST_SLAB_NODES 64
+
+typedef struct lub_list_slab_s lub_list_slab_t;
+struct lub_list_slab_s {
+	lub_list_slab_t *next;
+	lub_list_node_t nodes[LUB_LIST_SLAB_NODES];
+};
+
+static lub_list_slab_t *slabs = NULL;
+static lub_list_node_t *free_nodes = NULL;
+
+/*--------------------------------------------------------- */
+static lub_list_node_t *lub_list_node_alloc(void)
+{
+	lub_list_node_t *node;
+
+	if (!free_nodes) {
+		lub_list_slab_t *slab;
+		int i;
+
+		slab = malloc(sizeof(*slab));
+		assert(slab);
+		slab->next = slabs;
+		slabs = slab;
+		for (i = LUB_LIST_SLAB_NODES - 1; i >= 0; i--) {
+			slab->nodes[i].next = free_nodes;
+			free_nodes = &slab->nodes[i];
+		}
+	}
+	node = free_nodes;
+	free_nodes = node->next;
+
+	return node;
+}
+
 /*--------------------------------------------------------- */
 lub_list_node_t *lub_list_node_new(void *data)
 {
 	lub_list_node_t *this;
 
-	this = malloc(sizeof(*this));
-	assert(this);
+	this = lub_list_node_alloc();
 	lub_list_node_init(this, data);
 
 	return this;
@@ -97,7 +136,8 @@ inline lub_list_node_t *lub_list_iterator_prev(lub_list_node_t *this)
 /*--------------------------------------------------------- */
 inline void lub_list_node_free(lub_list_node_t *this)
 {
-	free(this);
+	this->next = free_nodes;
+	free_nodes = this;
 }
 
 /*--------------------------------------------------------- */
@@ -0,0 +1,199 @@
+/* metrics.c
+ * Export metrics in Prometheus text exposition format. The textfile
+ * is rewritten atomically (write to temporary file then rename) after
+ * each balancing cycle. The values are taken from the existing CPU
+ * and IRQ structures, there are no additional procfs reads.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lub/list.h"
+#include "irq.h"
+#include "cpu.h"
+#include "overhead.h"
+#include "cycle.h"
+#include "metrics.h"
+
+/*--------------------------------------------------------- */
+static void header(FILE *f, const char *name, const char *type,
+	const char *help)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*--------------------------------------------------------- */
+/* Label value with escaped backslash, double-quote and line feed */
+static void label_value(FILE *f, const char *str)
+{
+	if (!str)
+		return;
+	for (; *str; str++) {
+		switch (*str) {
+		case '\\':
+			fputs("\\\\", f);
+			break;
+		case '"':
+			fputs("\\\"", f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		default:
+			fputc(*str, f);
+			break;
+		}
+	}
+}
+
+/*--------------------------------------------------------- */
+static void write_cpus(FILE *f, lub_list_t *cpus)
+{
+	lub_list_node_t *iter;
+
+	header(f, "birq_cpu_irq_load", "gauge",
+		"IRQ and softirq load of CPU, percents.");
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_cpu_irq_load{cpu=\"%u\"} %.2f\n",
+			cpu->id, cpu->load);
+	}
+
+	header(f, "birq_cpu_load", "gauge",
+		"Total non-idle load of CPU, percents.");
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_cpu_load{cpu=\"%u\"} %.2f\n",
+			cpu->id, cpu->total_load);
+	}
+
+	header(f, "birq_cpu_irqs", "gauge",
+		"Number of IRQs bound to CPU.");
+	for (iter = lub_list_iterator_init(cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_cpu_irqs{cpu=\"%u\"} %u\n",
+			cpu->id, ilist_len(&cpu->irqs));
+	}
+}
+
+/*--------------------------------------------------------- */
+static void write_irqs(FILE *f, lub_list_t *irqs)
+{
+	lub_list_node_t *iter;
+	unsigned int blacklisted = 0;
+
+	header(f, "birq_irq_rate", "gauge",
+		"Interrupts per second.");
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_irq_rate{irq=\"%u\",desc=\"", irq->irq);
+		label_value(f, irq->desc);
+		fprintf(f, "\"} %llu\n", irq->rate);
+	}
+
+	header(f, "birq_irq_cpu", "gauge",
+		"Current CPU of IRQ. -1 if IRQ is not bound to single CPU.");
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_irq_cpu{irq=\"%u\"} %d\n", irq->irq,
+			irq->cpu ? (int)irq->cpu->id : -1);
+	}
+
+	header(f, "birq_irq_moves_total", "counter",
+		"Number of IRQ moves.");
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_irq_moves_total{irq=\"%u\"} %u\n",
+			irq->irq, irq->moves);
+	}
+
+	header(f, "birq_irq_blacklisted", "gauge",
+		"IRQ is blacklisted because its affinity can't be changed.");
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		fprintf(f, "birq_irq_blacklisted{irq=\"%u\"} %d\n",
+			irq->irq, irq->blacklisted ? 1 : 0);
+		if (irq->blacklisted)
+			blacklisted++;
+	}
+
+	header(f, "birq_blacklisted_irqs", "gauge",
+		"Number of blacklisted IRQs.");
+	fprintf(f, "birq_blacklisted_irqs %u\n", blacklisted);
+}
+
+/*--------------------------------------------------------- */
+/* The overhead histogram buckets are power of 2 microseconds */
+static void write_durations(FILE *f, overhead_t *overhead)
+{
+	int phase;
+
+	header(f, "birq_phase_duration_seconds", "histogram",
+		"Duration of balancing cycle and its phases.");
+	for (phase = 0; phase < OVERHEAD_NUM; phase++) {
+		overhead_hist_t *hist = &overhead->phases[phase];
+		const char *name = overhead_phase_name(phase);
+		unsigned long long count = 0;
+		int i;
+
+		for (i = 0; i < OVERHEAD_BUCKETS - 1; i++) {
+			count += hist->buckets[i];
+			fprintf(f, "birq_phase_duration_seconds_bucket"
+				"{phase=\"%s\",le=\"%g\"} %llu\n",
+				name, (double)(1ULL << i) / 1000000, count);
+		}
+		fprintf(f, "birq_phase_duration_seconds_bucket"
+			"{phase=\"%s\",le=\"+Inf\"} %llu\n", name, hist->count);
+		fprintf(f, "birq_phase_duration_seconds_sum{phase=\"%s\"} %g\n",
+			name, (double)hist->sum / 1000000000);
+		fprintf(f, "birq_phase_duration_seconds_count{phase=\"%s\"} %llu\n",
+			name, hist->count);
+	}
+}
+
+/*--------------------------------------------------------- */
+/* Write metrics to temporary file and rename it */
+int metrics_write(cycle_t *cycle, const char *fname)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	tmp[sizeof(tmp) - 1] = '\0';
+	if (!(f = fopen(tmp, "w")))
+		return -1;
+
+	header(f, "birq_cycles_total", "counter",
+		"Number of balancing cycles.");
+	fprintf(f, "birq_cycles_total %llu\n", cycle->cycles);
+	header(f, "birq_cycle_moves", "gauge",
+		"Number of IRQ moves within the last cycle.");
+	fprintf(f, "birq_cycle_moves %u\n", cycle->moves);
+	header(f, "birq_moves_total", "counter",
+		"Number of IRQ moves.");
+	fprintf(f, "birq_moves_total %llu\n", cycle->moves_total);
+	write_cpus(f, cycle->cpus);
+	write_irqs(f, cycle->irqs);
+	if (cycle->overhead)
+		write_durations(f, cycle->overhead);
+
+	if (fclose(f) != 0) {
+		remove(tmp);
+		return -1;
+	}
+	if (rename(tmp, fname) < 0) {
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef _metrics_h
+#define _metrics_h
+
+#include "cycle.h"
+
+int metrics_write(cycle_t *cycle, const char *fname);
+
+#endif
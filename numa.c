@@ -10,10 +10,13 @@
 #include <limits.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "lub/list.h"
 #include "cpumask.h"
 #include "numa.h"
+#include "path.h"
+#include "cpu.h"
 
 int numa_list_compare(const void *first, const void *second)
 {
@@ -78,6 +81,30 @@ int numa_list_free(lub_list_t *numas)
 	return 0;
 }
 
+/* Find NUMA node of CPU by /sys/devices/system/cpu/cpuN/nodeM link.
+   Returns NULL if node is unknown. */
+numa_t * numa_cpu_node(lub_list_t *numas, unsigned int cpu)
+{
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *dent;
+	numa_t *numa = NULL;
+
+	path_build(path, sizeof(path), "%s/cpu%u", SYSFS_CPU_PATH, cpu);
+	if (!(dir = opendir(path)))
+		return NULL;
+	while ((dent = readdir(dir))) {
+		unsigned int id;
+		if (sscanf(dent->d_name, "node%u", &id) != 1)
+			continue;
+		numa = numa_list_search(numas, id);
+		break;
+	}
+	closedir(dir);
+
+	return numa;
+}
+
 /* Show NUMA information */
 static void show_numa_info(numa_t *numa)
 {
@@ -100,43 +127,56 @@ int show_numas(lub_list_t *numas)
 	return 0;
 }
 
-/* Search for NUMA nodes */
+/* Search for NUMA nodes. The online nodes are taken from node/online
+   file. The old kernels have no this file so the nodeN directories are
+   searched. The files are opened relative to node directory. */
 int scan_numas(lub_list_t *numas)
 {
-	FILE *fd;
-	char path[PATH_MAX];
+	char buf[CPU_FILE_MAX];
+	char name[64];
 	unsigned int id;
 	numa_t *numa;
-	char *str = NULL;
-	size_t sz;
+	cpumask_t online; /* Node IDs */
 	cpumask_t cpumap;
-	cpus_init(cpumap);
+	ssize_t len;
+	int dirfd;
 
-	for (id = 0; id < NR_NUMA_NODES; id++) {
-		snprintf(path, sizeof(path),
-			"%s/node%d", SYSFS_NUMA_PATH, id);
-		path[sizeof(path) - 1] = '\0';
-		if (access(path, F_OK))
-			break;
+	if ((dirfd = path_open_dir("%s", SYSFS_NUMA_PATH)) < 0)
+		return 0;
+	cpus_init(online);
+	cpus_init(cpumap);
+	if (((len = path_read_at(dirfd, "online", buf, sizeof(buf))) < 0) ||
+		(cpulist_parse(buf, len, online) < 0)) {
+		cpus_clear(online);
+		for (id = 0; id < NR_NUMA_NODES; id++) {
+			snprintf(name, sizeof(name), "node%u", id);
+			if (faccessat(dirfd, name, F_OK, 0))
+				break;
+			cpu_set(id, online);
+		}
+	}
 
+	for (id = first_cpu(online); id < NR_CPUS; id = next_cpu(id, online)) {
 		if (!(numa = numa_list_search(numas, id))) {
 			numa = numa_new(id);
 			numa_list_add(numas, numa);
 		}
 
 		/* Get NUMA node cpumap */
-		snprintf(path, sizeof(path),
-			"%s/node%d/cpumap", SYSFS_NUMA_PATH, id);
-		path[sizeof(path) - 1] = '\0';
-		if ((fd = fopen(path, "r"))) {
-			if (getline(&str, &sz, fd) >= 0)
-				cpumask_parse_user(str, strlen(str), cpumap);
-			fclose(fd);
-			cpus_and(numa->cpumap, numa->cpumap, cpumap);
+		snprintf(name, sizeof(name), "node%u/cpulist", id);
+		if ((len = path_read_at(dirfd, name, buf, sizeof(buf))) >= 0) {
+			if (!cpulist_parse(buf, len, cpumap))
+				cpus_and(numa->cpumap, numa->cpumap, cpumap);
+			continue;
 		}
+		snprintf(name, sizeof(name), "node%u/cpumap", id);
+		if (((len = path_read_at(dirfd, name, buf, sizeof(buf))) >= 0) &&
+			!cpumask_parse_user(buf, len, cpumap))
+			cpus_and(numa->cpumap, numa->cpumap, cpumap);
 	}
-	free(str);
 
+	close(dirfd);
 	cpus_free(cpumap);
+	cpus_free(online);
 	return 0;
 }
@@ -19,5 +19,6 @@ int numa_list_free(lub_list_t *numas);
 int scan_numas(lub_list_t *numas);
 int show_numas(lub_list_t *numas);
 numa_t * numa_list_search(lub_list_t *numas, unsigned int id);
+numa_t * numa_cpu_node(lub_list_t *numas, unsigned int cpu);
 
 #endif
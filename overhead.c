@@ -0,0 +1,207 @@
+/* overhead.c
+ * Self-overhead instrumentation. The time and number of read/write
+ * syscalls are measured for each phase of balancing cycle. The process
+ * CPU time is measured for the whole cycle.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "overhead.h"
+
+/*--------------------------------------------------------- */
+static const char *phase_names[OVERHEAD_NUM] = {
+	"scan_irqs",
+	"verify_moves",
+	"cpu_hotplug",
+	"link_irqs_to_cpus",
+	"gather_statistics",
+	"choose_irqs_to_move",
+	"balance",
+	"apply_affinity",
+	"cycle"
+};
+
+const char *overhead_phase_name(overhead_phase_e phase)
+{
+	if (phase >= OVERHEAD_NUM)
+		return "unknown";
+
+	return phase_names[phase];
+}
+
+/*--------------------------------------------------------- */
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*--------------------------------------------------------- */
+/* Number of read and write syscalls from /proc/self/io. It's
+   available if kernel has task I/O accounting. The other syscalls
+   (open, close, stat) are not counted by kernel. */
+static unsigned long long rw_syscalls(overhead_t *overhead)
+{
+	char buf[512];
+	ssize_t len;
+	char *p;
+	unsigned long long num = 0;
+
+	if (overhead->io_fd < 0)
+		return 0;
+	overhead->samples++;
+	if ((len = pread(overhead->io_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return 0;
+	buf[len] = '\0';
+	if ((p = strstr(buf, "syscr:")))
+		num += strtoull(p + 6, NULL, 10);
+	if ((p = strstr(buf, "syscw:")))
+		num += strtoull(p + 6, NULL, 10);
+
+	return num;
+}
+
+/*--------------------------------------------------------- */
+/* Process CPU time (user and system), ns */
+static unsigned long long cpu_time(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return ((unsigned long long)ru.ru_utime.tv_sec +
+		ru.ru_stime.tv_sec) * 1000000000ULL +
+		((unsigned long long)ru.ru_utime.tv_usec +
+		ru.ru_stime.tv_usec) * 1000;
+}
+
+/*--------------------------------------------------------- */
+static void hist_add(overhead_hist_t *hist, unsigned long long ns)
+{
+	unsigned long long us = ns / 1000;
+	unsigned int bucket = 0;
+
+	while (us && (bucket < OVERHEAD_BUCKETS - 1)) {
+		us >>= 1;
+		bucket++;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum += ns;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+/*--------------------------------------------------------- */
+overhead_t *overhead_new(void)
+{
+	overhead_t *overhead;
+
+	overhead = malloc(sizeof(*overhead));
+	assert(overhead);
+	memset(overhead, 0, sizeof(*overhead));
+	overhead->io_fd = open("/proc/self/io", O_RDONLY);
+	overhead->start_time = now_ns();
+	overhead->cpu_time = cpu_time();
+
+	return overhead;
+}
+
+/*--------------------------------------------------------- */
+void overhead_free(overhead_t *overhead)
+{
+	if (!overhead)
+		return;
+	if (overhead->io_fd >= 0)
+		close(overhead->io_fd);
+	free(overhead);
+}
+
+/*--------------------------------------------------------- */
+void overhead_start(overhead_t *overhead, overhead_phase_e phase)
+{
+	overhead_hist_t *hist;
+
+	if (!overhead || (phase >= OVERHEAD_NUM))
+		return;
+	hist = &overhead->phases[phase];
+	hist->start_rw_syscalls = rw_syscalls(overhead);
+	hist->start_samples = overhead->samples;
+	hist->start_time = now_ns();
+}
+
+/*--------------------------------------------------------- */
+void overhead_stop(overhead_t *overhead, overhead_phase_e phase)
+{
+	overhead_hist_t *hist;
+	unsigned long long end_time = now_ns();
+	unsigned long long end_rw_syscalls;
+	unsigned long long own;
+
+	if (!overhead || (phase >= OVERHEAD_NUM))
+		return;
+	hist = &overhead->phases[phase];
+	hist_add(hist, end_time - hist->start_time);
+	/* Don't count the reads of /proc/self/io made by overhead_start()
+	   and by nested measurements */
+	own = overhead->samples - hist->start_samples + 1;
+	end_rw_syscalls = rw_syscalls(overhead);
+	if (end_rw_syscalls > hist->start_rw_syscalls + own)
+		hist->rw_syscalls += end_rw_syscalls -
+			hist->start_rw_syscalls - own;
+
+	/* The process CPU time is measured per cycle */
+	if (phase == OVERHEAD_CYCLE) {
+		unsigned long long cur = cpu_time();
+		hist_add(&overhead->cpu, cur - overhead->cpu_time);
+		overhead->cpu_time = cur;
+	}
+}
+
+/*--------------------------------------------------------- */
+static void hist_dump(overhead_hist_t *hist, const char *name, FILE *out)
+{
+	unsigned long long count = hist->count ? hist->count : 1;
+	unsigned int i;
+
+	fprintf(out, "phase=%s count=%llu avg_us=%.1f max_us=%.1f "
+		"rw_syscalls_op=%.1f hist=",
+		name, hist->count, (double)hist->sum / count / 1000,
+		(double)hist->max / 1000, (double)hist->rw_syscalls / count);
+	for (i = 0; i < OVERHEAD_BUCKETS; i++)
+		fprintf(out, "%s%llu", i ? "," : "", hist->buckets[i]);
+	fprintf(out, "\n");
+}
+
+/*--------------------------------------------------------- */
+/* Print statistics. The histogram buckets are power of 2 microseconds
+   (see OVERHEAD_BUCKETS). */
+void overhead_dump(overhead_t *overhead, FILE *out)
+{
+	unsigned long long uptime;
+	unsigned long long total_cpu;
+	int i;
+
+	if (!overhead)
+		return;
+	uptime = now_ns() - overhead->start_time;
+	total_cpu = cpu_time();
+	fprintf(out, "overhead uptime_s=%.1f cpu_s=%.3f cpu_share=%.4f%%\n",
+		(double)uptime / 1000000000, (double)total_cpu / 1000000000,
+		uptime ? (double)total_cpu * 100 / uptime : 0);
+	for (i = 0; i < OVERHEAD_NUM; i++)
+		hist_dump(&overhead->phases[i], phase_names[i], out);
+	hist_dump(&overhead->cpu, "cpu_time", out);
+	fflush(out);
+}
@@ -0,0 +1,57 @@
+#ifndef _overhead_h
+#define _overhead_h
+
+#include <stdio.h>
+
+/* Phases of balancing cycle */
+typedef enum {
+	OVERHEAD_SCAN_IRQS,
+	OVERHEAD_VERIFY_MOVES,
+	OVERHEAD_HOTPLUG,
+	OVERHEAD_LINK_IRQS,
+	OVERHEAD_GATHER,
+	OVERHEAD_CHOOSE,
+	OVERHEAD_BALANCE,
+	OVERHEAD_APPLY,
+	OVERHEAD_CYCLE, /* The whole cycle */
+	OVERHEAD_NUM
+} overhead_phase_e;
+
+/* Bucket 0 is for time less than 1us. Bucket N is for
+   [2^(N-1), 2^N) us. The last bucket is for all the greater values. */
+#define OVERHEAD_BUCKETS 24
+
+struct overhead_hist_s {
+	unsigned long long count;
+	unsigned long long sum; /* Total time, ns */
+	unsigned long long max; /* Maximal time, ns */
+	unsigned long long rw_syscalls; /* Total number of read/write syscalls */
+	unsigned long long buckets[OVERHEAD_BUCKETS];
+	/* Start values of current measurement */
+	unsigned long long start_time;
+	unsigned long long start_rw_syscalls;
+	unsigned long long start_samples;
+};
+typedef struct overhead_hist_s overhead_hist_t;
+
+struct overhead_s {
+	overhead_hist_t phases[OVERHEAD_NUM];
+	overhead_hist_t cpu; /* Process CPU time per cycle */
+	unsigned long long cpu_time; /* Process CPU time from getrusage, ns */
+	unsigned long long start_time; /* Time of measurements start, ns */
+	int io_fd; /* /proc/self/io */
+	unsigned long long samples; /* Number of /proc/self/io reads */
+};
+typedef struct overhead_s overhead_t;
+
+overhead_t *overhead_new(void);
+void overhead_free(overhead_t *overhead);
+void overhead_start(overhead_t *overhead, overhead_phase_e phase);
+void overhead_stop(overhead_t *overhead, overhead_phase_e phase);
+void overhead_dump(overhead_t *overhead, FILE *out);
+const char *overhead_phase_name(overhead_phase_e phase);
+/* Number of allocations. Defined by alloc_count.c that is linked
+   into birq-bench only. */
+unsigned long long overhead_allocs(void);
+
+#endif
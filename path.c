@@ -0,0 +1,89 @@
+/* path.c
+ * Build paths to procfs and sysfs files. Read small sysfs files.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "path.h"
+
+static char *root = NULL;
+
+int path_set_root(const char *new_root)
+{
+	free(root);
+	root = NULL;
+	if (!new_root)
+		return 0;
+	root = strdup(new_root);
+	/* Remove trailing slashes. All paths are absolute. */
+	while ((strlen(root) > 0) && (root[strlen(root) - 1] == '/'))
+		root[strlen(root) - 1] = '\0';
+
+	return 0;
+}
+
+const char *path_root(void)
+{
+	return root ? root : "";
+}
+
+/* Like snprintf() but prepends root to resulting path.
+   The result is always null-terminated. */
+int path_build(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+	int ret;
+
+	len = snprintf(buf, size, "%s", path_root());
+	if (len >= (int)size)
+		len = size - 1;
+	va_start(ap, fmt);
+	ret = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	buf[size - 1] = '\0';
+
+	return len + ret;
+}
+
+/* Open directory. The directory fd allows to open files by relative
+   names (see openat()). Returns fd or -1. */
+int path_open_dir(const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list ap;
+	int len;
+
+	len = snprintf(path, sizeof(path), "%s", path_root());
+	if (len >= (int)sizeof(path))
+		len = sizeof(path) - 1;
+	va_start(ap, fmt);
+	vsnprintf(path + len, sizeof(path) - len, fmt, ap);
+	va_end(ap);
+
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Read small file relative to directory fd. The result is
+   null-terminated. Returns length or -1. */
+ssize_t path_read_at(int dirfd, const char *name, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	if ((fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+
+	return len;
+}
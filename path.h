@@ -0,0 +1,18 @@
+#ifndef _path_h
+#define _path_h
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Root directory for all procfs and sysfs files. The empty root
+   (default) means the live host. The non-empty root allows to use
+   fake procfs/sysfs tree (simulation). */
+int path_set_root(const char *root);
+const char *path_root(void);
+int path_build(char *buf, size_t size, const char *fmt, ...)
+	__attribute__ ((format (printf, 3, 4)));
+int path_open_dir(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2)));
+ssize_t path_read_at(int dirfd, const char *name, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,165 @@
+/* plan.c
+ * Plan of IRQ moves. The dry-run mode writes the moves computed by
+ * balancing cycle to the plan file instead of smp_affinity. The plan
+ * can be reviewed, edited and then applied in one batch.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lub/list.h"
+#include "irq.h"
+#include "cpu.h"
+#include "balance.h"
+#include "statistics.h"
+#include "cycle.h"
+#include "plan.h"
+
+/*--------------------------------------------------------- */
+/* Write moves of IRQs need to be balanced. The file is rewritten
+   atomically. The current affinity is in comment for reference. */
+int plan_write(cycle_t *cycle, const char *fname)
+{
+	char tmp[PATH_MAX];
+	lub_list_node_t *iter;
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	tmp[sizeof(tmp) - 1] = '\0';
+	if (!(f = fopen(tmp, "w")))
+		return -1;
+
+	fprintf(f, "# birq plan, cycle %llu\n", cycle->cycles);
+	fprintf(f, "# <irq> <cpu> # <desc> [<current affinity>]\n");
+	for (iter = lub_list_iterator_init(cycle->balance_irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		char buf[NR_CPUS + 1];
+		if (!irq->cpu)
+			continue;
+		cpumask_scnprintf(buf, sizeof(buf), irq->affinity);
+		buf[sizeof(buf) - 1] = '\0';
+		fprintf(f, "%u %u # %s [%s]\n", irq->irq, irq->cpu->id,
+			irq->desc ? irq->desc : "", buf);
+	}
+
+	if (fclose(f) != 0) {
+		remove(tmp);
+		return -1;
+	}
+	if (rename(tmp, fname) < 0) {
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Check the move against current system state. Returns error
+   message or NULL if move is valid. */
+static const char *plan_check(cycle_t *cycle, unsigned int num,
+	unsigned int cpu_id, irq_t **irq, cpu_t **cpu)
+{
+	if (!(*irq = irq_list_search(cycle->irqs, num)))
+		return "unknown IRQ";
+	if (!(*cpu = cpu_list_search(cycle->cpus, cpu_id)))
+		return "unknown CPU";
+	if ((*irq)->blacklisted)
+		return "IRQ is blacklisted";
+	if (!cpu_isset(cpu_id, (*irq)->local_cpus))
+		return "CPU is not local for IRQ";
+
+	return NULL;
+}
+
+/*--------------------------------------------------------- */
+static void batch_free(lub_list_t *batch)
+{
+	lub_list_node_t *node;
+
+	while ((node = lub_list__get_tail(batch))) {
+		lub_list_del(batch, node);
+		lub_list_node_free(node);
+	}
+	lub_list_free(batch);
+}
+
+/*--------------------------------------------------------- */
+/* Validate the whole plan against current IRQs, CPUs and local CPUs
+   then apply it in one batch. Nothing is applied if plan has errors.
+   Returns number of IRQs can't be moved or -1 on error. */
+int plan_apply(cycle_t *cycle, const char *fname)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t size = 0;
+	unsigned int line_num = 0;
+	int errors = 0;
+	int failed = 0;
+	lub_list_t *batch;
+	lub_list_node_t *iter;
+
+	if (!(f = fopen(fname, "r")))
+		return -1;
+
+	/* Current state */
+	scan_irqs(cycle->irqs, cycle->balance_irqs, cycle->pxms);
+	link_irqs_to_cpus(cycle->cpu_index);
+
+	batch = lub_list_new(irq_list_compare);
+	while (getline(&line, &size, f) >= 0) {
+		unsigned int num;
+		unsigned int cpu_id;
+		irq_t *irq;
+		cpu_t *cpu;
+		const char *err;
+		char *p;
+
+		line_num++;
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+		if (strspn(line, " \t\r\n") == strlen(line))
+			continue;
+		if (sscanf(line, "%u %u", &num, &cpu_id) != 2) {
+			fprintf(stderr, "Error: %s:%u: Illegal line.\n",
+				fname, line_num);
+			errors++;
+			continue;
+		}
+		if ((err = plan_check(cycle, num, cpu_id, &irq, &cpu))) {
+			fprintf(stderr, "Error: %s:%u: IRQ %u to CPU%u: %s.\n",
+				fname, line_num, num, cpu_id, err);
+			errors++;
+			continue;
+		}
+		/* The later line for the same IRQ wins */
+		move_irq_to_cpu(irq, cpu);
+		if (!lub_list_search(batch, irq))
+			lub_list_add(batch, irq);
+	}
+	free(line);
+	fclose(f);
+
+	if (errors) {
+		batch_free(batch);
+		return -1;
+	}
+
+	apply_affinity(batch);
+	for (iter = lub_list_iterator_init(batch); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		if (irq->blacklisted) {
+			fprintf(stderr, "Error: Can't move IRQ %u.\n", irq->irq);
+			failed++;
+		}
+	}
+	printf("Plan applied: %u IRQs, %d failed.\n",
+		lub_list_len(batch), failed);
+	batch_free(batch);
+
+	return failed;
+}
@@ -0,0 +1,12 @@
+#ifndef _plan_h
+#define _plan_h
+
+#include "cycle.h"
+
+/* Plan file contains the IRQ moves. One move per line:
+   <irq> <cpu> [# comment] */
+
+int plan_write(cycle_t *cycle, const char *fname);
+int plan_apply(cycle_t *cycle, const char *fname);
+
+#endif
@@ -0,0 +1,168 @@
+/* rps.c
+ * Receive Packet Steering for single-IRQ hotspots.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <limits.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lub/list.h"
+#include "cpumask.h"
+#include "irq.h"
+#include "rps.h"
+#include "path.h"
+
+/* Get number from the end of IRQ description like "eth0-rx-3" or
+   "virtio0-input.0". Returns -1 if there is no trailing number. */
+static int desc_queue_num(const char *desc)
+{
+	const char *p;
+
+	if (!desc)
+		return -1;
+	p = desc + strlen(desc);
+	while ((p > desc) && isdigit(*(p - 1)))
+		p--;
+	if (!*p)
+		return -1;
+	return strtol(p, NULL, 10);
+}
+
+/* Find rps_cpus file for the network receive queue served by IRQ.
+   The single-queue devices are simple. For the multi-queue devices
+   try to get queue number from the IRQ description. */
+static char *rps_search_path(irq_t *irq)
+{
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *dent;
+	char *res = NULL;
+
+	if (!irq->pci_addr)
+		return NULL;
+
+	path_build(path, sizeof(path), "%s/%s/net",
+		SYSFS_PCI_PATH, irq->pci_addr);
+	path[sizeof(path) - 1] = '\0';
+	if (!(dir = opendir(path)))
+		return NULL; /* Not a network device */
+	while (!res && (dent = readdir(dir))) {
+		DIR *qdir;
+		struct dirent *qent;
+		char qpath[PATH_MAX];
+		int rx_num = 0;
+		int queue;
+
+		if (dent->d_name[0] == '.')
+			continue;
+		path_build(qpath, sizeof(qpath), "%s/%s/net/%s/queues",
+			SYSFS_PCI_PATH, irq->pci_addr, dent->d_name);
+		qpath[sizeof(qpath) - 1] = '\0';
+		if (!(qdir = opendir(qpath)))
+			continue;
+		while ((qent = readdir(qdir))) {
+			if (!strncmp(qent->d_name, "rx-", 3))
+				rx_num++;
+		}
+		closedir(qdir);
+		if (rx_num == 0)
+			continue;
+
+		if (rx_num == 1)
+			queue = 0;
+		else
+			queue = desc_queue_num(irq->desc);
+		if ((queue < 0) || (queue >= rx_num))
+			continue;
+		path_build(qpath, sizeof(qpath),
+			"%s/%s/net/%s/queues/rx-%d/rps_cpus",
+			SYSFS_PCI_PATH, irq->pci_addr, dent->d_name, queue);
+		qpath[sizeof(qpath) - 1] = '\0';
+		if (access(qpath, W_OK))
+			continue;
+		res = strdup(qpath);
+	}
+	closedir(dir);
+
+	return res;
+}
+
+static int rps_write(const char *path, cpumask_t *cpumask)
+{
+	char buf[NR_CPUS + 1];
+	int f;
+	int ret = 0;
+
+	if ((f = open(path, O_WRONLY)) < 0)
+		return -1;
+	cpumask_scnprintf(buf, sizeof(buf), *cpumask);
+	buf[sizeof(buf) - 1] = '\0';
+	if (write(f, buf, strlen(buf)) < 0)
+		ret = -1;
+	close(f);
+
+	return ret;
+}
+
+/* Spread softirq processing of the IRQ's receive queue
+   over specified CPUs. */
+int rps_enable(irq_t *irq, cpumask_t *cpumask)
+{
+	char *path;
+
+	if (!irq)
+		return -1;
+	if (irq->rps)
+		path = irq->rps;
+	else if (!(path = rps_search_path(irq)))
+		return -1;
+	if (rps_write(path, cpumask) < 0) {
+		if (path != irq->rps)
+			free(path);
+		return -1;
+	}
+	irq->rps = path;
+	cpus_copy(irq->rps_cpus, *cpumask);
+
+	return 0;
+}
+
+/* Return softirq processing to the IRQ's CPU */
+int rps_disable(irq_t *irq)
+{
+	cpumask_t cpumask;
+	int ret;
+
+	if (!irq || !irq->rps)
+		return -1;
+	cpus_init(cpumask);
+	cpus_clear(cpumask);
+	ret = rps_write(irq->rps, &cpumask);
+	cpus_free(cpumask);
+	free(irq->rps);
+	irq->rps = NULL;
+	cpus_clear(irq->rps_cpus);
+
+	return ret;
+}
+
+/* Disable all RPS settings made by birq */
+int rps_disable_all(lub_list_t *irqs)
+{
+	lub_list_node_t *iter;
+
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		if (irq->rps)
+			rps_disable(irq);
+	}
+
+	return 0;
+}
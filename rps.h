@@ -0,0 +1,12 @@
+#ifndef _rps_h
+#define _rps_h
+
+#include "lub/list.h"
+#include "cpumask.h"
+#include "irq.h"
+
+int rps_enable(irq_t *irq, cpumask_t *cpumask);
+int rps_disable(irq_t *irq);
+int rps_disable_all(lub_list_t *irqs);
+
+#endif
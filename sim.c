@@ -0,0 +1,822 @@
+/* sim.c
+ * Simulated system. The fake procfs/sysfs tree is generated from
+ * the scenario file and the real balancing cycle is run against it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <ftw.h>
+
+#include "birq.h"
+#include "lub/list.h"
+#include "cpumask.h"
+#include "irq.h"
+#include "cpu.h"
+#include "numa.h"
+#include "statistics.h"
+#include "balance.h"
+#include "path.h"
+#include "cycle.h"
+#include "sim.h"
+
+/* Clock ticks per second for /proc/stat */
+#define SIM_USER_HZ 100
+
+/*--------------------------------------------------------- */
+sim_t *sim_new(void)
+{
+	sim_t *sim;
+
+	sim = malloc(sizeof(*sim));
+	assert(sim);
+	memset(sim, 0, sizeof(*sim));
+	sim->cycles = SIM_DEFAULT_CYCLES;
+	sim->short_interval = BIRQ_SHORT_INTERVAL;
+	sim->long_interval = BIRQ_LONG_INTERVAL;
+	sim->seed = 1;
+	cpus_init(sim->online);
+	cpus_clear(sim->online);
+
+	return sim;
+}
+
+/*--------------------------------------------------------- */
+void sim_free(sim_t *sim)
+{
+	unsigned int i;
+
+	if (!sim)
+		return;
+	for (i = 0; i < sim->irq_num; i++) {
+		free(sim->irqs[i].pci_addr);
+		free(sim->irqs[i].desc);
+		free(sim->irqs[i].cpu_intr);
+	}
+	free(sim->irqs);
+	for (i = 0; i < sim->node_num; i++)
+		cpus_free(sim->nodes[i].cpumask);
+	free(sim->events);
+	cpus_free(sim->online);
+	free(sim->root);
+	free(sim);
+}
+
+/*--------------------------------------------------------- */
+/* Add IRQ with default parameters. The pci_addr can be NULL. */
+sim_irq_t *sim_add_irq(sim_t *sim, unsigned int num,
+	const char *pci_addr, const char *desc)
+{
+	sim_irq_t *irq;
+
+	irq = realloc(sim->irqs, (sim->irq_num + 1) * sizeof(*irq));
+	assert(irq);
+	sim->irqs = irq;
+	irq = &sim->irqs[sim->irq_num];
+	memset(irq, 0, sizeof(*irq));
+	irq->num = num;
+	if (pci_addr)
+		irq->pci_addr = strdup(pci_addr);
+	irq->desc = strdup(desc);
+	irq->node = -1;
+	irq->cpu = -1;
+	irq->hint = -1;
+	irq->cost = SIM_DEFAULT_COST;
+	irq->profile = SIM_PROFILE_CONST;
+	sim->irq_num++;
+
+	return irq;
+}
+
+/*--------------------------------------------------------- */
+/* Parse IRQ line:
+   irq <num> <pci_addr|-> <desc> [node <id>] [cpu <id>] [hint <id>]
+       [cost <ns>]
+       [rate <r>] [periodic <low> <high> <period> <burst>]
+       [step <r1> <r2> <cycle>] */
+static int parse_irq(sim_t *sim, char **saveptr)
+{
+	sim_irq_t *irq;
+	char *tok;
+
+	unsigned int num;
+	char *pci_addr;
+
+	if (!(tok = strtok_r(NULL, " \t", saveptr)))
+		return -1;
+	num = strtoul(tok, NULL, 10);
+	if (!num || (num >= SIM_MAX_IRQ_NUM))
+		return -1;
+	if (!(pci_addr = strtok_r(NULL, " \t", saveptr)))
+		return -1;
+	if (!strcmp(pci_addr, "-"))
+		pci_addr = NULL;
+	if (!(tok = strtok_r(NULL, " \t", saveptr)))
+		return -1;
+	irq = sim_add_irq(sim, num, pci_addr, tok);
+
+	while ((tok = strtok_r(NULL, " \t", saveptr))) {
+		char *arg[4];
+		unsigned int args = 0;
+		unsigned int i;
+
+		if (!strcmp(tok, "node") || !strcmp(tok, "cpu") ||
+			!strcmp(tok, "hint") || !strcmp(tok, "cost") ||
+			!strcmp(tok, "rate"))
+			args = 1;
+		else if (!strcmp(tok, "step"))
+			args = 3;
+		else if (!strcmp(tok, "periodic"))
+			args = 4;
+		else
+			return -1;
+		for (i = 0; i < args; i++) {
+			if (!(arg[i] = strtok_r(NULL, " \t", saveptr)))
+				return -1;
+		}
+
+		if (!strcmp(tok, "node")) {
+			irq->node = strtol(arg[0], NULL, 10);
+		} else if (!strcmp(tok, "cpu")) {
+			irq->cpu = strtol(arg[0], NULL, 10);
+		} else if (!strcmp(tok, "hint")) {
+			irq->hint = strtol(arg[0], NULL, 10);
+		} else if (!strcmp(tok, "cost")) {
+			irq->cost = strtod(arg[0], NULL);
+		} else if (!strcmp(tok, "rate")) {
+			irq->profile = SIM_PROFILE_CONST;
+			irq->rate = strtod(arg[0], NULL);
+		} else if (!strcmp(tok, "step")) {
+			irq->profile = SIM_PROFILE_STEP;
+			irq->rate = strtod(arg[0], NULL);
+			irq->rate2 = strtod(arg[1], NULL);
+			irq->period = strtoul(arg[2], NULL, 10);
+		} else if (!strcmp(tok, "periodic")) {
+			irq->profile = SIM_PROFILE_PERIODIC;
+			irq->rate = strtod(arg[0], NULL);
+			irq->rate2 = strtod(arg[1], NULL);
+			irq->period = strtoul(arg[2], NULL, 10);
+			irq->burst = strtoul(arg[3], NULL, 10);
+			if (!irq->period)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Parse scenario file. The format is:
+   cpus <num>
+   node <id> <cpulist>
+   cycles <num>
+   irq ... (see parse_irq())
+   offline <cpu> <cycle>
+   online <cpu> <cycle>
+   The '#' starts comment. */
+int sim_parse_scenario(sim_t *sim, const char *fname)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t size = 0;
+	unsigned int ln = 0; /* Line number */
+	int ret = 0;
+
+	if (!(file = fopen(fname, "r"))) {
+		fprintf(stderr, "Error: Can't open scenario %s\n", fname);
+		return -1;
+	}
+
+	while (!feof(file)) {
+		char *str;
+		char *cmd;
+		char *saveptr = NULL;
+
+		ln++; /* Next line */
+		if (getline(&line, &size, file) <= 0)
+			continue;
+		/* Find comments */
+		if ((str = strchr(line, '#')))
+			*str = '\0';
+		/* Find \n */
+		if ((str = strchr(line, '\n')))
+			*str = '\0';
+		if (!(cmd = strtok_r(line, " \t", &saveptr)))
+			continue;
+
+		if (!strcmp(cmd, "cpus")) {
+			char *arg = strtok_r(NULL, " \t", &saveptr);
+			if (arg)
+				sim->cpu_num = strtoul(arg, NULL, 10);
+			if (!arg || !sim->cpu_num ||
+				(sim->cpu_num > NR_CPUS))
+				goto illegal;
+		} else if (!strcmp(cmd, "cycles")) {
+			char *arg = strtok_r(NULL, " \t", &saveptr);
+			if (!arg)
+				goto illegal;
+			sim->cycles = strtoul(arg, NULL, 10);
+		} else if (!strcmp(cmd, "node")) {
+			char *id = strtok_r(NULL, " \t", &saveptr);
+			char *list = strtok_r(NULL, " \t", &saveptr);
+			sim_node_t *node;
+			if (!id || !list || (sim->node_num >= SIM_MAX_NODES))
+				goto illegal;
+			node = &sim->nodes[sim->node_num];
+			node->id = strtoul(id, NULL, 10);
+			cpus_init(node->cpumask);
+			if (cpulist_parse(list, strlen(list), node->cpumask) < 0) {
+				cpus_free(node->cpumask);
+				goto illegal;
+			}
+			sim->node_num++;
+		} else if (!strcmp(cmd, "irq")) {
+			if (parse_irq(sim, &saveptr) < 0)
+				goto illegal;
+		} else if (!strcmp(cmd, "offline") || !strcmp(cmd, "online")) {
+			char *cpu = strtok_r(NULL, " \t", &saveptr);
+			char *cycle = strtok_r(NULL, " \t", &saveptr);
+			sim_event_t *ev;
+			if (!cpu || !cycle)
+				goto illegal;
+			ev = realloc(sim->events,
+				(sim->event_num + 1) * sizeof(*ev));
+			assert(ev);
+			sim->events = ev;
+			ev = &sim->events[sim->event_num++];
+			ev->cpu = strtoul(cpu, NULL, 10);
+			ev->cycle = strtoul(cycle, NULL, 10);
+			ev->online = !strcmp(cmd, "online");
+			if (ev->cpu >= NR_CPUS)
+				goto illegal;
+		} else {
+			goto illegal;
+		}
+		continue;
+illegal:
+		fprintf(stderr, "Error: Illegal line %u in %s\n", ln, fname);
+		ret = -1;
+	}
+	free(line);
+	fclose(file);
+
+	if (!sim->cpu_num) {
+		fprintf(stderr, "Error: No CPUs in %s\n", fname);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/*--------------------------------------------------------- */
+/* Write string to the file within fake root. Creates parent
+   directories (and root itself) if needed. */
+static int sim_write(const char *str, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+static int sim_write(const char *str, const char *fmt, ...)
+{
+	char rel[PATH_MAX];
+	char path[PATH_MAX];
+	char *p;
+	va_list ap;
+	FILE *f;
+
+	va_start(ap, fmt);
+	vsnprintf(rel, sizeof(rel), fmt, ap);
+	va_end(ap);
+	rel[sizeof(rel) - 1] = '\0';
+	path_build(path, sizeof(path), "%s", rel);
+
+	/* mkdir -p */
+	for (p = path + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+	if (!(f = fopen(path, "w")))
+		return -1;
+	fputs(str, f);
+	if (fclose(f) != 0)
+		return -1;
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static void sim_cpumask_str(char *buf, size_t len, cpumask_t *cpumask)
+{
+	cpumask_scnprintf(buf, len, *cpumask);
+	buf[len - 1] = '\0';
+	strncat(buf, "\n", len - strlen(buf) - 1);
+}
+
+/*--------------------------------------------------------- */
+/* Write mask in both formats: hex file like "smp_affinity" and
+   CPU list file like "smp_affinity_list" within the dir. */
+static int sim_write_mask(cpumask_t *cpumask, const char *dir,
+	const char *hex, const char *list)
+{
+	char buf[NR_CPUS * 6];
+
+	sim_cpumask_str(buf, sizeof(buf), cpumask);
+	if (sim_write(buf, "%s/%s", dir, hex) < 0)
+		return -1;
+	cpulist_scnprintf(buf, sizeof(buf) - 1, *cpumask);
+	buf[sizeof(buf) - 2] = '\0';
+	strcat(buf, "\n");
+
+	return sim_write(buf, "%s/%s", dir, list);
+}
+
+/*--------------------------------------------------------- */
+/* Write /sys/devices/system/cpu/online like "0-3,6-7" */
+static int sim_write_online(sim_t *sim)
+{
+	char buf[NR_CPUS * 6];
+
+	cpulist_scnprintf(buf, sizeof(buf) - 1, sim->online);
+	buf[sizeof(buf) - 2] = '\0';
+	strcat(buf, "\n");
+
+	return sim_write(buf, "%s/online", SYSFS_CPU_PATH);
+}
+
+/*--------------------------------------------------------- */
+static sim_node_t *sim_node(sim_t *sim, int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < sim->node_num; i++) {
+		if (sim->nodes[i].id == (unsigned int)id)
+			return &sim->nodes[i];
+	}
+
+	return NULL;
+}
+
+/*--------------------------------------------------------- */
+/* Generate sysfs topology and initial IRQ affinities */
+static int sim_create_tree(sim_t *sim)
+{
+	char buf[NR_CPUS + 16];
+	char dir[PATH_MAX];
+	unsigned int i;
+	cpumask_t all;
+	cpumask_t cpumask;
+	int ret = -1;
+
+	cpus_init(all);
+	cpus_init(cpumask);
+	cpus_clear(all);
+	for (i = 0; i < sim->cpu_num; i++)
+		cpu_set(i, all);
+
+	/* CPUs */
+	for (i = 0; i < sim->cpu_num; i++) {
+		unsigned int package = 0;
+		cpumask_t *llc = &all;
+		unsigned int j;
+		for (j = 0; j < sim->node_num; j++) {
+			if (!cpu_isset(i, sim->nodes[j].cpumask))
+				continue;
+			package = sim->nodes[j].id;
+			llc = &sim->nodes[j].cpumask;
+			/* The link to node in real sysfs */
+			if (sim_write("", "%s/cpu%u/node%u", SYSFS_CPU_PATH,
+				i, package) < 0)
+				goto err;
+		}
+		snprintf(buf, sizeof(buf), "%u\n", package);
+		if (sim_write(buf, "%s/cpu%u/topology/physical_package_id",
+			SYSFS_CPU_PATH, i) < 0)
+			goto err;
+		snprintf(buf, sizeof(buf), "%u\n", i);
+		if (sim_write(buf, "%s/cpu%u/topology/core_id",
+			SYSFS_CPU_PATH, i) < 0)
+			goto err;
+		cpus_clear(cpumask);
+		cpu_set(i, cpumask);
+		snprintf(dir, sizeof(dir), "%s/cpu%u/topology",
+			SYSFS_CPU_PATH, i);
+		if (sim_write_mask(&cpumask, dir, "thread_siblings",
+			"thread_siblings_list") < 0)
+			goto err;
+		/* The node shares last level cache */
+		snprintf(dir, sizeof(dir), "%s/cpu%u/cache/index3",
+			SYSFS_CPU_PATH, i);
+		if (sim_write_mask(llc, dir, "shared_cpu_map", "shared_cpu_list") < 0)
+			goto err;
+	}
+	cpulist_scnprintf(buf, sizeof(buf) - 1, all);
+	strcat(buf, "\n");
+	if (sim_write(buf, "%s/possible", SYSFS_CPU_PATH) < 0)
+		goto err;
+	if (sim_write_online(sim) < 0)
+		goto err;
+
+	/* NUMA nodes */
+	cpus_clear(cpumask);
+	for (i = 0; i < sim->node_num; i++) {
+		snprintf(dir, sizeof(dir), "%s/node%u",
+			SYSFS_NUMA_PATH, sim->nodes[i].id);
+		if (sim_write_mask(&sim->nodes[i].cpumask, dir,
+			"cpumap", "cpulist") < 0)
+			goto err;
+		cpu_set(sim->nodes[i].id, cpumask);
+	}
+	if (sim->node_num) {
+		cpulist_scnprintf(buf, sizeof(buf) - 1, cpumask);
+		strcat(buf, "\n");
+		if (sim_write(buf, "%s/online", SYSFS_NUMA_PATH) < 0)
+			goto err;
+	}
+
+	/* IRQs */
+	for (i = 0; i < sim->irq_num; i++) {
+		sim_irq_t *irq = &sim->irqs[i];
+		sim_node_t *node = sim_node(sim, irq->node);
+
+		if (irq->pci_addr) {
+			if (sim_write("", "%s/%s/msi_irqs/%u", SYSFS_PCI_PATH,
+				irq->pci_addr, irq->num) < 0)
+				goto err;
+			snprintf(dir, sizeof(dir), "%s/%s",
+				SYSFS_PCI_PATH, irq->pci_addr);
+			if (sim_write_mask(node ? &node->cpumask : &all, dir,
+				"local_cpus", "local_cpulist") < 0)
+				goto err;
+		}
+		if (irq->cpu >= 0) {
+			cpus_clear(cpumask);
+			cpu_set(irq->cpu, cpumask);
+		} else {
+			cpus_copy(cpumask, all);
+		}
+		snprintf(dir, sizeof(dir), "%s/%u", PROC_IRQ, irq->num);
+		if (sim_write_mask(&cpumask, dir, "smp_affinity",
+			"smp_affinity_list") < 0)
+			goto err;
+		/* The kernel shows zero mask if there is no hint */
+		cpus_clear(cpumask);
+		if (irq->hint >= 0)
+			cpu_set(irq->hint, cpumask);
+		sim_cpumask_str(buf, sizeof(buf), &cpumask);
+		if (sim_write(buf, "%s/affinity_hint", dir) < 0)
+			goto err;
+	}
+
+	ret = 0;
+err:
+	cpus_free(cpumask);
+	cpus_free(all);
+
+	return ret;
+}
+
+/*--------------------------------------------------------- */
+/* Current rate of IRQ, interrupts per second */
+static double sim_irq_rate(sim_irq_t *irq, unsigned int cycle)
+{
+	switch (irq->profile) {
+	case SIM_PROFILE_STEP:
+		return (cycle < irq->period) ? irq->rate : irq->rate2;
+	case SIM_PROFILE_PERIODIC:
+		return ((cycle % irq->period) < irq->burst) ?
+			irq->rate2 : irq->rate;
+	default:
+		break;
+	}
+	return irq->rate;
+}
+
+/*--------------------------------------------------------- */
+/* Read affinity mask written by balancer */
+static int sim_irq_affinity(sim_irq_t *irq, cpumask_t *cpumask)
+{
+	char list[PATH_MAX];
+	char path[PATH_MAX];
+
+	path_build(list, sizeof(list), "%s/%u/smp_affinity_list",
+		PROC_IRQ, irq->num);
+	path_build(path, sizeof(path), "%s/%u/smp_affinity",
+		PROC_IRQ, irq->num);
+
+	return cpumask_read(list, path, *cpumask);
+}
+
+/*--------------------------------------------------------- */
+/* Get CPU IRQ is delivered to. The first online CPU of affinity mask
+   written by balancer. */
+static unsigned int sim_irq_cpu(sim_t *sim, sim_irq_t *irq)
+{
+	cpumask_t cpumask;
+	unsigned int cpu;
+
+	cpus_init(cpumask);
+	if (sim_irq_affinity(irq, &cpumask) < 0)
+		cpus_clear(cpumask);
+	cpus_and(cpumask, cpumask, sim->online);
+	cpu = first_cpu(cpumask);
+	if (cpu >= sim->cpu_num)
+		cpu = first_cpu(sim->online);
+	cpus_free(cpumask);
+
+	return cpu;
+}
+
+/*--------------------------------------------------------- */
+/* Apply CPU hotplug events of the cycle. Like kernel does, the
+   affinity of IRQ without online CPUs is changed to all online
+   CPUs. */
+static int sim_hotplug(sim_t *sim, unsigned int cycle)
+{
+	char dir[PATH_MAX];
+	cpumask_t cpumask;
+	unsigned int i;
+	int changed = 0;
+	int ret = 0;
+
+	for (i = 0; i < sim->event_num; i++) {
+		sim_event_t *ev = &sim->events[i];
+		if ((ev->cycle != cycle) || (ev->cpu >= sim->cpu_num))
+			continue;
+		if (ev->online)
+			cpu_set(ev->cpu, sim->online);
+		else
+			cpu_clear(ev->cpu, sim->online);
+		changed = 1;
+	}
+	if (!changed)
+		return 0;
+	if (sim_write_online(sim) < 0)
+		return -1;
+
+	cpus_init(cpumask);
+	for (i = 0; i < sim->irq_num; i++) {
+		sim_irq_t *irq = &sim->irqs[i];
+		if (sim_irq_affinity(irq, &cpumask) < 0)
+			continue;
+		cpus_and(cpumask, cpumask, sim->online);
+		if (!cpus_empty(cpumask))
+			continue;
+		snprintf(dir, sizeof(dir), "%s/%u", PROC_IRQ, irq->num);
+		if (sim_write_mask(&sim->online, dir, "smp_affinity",
+			"smp_affinity_list") < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	cpus_free(cpumask);
+
+	return ret;
+}
+
+/*--------------------------------------------------------- */
+/* Simulate interval and write /proc/stat and /proc/interrupts */
+int sim_step(sim_t *sim, unsigned int cycle, unsigned int interval)
+{
+	double irq_ns[NR_CPUS];
+	double ticks = (double)interval * SIM_USER_HZ;
+	unsigned int i, j;
+	FILE *f;
+	char path[PATH_MAX];
+	unsigned long long total_intr = 0;
+	unsigned long long *intr_by_num;
+	unsigned int online = 0;
+
+	if (sim_hotplug(sim, cycle) < 0)
+		return -1;
+	for (i = 0; i < sim->cpu_num; i++)
+		irq_ns[i] = 0;
+	for (i = 0; i < sim->irq_num; i++) {
+		sim_irq_t *irq = &sim->irqs[i];
+		double intr = sim_irq_rate(irq, cycle) * interval;
+		unsigned int cpu = sim_irq_cpu(sim, irq);
+		irq->intr += (unsigned long long)intr;
+		irq->cpu_intr[cpu] += (unsigned long long)intr;
+		irq_ns[cpu] += intr * irq->cost;
+	}
+
+	/* CPU counters in USER_HZ ticks */
+	sim->max_load = 0;
+	sim->mean_load = 0;
+	for (i = 0; i < sim->cpu_num; i++) {
+		double irq_ticks = irq_ns[i] / 1000000000.0 * SIM_USER_HZ;
+		if (irq_ticks > ticks)
+			irq_ticks = ticks;
+		sim->cpu_irq[i] += irq_ticks;
+		sim->cpu_idle[i] += ticks - irq_ticks;
+		sim->load[i] = ticks ? irq_ticks * 100 / ticks : 0;
+		if (!cpu_isset(i, sim->online))
+			continue;
+		if (sim->load[i] > sim->max_load)
+			sim->max_load = sim->load[i];
+		sim->mean_load += sim->load[i];
+		online++;
+	}
+	if (online)
+		sim->mean_load /= online;
+
+	/* /proc/stat */
+	path_build(path, sizeof(path), "%s", PROC_STAT);
+	if (!(f = fopen(path, "w")))
+		return -1;
+	fprintf(f, "cpu  0 0 0 0 0 0 0 0 0 0\n");
+	for (i = 0; i < sim->cpu_num; i++)
+		if (cpu_isset(i, sim->online))
+			fprintf(f, "cpu%u 0 0 0 %llu 0 0 %llu 0 0 0\n", i,
+				(unsigned long long)sim->cpu_idle[i],
+				(unsigned long long)sim->cpu_irq[i]);
+	intr_by_num = calloc(sim->max_irq + 1, sizeof(*intr_by_num));
+	assert(intr_by_num);
+	for (i = 0; i < sim->irq_num; i++) {
+		total_intr += sim->irqs[i].intr;
+		intr_by_num[sim->irqs[i].num] = sim->irqs[i].intr;
+	}
+	fprintf(f, "intr %llu", total_intr);
+	for (i = 0; i <= sim->max_irq; i++)
+		fprintf(f, " %llu", intr_by_num[i]);
+	fprintf(f, "\n");
+	fclose(f);
+	free(intr_by_num);
+
+	/* /proc/interrupts. Only online CPUs are shown. */
+	path_build(path, sizeof(path), "%s", PROC_INTERRUPTS);
+	if (!(f = fopen(path, "w")))
+		return -1;
+	fprintf(f, "    ");
+	for (i = 0; i < sim->cpu_num; i++)
+		if (cpu_isset(i, sim->online))
+			fprintf(f, "       CPU%u", i);
+	fprintf(f, "\n");
+	for (i = 0; i < sim->irq_num; i++) {
+		sim_irq_t *irq = &sim->irqs[i];
+		fprintf(f, "%4u: ", irq->num);
+		for (j = 0; j < sim->cpu_num; j++)
+			if (cpu_isset(j, sim->online))
+				fprintf(f, " %10llu", irq->cpu_intr[j]);
+		fprintf(f, "  PCI-MSI-edge      %s\n", irq->desc);
+	}
+	fclose(f);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static int sim_rm(const char *path, const struct stat *sb,
+	int flag, struct FTW *ftw)
+{
+	sb = sb; flag = flag; ftw = ftw; /* Happy compiler */
+	return remove(path);
+}
+
+/*--------------------------------------------------------- */
+static unsigned int sim_moves(cycle_t *cycle)
+{
+	lub_list_node_t *iter;
+	unsigned int moves = 0;
+
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		moves += irq->moves;
+	}
+
+	return moves;
+}
+
+/*--------------------------------------------------------- */
+/* Create fake procfs/sysfs tree with initial counters and set it as
+   the root for balancer. */
+int sim_setup(sim_t *sim)
+{
+	char tmpl[] = "/tmp/birq-sim.XXXXXX";
+	unsigned int i;
+
+	for (i = 0; i < sim->irq_num; i++) {
+		if (sim->irqs[i].num > sim->max_irq)
+			sim->max_irq = sim->irqs[i].num;
+		sim->irqs[i].cpu_intr = calloc(sim->cpu_num,
+			sizeof(*sim->irqs[i].cpu_intr));
+		assert(sim->irqs[i].cpu_intr);
+	}
+
+	if (!sim->root) {
+		if (!mkdtemp(tmpl)) {
+			fprintf(stderr, "Error: Can't create fake root: %s\n",
+				strerror(errno));
+			return -1;
+		}
+		sim->root = strdup(tmpl);
+	}
+	path_set_root(sim->root);
+	cpus_clear(sim->online);
+	for (i = 0; i < sim->cpu_num; i++)
+		cpu_set(i, sim->online);
+	if ((sim_create_tree(sim) < 0) || (sim_step(sim, 0, 0) < 0)) {
+		fprintf(stderr, "Error: Can't write fake root %s: %s\n",
+			sim->root, strerror(errno));
+		sim_cleanup(sim);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Reset root and remove fake tree if it's not needed to keep it */
+void sim_cleanup(sim_t *sim)
+{
+	path_set_root(NULL);
+	if (!sim->keep)
+		nftw(sim->root, sim_rm, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/*--------------------------------------------------------- */
+/* Run simulation. The results are stored within sim structure. */
+int sim_run(sim_t *sim, cycle_t *cycle)
+{
+	unsigned int i;
+	unsigned int interval = 0;
+	unsigned long long now = SIM_START_TIME;
+	unsigned int moves = 0;
+	double ratio_sum = 0;
+
+	if (sim_setup(sim) < 0)
+		return -1;
+
+	srand(sim->seed);
+	cycle_scan(cycle, NULL);
+	/* The first cycle gets initial counters only */
+	cycle_run(cycle, now);
+
+	for (i = 0; i < sim->cycles; i++) {
+		unsigned int cur_moves;
+		int balanced;
+
+		interval = interval ? interval : sim->long_interval;
+		if (sim_step(sim, i, interval) < 0) {
+			fprintf(stderr, "Error: Can't write fake root %s: %s\n",
+				sim->root, strerror(errno));
+			sim_cleanup(sim);
+			return -1;
+		}
+		now += (unsigned long long)interval * 1000;
+
+		if (sim->quiet)
+			fflush(stdout);
+		balanced = cycle_run(cycle, now);
+		cur_moves = sim_moves(cycle) - moves;
+		moves += cur_moves;
+
+		/* Quality metrics. The loads are loads of finished
+		   interval. */
+		if (sim->mean_load > 0)
+			ratio_sum += sim->max_load / sim->mean_load;
+		else
+			ratio_sum += 1;
+		if (sim->max_load >= cycle->threshold)
+			sim->time_above += interval;
+		if (cur_moves) {
+			sim->converge_cycle = i + 1;
+			sim->converge_time = (now - SIM_START_TIME) / 1000;
+		}
+		sim->time = (now - SIM_START_TIME) / 1000;
+		if (sim->trace)
+			fprintf(sim->trace, "cycle=%u time=%llu interval=%u "
+				"max_load=%.2f mean_load=%.2f moves=%u\n",
+				i, (now - SIM_START_TIME) / 1000, interval,
+				sim->max_load, sim->mean_load, cur_moves);
+
+		interval = balanced ? sim->short_interval : sim->long_interval;
+	}
+	sim->moves = moves;
+	sim->ratio = sim->cycles ? ratio_sum / sim->cycles : 1;
+	sim->final_max_load = sim->max_load;
+	sim->final_mean_load = sim->mean_load;
+
+	sim_cleanup(sim);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+void sim_show(sim_t *sim, FILE *out)
+{
+	fprintf(out, "cycles=%u time=%llu moves=%u converge_cycle=%u "
+		"converge_time=%llu ratio=%.3f final_max_load=%.2f "
+		"final_mean_load=%.2f time_above=%llu\n",
+		sim->cycles, sim->time, sim->moves, sim->converge_cycle,
+		sim->converge_time, sim->ratio, sim->final_max_load,
+		sim->final_mean_load, sim->time_above);
+}
+
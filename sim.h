@@ -0,0 +1,104 @@
+#ifndef _sim_h
+#define _sim_h
+
+#include <stdio.h>
+#include "cpumask.h"
+#include "cycle.h"
+
+#define SIM_DEFAULT_CYCLES 100
+#define SIM_DEFAULT_COST 1000.0 /* ns per interrupt */
+#define SIM_MAX_NODES 64
+#define SIM_MAX_IRQ_NUM 65536
+/* Time of the first cycle, ms. The zero time means "never" for
+   balancer (the IRQ was never moved etc.) */
+#define SIM_START_TIME 1000000ULL
+
+/* Rate profile of simulated IRQ */
+typedef enum {
+	SIM_PROFILE_CONST, /* rate */
+	SIM_PROFILE_STEP, /* rate before cycle 'period' then rate2 */
+	SIM_PROFILE_PERIODIC /* rate2 for 'burst' cycles of each 'period' */
+} sim_profile_e;
+
+struct sim_irq_s {
+	unsigned int num; /* IRQ number */
+	char *pci_addr; /* PCI address. NULL for non-PCI IRQ */
+	char *desc; /* Device name */
+	int node; /* Local NUMA node. -1 - all CPUs are local */
+	int cpu; /* Initial CPU. -1 - all CPUs */
+	int hint; /* CPU of affinity hint. -1 - no hint */
+	double cost; /* CPU time per interrupt, ns */
+	sim_profile_e profile;
+	double rate; /* Interrupts per second */
+	double rate2;
+	unsigned int period; /* Profile period or step, in cycles */
+	unsigned int burst; /* Burst length, in cycles */
+	unsigned long long intr; /* Total number of interrupts */
+	unsigned long long *cpu_intr; /* Number of interrupts per CPU */
+};
+typedef struct sim_irq_s sim_irq_t;
+
+struct sim_node_s {
+	unsigned int id;
+	cpumask_t cpumask;
+};
+typedef struct sim_node_s sim_node_t;
+
+/* CPU hotplug event */
+struct sim_event_s {
+	unsigned int cpu;
+	unsigned int cycle; /* Cycle to change CPU state on */
+	int online; /* New state */
+};
+typedef struct sim_event_s sim_event_t;
+
+struct sim_s {
+	/* Scenario */
+	unsigned int cpu_num;
+	sim_node_t nodes[SIM_MAX_NODES];
+	unsigned int node_num;
+	sim_irq_t *irqs;
+	unsigned int irq_num;
+	unsigned int max_irq; /* Maximal IRQ number */
+	unsigned int cycles; /* Number of balancing cycles to run */
+	sim_event_t *events; /* CPU hotplug events */
+	unsigned int event_num;
+	/* Simulation parameters */
+	unsigned int short_interval; /* Simulated intervals, seconds */
+	unsigned int long_interval;
+	unsigned int seed; /* Seed for random choose */
+	char *root; /* Fake procfs/sysfs root */
+	int keep; /* Don't remove fake root */
+	int quiet;
+	FILE *trace; /* Per cycle output */
+	/* State */
+	cpumask_t online; /* Online CPUs */
+	double cpu_irq[NR_CPUS]; /* IRQ time, USER_HZ ticks */
+	double cpu_idle[NR_CPUS]; /* Idle time, USER_HZ ticks */
+	float load[NR_CPUS]; /* Real IRQ load of last interval */
+	float max_load;
+	float mean_load;
+	/* Results */
+	unsigned int moves; /* Total number of moves */
+	unsigned int converge_cycle; /* Cycles before the last move */
+	unsigned long long converge_time; /* Time of the last move, s */
+	float ratio; /* Mean of max/mean load ratio */
+	float final_max_load;
+	float final_mean_load;
+	unsigned long long time_above; /* Time with overloaded CPU, s */
+	unsigned long long time; /* Simulated time, s */
+};
+typedef struct sim_s sim_t;
+
+sim_t *sim_new(void);
+void sim_free(sim_t *sim);
+int sim_parse_scenario(sim_t *sim, const char *fname);
+sim_irq_t *sim_add_irq(sim_t *sim, unsigned int num,
+	const char *pci_addr, const char *desc);
+int sim_setup(sim_t *sim);
+int sim_step(sim_t *sim, unsigned int cycle, unsigned int interval);
+void sim_cleanup(sim_t *sim);
+int sim_run(sim_t *sim, cycle_t *cycle);
+void sim_show(sim_t *sim, FILE *out);
+
+#endif
@@ -0,0 +1,242 @@
+/* state.c
+ * Persistent state for warm start. The state is saved on exit and
+ * periodically. It's the text file:
+ *   birq-state <version>
+ *   boot_id <id>
+ *   cpu <id> <old_load_all> <old_load_irq> <old_load_busy> <old_load> <load>
+ *   irq <num> <pci_addr> <old_intr> <stat_time> <rate> <last_move> <moves>
+ *       <backoff> <rate_before> <rate_after> <local_cpus> <desc>
+ * The counters, times and IRQ numbers are valid within the same boot
+ * only. So if boot_id is the same then the IRQs are restored by number
+ * and the first cycle has valid statistics and needs no sysfs scan.
+ * Else the move history and rate estimates are restored for the IRQs
+ * with the same PCI address and description.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lub/list.h"
+#include "irq.h"
+#include "cpu.h"
+#include "path.h"
+#include "cycle.h"
+#include "state.h"
+
+#define STR(str) ( (str && *str) ? str : "-" )
+
+/*--------------------------------------------------------- */
+static void boot_id(char *buf, size_t size)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	buf[0] = '\0';
+	path_build(path, sizeof(path), "%s", PROC_BOOT_ID);
+	if (!(f = fopen(path, "r")))
+		return;
+	if (!fgets(buf, size, f))
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, " \t\r\n")] = '\0';
+}
+
+/*--------------------------------------------------------- */
+/* Write state file atomically */
+int state_save(cycle_t *cycle, const char *fname)
+{
+	char tmp[PATH_MAX];
+	char buf[NR_CPUS + 1];
+	lub_list_node_t *iter;
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	tmp[sizeof(tmp) - 1] = '\0';
+	if (!(f = fopen(tmp, "w")))
+		return -1;
+
+	boot_id(buf, sizeof(buf));
+	fprintf(f, "%s %u\n", STATE_MAGIC, STATE_VERSION);
+	fprintf(f, "boot_id %s\n", buf[0] ? buf : "-");
+	for (iter = lub_list_iterator_init(cycle->cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		fprintf(f, "cpu %u %llu %llu %llu %.2f %.2f\n", cpu->id,
+			cpu->old_load_all, cpu->old_load_irq,
+			cpu->old_load_busy, cpu->old_load, cpu->load);
+	}
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		/* The blacklisted IRQs will be checked again */
+		if (irq->blacklisted)
+			continue;
+		cpumask_scnprintf(buf, sizeof(buf), irq->local_cpus);
+		buf[sizeof(buf) - 1] = '\0';
+		fprintf(f, "irq %u %s %llu %llu %llu %llu %u %u %llu %llu %s %s\n",
+			irq->irq, STR(irq->pci_addr), irq->old_intr,
+			irq->stat_time, irq->rate, irq->last_move, irq->moves,
+			irq->backoff, irq->rate_before, irq->rate_after,
+			buf, STR(irq->desc));
+	}
+
+	if (fclose(f) != 0) {
+		remove(tmp);
+		return -1;
+	}
+	if (rename(tmp, fname) < 0) {
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static int str_equal(const char *saved, const char *cur)
+{
+	if (!strcmp(saved, "-"))
+		return (!cur || !*cur);
+	return (cur && !strcmp(saved, cur));
+}
+
+/*--------------------------------------------------------- */
+/* Find IRQ by PCI address and description */
+static irq_t *irq_match(lub_list_t *irqs, const char *pci_addr,
+	const char *desc)
+{
+	lub_list_node_t *iter;
+
+	for (iter = lub_list_iterator_init(irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		if (str_equal(pci_addr, irq->pci_addr) &&
+			str_equal(desc, irq->desc))
+			return irq;
+	}
+
+	return NULL;
+}
+
+/*--------------------------------------------------------- */
+/* Restore state. The CPUs must be already scanned. Returns
+   number of restored IRQs or -1 if state can't be used. */
+int state_load(cycle_t *cycle, const char *fname)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t size = 0;
+	char cur_boot[128];
+	int same_boot = 0;
+	unsigned int version = 0;
+	int restored = 0;
+
+	if (!(f = fopen(fname, "r")))
+		return -1;
+	if ((getline(&line, &size, f) < 0) ||
+		(sscanf(line, STATE_MAGIC " %u", &version) != 1) ||
+		(version != STATE_VERSION)) {
+		free(line);
+		fclose(f);
+		return -1;
+	}
+
+	boot_id(cur_boot, sizeof(cur_boot));
+
+	/* The IRQ numbers are not persistent between boots. So the
+	   current IRQs must be known to match them. */
+	while (getline(&line, &size, f) >= 0) {
+		char pci_addr[64];
+		char *mask;
+		unsigned int num;
+		int pos = 0;
+		irq_t st;
+		irq_t *irq;
+		char *desc;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!strncmp(line, "boot_id ", 8)) {
+			same_boot = cur_boot[0] && !strcmp(line + 8, cur_boot);
+			if (!same_boot) {
+				lub_list_t *balance_irqs = lub_list_new(irq_list_compare);
+				lub_list_node_t *node;
+				scan_irqs(cycle->irqs, balance_irqs, cycle->pxms);
+				while ((node = lub_list__get_tail(balance_irqs))) {
+					lub_list_del(balance_irqs, node);
+					lub_list_node_free(node);
+				}
+				lub_list_free(balance_irqs);
+			}
+			continue;
+		}
+
+		if (!strncmp(line, "cpu ", 4)) {
+			cpu_t c;
+			cpu_t *cpu;
+			if (!same_boot)
+				continue;
+			if (sscanf(line, "cpu %u %llu %llu %llu %f %f", &c.id,
+				&c.old_load_all, &c.old_load_irq,
+				&c.old_load_busy, &c.old_load, &c.load) != 6)
+				continue;
+			if (!(cpu = cpu_list_search(cycle->cpus, c.id)))
+				continue;
+			cpu->old_load_all = c.old_load_all;
+			cpu->old_load_irq = c.old_load_irq;
+			cpu->old_load_busy = c.old_load_busy;
+			cpu->old_load = c.old_load;
+			cpu->load = c.load;
+			continue;
+		}
+
+		if (strncmp(line, "irq ", 4))
+			continue;
+		if (sscanf(line, "irq %u %63s %llu %llu %llu %llu %u %u "
+			"%llu %llu %n", &num, pci_addr, &st.old_intr,
+			&st.stat_time, &st.rate, &st.last_move, &st.moves,
+			&st.backoff, &st.rate_before, &st.rate_after,
+			&pos) != 10)
+			continue;
+		if (!pos)
+			continue;
+		mask = line + pos;
+		desc = mask + strcspn(mask, " ");
+		if (!*desc)
+			continue;
+		*desc++ = '\0';
+
+		if (same_boot) {
+			/* The scan_irqs() will find out IRQs disappeared
+			   or reused by another device */
+			if (!(irq = irq_list_add(cycle->irqs, num)))
+				continue;
+			free(irq->desc);
+			irq->desc = strcmp(desc, "-") ? strdup(desc) : NULL;
+			if (strcmp(pci_addr, "-")) {
+				free(irq->pci_addr);
+				irq->pci_addr = strdup(pci_addr);
+			}
+			cpumask_parse_user(mask, strlen(mask), irq->local_cpus);
+			/* The scan_irqs() doesn't consider it as new one */
+			irq_get_hint(irq);
+			irq->old_intr = st.old_intr;
+			irq->stat_time = st.stat_time;
+			irq->last_move = st.last_move;
+		} else {
+			if (!(irq = irq_match(cycle->irqs, pci_addr, desc)))
+				continue;
+		}
+		irq->rate = st.rate;
+		irq->moves = st.moves;
+		irq->backoff = st.backoff;
+		irq->rate_before = st.rate_before;
+		irq->rate_after = st.rate_after;
+		restored++;
+	}
+	free(line);
+	fclose(f);
+
+	return restored;
+}
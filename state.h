@@ -0,0 +1,14 @@
+#ifndef _state_h
+#define _state_h
+
+#include "cycle.h"
+
+/* State file keeps the learned state between restarts */
+#define STATE_MAGIC "birq-state"
+#define STATE_VERSION 1
+#define PROC_BOOT_ID "/proc/sys/kernel/random/boot_id"
+
+int state_save(cycle_t *cycle, const char *fname);
+int state_load(cycle_t *cycle, const char *fname);
+
+#endif
@@ -14,53 +14,104 @@
 #include "cpu.h"
 #include "irq.h"
 #include "balance.h"
+#include "path.h"
 
 /* The setting of smp affinity is not reliable due to problems with some
- * APIC hw/driver. So we need to relink IRQs to CPUs on each iteration.
- * The linkage is based on current smp affinity value.
+ * APIC hw/driver. So the current smp affinity is read on each iteration.
+ * Only IRQs with changed affinity (see irq_get_affinity()) are relinked.
+ * The IRQ already linked to its CPU (moved by balancer) is not touched.
+ * The index is built by cpu_list_index(). So the IRQ bound to second
+ * thread of Hyper Threading is linked to the listed sibling. The IRQ
+ * bound to unknown (offline) CPU stays changed until the CPU appears.
  */
-void link_irqs_to_cpus(lub_list_t *cpus, lub_list_t *irqs)
+void link_irqs_to_cpus(cpu_t **index)
 {
-	lub_list_node_t *iter;
+	ilist_t missed; /* IRQs bound to unknown CPUs */
+	irq_t *irq;
+
+	/* Iterate through changed IRQs */
+	ilist_init(&missed);
+	while ((irq = irq_changed_pop())) {
+		cpu_t *cpu = NULL;
+
+		/* The blacklisted IRQs and IRQs with multi-affinity
+		   are not linked to any CPU. */
+		if (!irq->blacklisted && (cpus_weight(irq->affinity) == 1) &&
+			!(cpu = index[first_cpu(irq->affinity)]))
+			ilist_add_tail(&missed, &irq->change_link);
+		if (cpu && (irq->cpu_link.list == &cpu->irqs))
+			continue;
+		if (cpu)
+			move_irq_to_cpu(irq, cpu);
+		else if (irq->cpu)
+			remove_irq_from_cpu(irq, irq->cpu);
+	}
 
-	/* Clear all CPU's irq lists. These lists are probably out of date. */
-	for (iter = lub_list_iterator_init(cpus); iter;
-		iter = lub_list_iterator_next(iter)) {
-		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
-		lub_list_node_t *node;
-		while ((node = lub_list__get_tail(cpu->irqs))) {
-			lub_list_del(cpu->irqs, node);
-			lub_list_node_free(node);
-		}
+	while (missed.head) {
+		irq = ilist_entry(missed.head, irq_t, change_link);
+		ilist_del(&irq->change_link);
+		irq_changed(irq);
 	}
+}
 
-	/* Iterate through IRQ list */
-	for (iter = lub_list_iterator_init(irqs); iter;
-		iter = lub_list_iterator_next(iter)) {
-		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
-		int cpu_num;
-		cpu_t *cpu;
+/* Calculate CPU load using new total, IRQ and non-idle time counters
+   from /proc/stat. The non-idle counter is informational only and
+   can be 0 if unknown. */
+void cpu_update_load(cpu_t *cpu, unsigned long long load_all,
+	unsigned long long load_irq, unsigned long long load_busy,
+	unsigned long long now)
+{
+	cpu->old_load = cpu->load;
+	cpu->total_load = 0;
+	if (cpu->old_load_all == 0) {
+		/* When old_load_all = 0 - it's first iteration */
+		cpu->load = 0;
+	} else {
+		float d_all = (float)(load_all - cpu->old_load_all);
+		float d_irq = (float)(load_irq - cpu->old_load_irq);
+		cpu->load = d_all ? d_irq * 100 / d_all : 0;
+		if (d_all && (load_busy >= cpu->old_load_busy))
+			cpu->total_load = (float)(load_busy -
+				cpu->old_load_busy) * 100 / d_all;
+	}
 
-		/* Ignore blacklisted IRQs */
-		if (irq->blacklisted)
-			continue;
-		/* Ignore IRQs with multi-affinity. */
-		if (cpus_weight(irq->affinity) > 1)
-			continue;
+	history_add(&cpu->history, cpu->load, now);
 
-		cpu_num = first_cpu(irq->affinity);
-		if (NR_CPUS == cpu_num) /* Something went wrong. No bits set. */
-			continue;
-		if (!(cpu = cpu_list_search(cpus, cpu_num)))
-			continue;
-		move_irq_to_cpu(irq, cpu);
+	cpu->old_load_all = load_all;
+	cpu->old_load_irq = load_irq;
+	cpu->old_load_busy = load_busy;
+}
+
+/* Calculate number of interrupts for current iteration using
+   new total number of interrupts */
+void irq_update_intr(irq_t *irq, unsigned long long intr,
+	unsigned long long now)
+{
+	if (irq->old_intr == 0)
+		irq->intr = 0;
+	else
+		irq->intr = intr - irq->old_intr;
+	irq->old_intr = intr;
+
+	/* Interrupts per second */
+	if ((irq->stat_time == 0) || (now <= irq->stat_time))
+		irq->rate = 0;
+	else
+		irq->rate = irq->intr * 1000 / (now - irq->stat_time);
+	irq->stat_time = now;
+	history_add(&irq->history, irq->rate, now);
+	/* The whole interval after move is measured now */
+	if (irq->rate_after_pending) {
+		irq->rate_after = irq->rate;
+		irq->rate_after_pending = 0;
 	}
 }
 
 /* Gather load statistics for CPUs and number of interrupts
  * for current iteration.
  */
-void gather_statistics(lub_list_t *cpus, lub_list_t *irqs)
+void gather_statistics(lub_list_t *cpus, lub_list_t *irqs,
+	unsigned long long now)
 {
 	FILE *file;
 	char *line = NULL;
@@ -80,8 +131,10 @@ void gather_statistics(lub_list_t *cpus, lub_list_t *irqs)
 	char *intr_str;
 	char *saveptr = NULL;
 	unsigned int inum = 0;
+	char path[PATH_MAX];
 
-	file = fopen("/proc/stat", "r");
+	path_build(path, sizeof(path), "%s", PROC_STAT);
+	file = fopen(path, "r");
 	if (!file) {
 		fprintf(stderr, "Warning: Can't open /proc/stat. Balacing is broken.\n");
 		return;
@@ -119,19 +172,8 @@ void gather_statistics(lub_list_t *cpus, lub_list_t *irqs)
 		load_all = l_user + l_nice + l_system + l_idle + l_iowait +
 			l_irq + l_softirq + l_steal + l_guest + l_guest_nice;
 		load_irq = l_irq + l_softirq;
-
-		cpu->old_load = cpu->load;
-		if (cpu->old_load_all == 0) {
-			/* When old_load_all = 0 - it's first iteration */
-			cpu->load = 0;
-		} else {
-			float d_all = (float)(load_all - cpu->old_load_all);
-			float d_irq = (float)(load_irq - cpu->old_load_irq);
-			cpu->load = d_irq * 100 / d_all;
-		}
-
-		cpu->old_load_all = load_all;
-		cpu->old_load_irq = load_irq;
+		cpu_update_load(cpu, load_all, load_irq,
+			load_all - l_idle - l_iowait, now);
 	}
 
 	/* Parse "intr" line. Get number of interrupts. */
@@ -150,11 +192,7 @@ void gather_statistics(lub_list_t *cpus, lub_list_t *irqs)
 		intr = strtoull(intr_str, &endptr, 10);
 		if (endptr == intr_str)
 			intr = 0;
-		if (irq->old_intr == 0)
-			irq->intr = 0;
-		else
-			irq->intr = intr - irq->old_intr;
-		irq->old_intr = intr;
+		irq_update_intr(irq, intr, now);
 	}
 
 	fclose(file);
@@ -168,25 +206,24 @@ void show_statistics(lub_list_t *cpus, int verbose)
 	for (iter = lub_list_iterator_init(cpus); iter;
 		iter = lub_list_iterator_next(iter)) {
 		cpu_t *cpu;
-		lub_list_node_t *irq_iter;
+		ilist_link_t *link;
 
 		cpu = (cpu_t *)lub_list_node__get_data(iter);
 		printf("CPU%u package %u, core %u, irqs %d, old %.2f%%, load %.2f%%\n",
 			cpu->id, cpu->package_id, cpu->core_id,
-			lub_list_len(cpu->irqs), cpu->old_load, cpu->load);
+			ilist_len(&cpu->irqs), cpu->old_load, cpu->load);
 
 		if (!verbose)
 			continue;
-		for (irq_iter = lub_list_iterator_init(cpu->irqs); irq_iter;
-		irq_iter = lub_list_iterator_next(irq_iter)) {
+		ilist_for_each(link, &cpu->irqs) {
 			char buf[NR_CPUS + 1];
-			irq_t *irq = (irq_t *)lub_list_node__get_data(irq_iter);
+			irq_t *irq = ilist_entry(link, irq_t, cpu_link);
 			if (cpus_full(irq->affinity))
 				snprintf(buf, sizeof(buf), "*");
 			else
 				cpumask_scnprintf(buf, sizeof(buf), irq->affinity);
 			buf[sizeof(buf) - 1] = '\0';
-			printf("    IRQ %3u, [%s], weight %d, intr %llu, %s\n", irq->irq, buf, irq->weight, irq->intr, irq->desc);
+			printf("    IRQ %3u, [%s], weight %d, moves %u, intr %llu, %s\n", irq->irq, buf, irq->weight, irq->moves, irq->intr, irq->desc);
 		}
 	}
 }
@@ -2,9 +2,19 @@
 #define _statistics_h
 
 #include "lub/list.h"
+#include "cpu.h"
+#include "irq.h"
 
-void link_irqs_to_cpus(lub_list_t *cpus, lub_list_t *irqs);
-void gather_statistics(lub_list_t *cpus, lub_list_t *irqs);
+#define PROC_STAT "/proc/stat"
+
+void link_irqs_to_cpus(cpu_t **index);
+void cpu_update_load(cpu_t *cpu, unsigned long long load_all,
+	unsigned long long load_irq, unsigned long long load_busy,
+	unsigned long long now);
+void irq_update_intr(irq_t *irq, unsigned long long intr,
+	unsigned long long now);
+void gather_statistics(lub_list_t *cpus, lub_list_t *irqs,
+	unsigned long long now);
 void show_statistics(lub_list_t *cpus, int verbose);
 
 #endif
@@ -0,0 +1,730 @@
+/* trace.c
+ * Record and replay of balancing cycles.
+ *
+ * The trace is an append-only binary file. It contains the raw inputs
+ * of each balancing cycle (CPU counters from /proc/stat, number of
+ * interrupts, IRQ descriptions, affinity, local CPUs, hint and consumer
+ * CPUs masks, the set of CPUs after hotplug) and the resulting decisions. The values are delta-encoded against the
+ * previous cycle and written as varints. The unchanged IRQs and CPUs
+ * are not written at all.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "lub/list.h"
+#include "cpumask.h"
+#include "irq.h"
+#include "cpu.h"
+#include "statistics.h"
+#include "balance.h"
+#include "cycle.h"
+#include "trace.h"
+
+/*--------------------------------------------------------- */
+static void put_varint(FILE *f, unsigned long long val)
+{
+	while (val >= 0x80) {
+		fputc((val & 0x7f) | 0x80, f);
+		val >>= 7;
+	}
+	fputc(val, f);
+}
+
+/*--------------------------------------------------------- */
+static void put_zigzag(FILE *f, long long val)
+{
+	put_varint(f, ((unsigned long long)val << 1) ^ (val >> 63));
+}
+
+/*--------------------------------------------------------- */
+static void put_string(FILE *f, const char *str)
+{
+	size_t len = str ? strlen(str) : 0;
+
+	put_varint(f, len);
+	if (len)
+		fwrite(str, 1, len, f);
+}
+
+/*--------------------------------------------------------- */
+/* Mask is written as a list of ranges of set bits */
+static void put_cpumask(FILE *f, cpumask_t *cpumask)
+{
+	bit_index_t start;
+	bit_index_t end = 0;
+	unsigned int ranges = 0;
+	bit_index_t pos = 0;
+
+	/* Count ranges */
+	while ((pos < NR_CPUS) &&
+		bit_array_find_next_set_bit(cpumask->bits, pos, &start)) {
+		ranges++;
+		if (!bit_array_find_next_clear_bit(cpumask->bits, start, &pos))
+			pos = NR_CPUS;
+	}
+	put_varint(f, ranges);
+
+	/* Write ranges as (gap, length) pairs */
+	pos = 0;
+	while ((pos < NR_CPUS) &&
+		bit_array_find_next_set_bit(cpumask->bits, pos, &start)) {
+		if (!bit_array_find_next_clear_bit(cpumask->bits, start, &pos))
+			pos = NR_CPUS;
+		put_varint(f, start - end);
+		put_varint(f, pos - start);
+		end = pos;
+	}
+}
+
+/*--------------------------------------------------------- */
+static int get_varint(FILE *f, unsigned long long *val)
+{
+	unsigned int shift = 0;
+	int c;
+
+	*val = 0;
+	do {
+		if ((c = fgetc(f)) == EOF)
+			return -1;
+		if (shift > 63)
+			return -1;
+		*val |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static int get_zigzag(FILE *f, long long *val)
+{
+	unsigned long long v;
+
+	if (get_varint(f, &v) < 0)
+		return -1;
+	*val = (long long)(v >> 1) ^ -(long long)(v & 1);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static char *get_string(FILE *f)
+{
+	unsigned long long len;
+	char *str;
+
+	if (get_varint(f, &len) < 0)
+		return NULL;
+	if (!(str = malloc(len + 1)))
+		return NULL;
+	if (len && (fread(str, 1, len, f) != len)) {
+		free(str);
+		return NULL;
+	}
+	str[len] = '\0';
+
+	return str;
+}
+
+/*--------------------------------------------------------- */
+static int get_cpumask(FILE *f, cpumask_t *cpumask)
+{
+	unsigned long long ranges;
+	unsigned long long pos = 0;
+
+	cpus_clear(*cpumask);
+	if (get_varint(f, &ranges) < 0)
+		return -1;
+	while (ranges--) {
+		unsigned long long gap, len;
+		if (get_varint(f, &gap) < 0 || get_varint(f, &len) < 0)
+			return -1;
+		pos += gap;
+		if ((pos + len) > NR_CPUS)
+			return -1;
+		if (len)
+			bit_array_set_region(cpumask->bits, pos, len);
+		pos += len;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* FNV-1a hash to find out changed strings and masks */
+static unsigned long long hash(const void *data, size_t len,
+	unsigned long long h)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+static unsigned long long hash_cpumask(cpumask_t *cpumask)
+{
+	return hash(cpumask->bits->words,
+		cpumask->bits->num_of_words * sizeof(word_t), HASH_INIT);
+}
+
+static unsigned long long hash_desc(irq_t *irq)
+{
+	unsigned long long h = HASH_INIT;
+
+	if (irq->type)
+		h = hash(irq->type, strlen(irq->type), h);
+	h = hash("", 1, h);
+	if (irq->desc)
+		h = hash(irq->desc, strlen(irq->desc), h);
+
+	return h;
+}
+
+/*--------------------------------------------------------- */
+static trace_irq_t *trace_irq(trace_t *trace, unsigned int num)
+{
+	if (num >= trace->irqs_num) {
+		unsigned int new_num = num + 256;
+		trace->irqs = realloc(trace->irqs,
+			new_num * sizeof(*trace->irqs));
+		assert(trace->irqs);
+		memset(trace->irqs + trace->irqs_num, 0,
+			(new_num - trace->irqs_num) * sizeof(*trace->irqs));
+		trace->irqs_num = new_num;
+	}
+
+	return &trace->irqs[num];
+}
+
+/*--------------------------------------------------------- */
+static trace_t *trace_new(FILE *file)
+{
+	trace_t *trace;
+
+	trace = malloc(sizeof(*trace));
+	assert(trace);
+	memset(trace, 0, sizeof(*trace));
+	trace->file = file;
+
+	return trace;
+}
+
+/*--------------------------------------------------------- */
+static void trace_reset(trace_t *trace)
+{
+	trace->now = 0;
+	trace->cpus_hash = 0;
+	memset(trace->load_all, 0, sizeof(trace->load_all));
+	memset(trace->load_irq, 0, sizeof(trace->load_irq));
+	if (trace->irqs)
+		memset(trace->irqs, 0, trace->irqs_num * sizeof(*trace->irqs));
+}
+
+/*--------------------------------------------------------- */
+/* Open trace for appending. The start record contains balancing
+   parameters. The existing trace of another version or for another
+   NR_CPUS is not appended. */
+trace_t *trace_open(const char *fname, cycle_t *cycle)
+{
+	FILE *file;
+	trace_t *trace;
+	char magic[sizeof(TRACE_MAGIC)];
+	unsigned long long version, nr_cpus;
+
+	if (!(file = fopen(fname, "a+")))
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) != 0) {
+		rewind(file);
+		if ((fread(magic, 1, sizeof(magic), file) != sizeof(magic)) ||
+			memcmp(magic, TRACE_MAGIC, sizeof(magic)) ||
+			(get_varint(file, &version) < 0) ||
+			(version != TRACE_VERSION) ||
+			(get_varint(file, &nr_cpus) < 0) || (nr_cpus != NR_CPUS)) {
+			fclose(file);
+			errno = EINVAL;
+			return NULL;
+		}
+		fseek(file, 0, SEEK_END);
+	} else {
+		fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file);
+		put_varint(file, TRACE_VERSION);
+		put_varint(file, NR_CPUS);
+	}
+	trace = trace_new(file);
+
+	put_varint(file, TRACE_REC_START);
+	put_varint(file, (unsigned long long)(cycle->threshold * 100));
+	put_varint(file, (unsigned long long)(cycle->load_limit * 100));
+	put_varint(file, cycle->strategy);
+	put_varint(file, cycle->cooldown);
+	fflush(file);
+
+	return trace;
+}
+
+/*--------------------------------------------------------- */
+void trace_close(trace_t *trace)
+{
+	if (!trace)
+		return;
+	if (trace->file)
+		fclose(trace->file);
+	free(trace->irqs);
+	free(trace);
+}
+
+/*--------------------------------------------------------- */
+/* Write cycle record. It must be called after balance() but before
+   apply_affinity(). The seed is a seed of random generator used
+   for the cycle's decisions. */
+int trace_write_cycle(trace_t *trace, cycle_t *cycle,
+	unsigned long long now, unsigned int seed)
+{
+	FILE *f = trace->file;
+	FILE *mem;
+	char *buf = NULL;
+	size_t size = 0;
+	lub_list_node_t *iter;
+	unsigned int num;
+	unsigned int prev_id;
+	unsigned long long h;
+	cpumask_t cpus;
+
+	put_varint(f, TRACE_REC_CYCLE);
+	put_varint(f, (now > trace->now) ? (now - trace->now) : 0);
+	trace->now = now;
+	put_varint(f, seed);
+
+	/* CPU counters */
+	if (!(mem = open_memstream(&buf, &size)))
+		return -1;
+	num = 0;
+	prev_id = 0;
+	for (iter = lub_list_iterator_init(cycle->cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		if ((cpu->old_load_all == trace->load_all[cpu->id]) &&
+			(cpu->old_load_irq == trace->load_irq[cpu->id]))
+			continue;
+		put_varint(mem, cpu->id - prev_id);
+		put_zigzag(mem, cpu->old_load_all - trace->load_all[cpu->id]);
+		put_zigzag(mem, cpu->old_load_irq - trace->load_irq[cpu->id]);
+		trace->load_all[cpu->id] = cpu->old_load_all;
+		trace->load_irq[cpu->id] = cpu->old_load_irq;
+		prev_id = cpu->id;
+		num++;
+	}
+	fclose(mem);
+	put_varint(f, num);
+	fwrite(buf, 1, size, f);
+	free(buf);
+	buf = NULL;
+
+	/* IRQs */
+	if (!(mem = open_memstream(&buf, &size)))
+		return -1;
+	num = 0;
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		trace_irq_t *t = trace_irq(trace, irq->irq);
+		unsigned int flags = 0;
+
+		t->seen = 1;
+		if ((h = hash_desc(irq)) != t->desc_hash || !t->present)
+			flags |= TRACE_IRQ_DESC;
+		t->desc_hash = h;
+		if ((h = hash_cpumask(&irq->affinity)) != t->affinity_hash ||
+			!t->present)
+			flags |= TRACE_IRQ_AFFINITY;
+		t->affinity_hash = h;
+		if ((h = hash_cpumask(&irq->local_cpus)) != t->local_hash ||
+			!t->present)
+			flags |= TRACE_IRQ_LOCAL;
+		t->local_hash = h;
+		if ((h = hash_cpumask(&irq->hint)) != t->hint_hash ||
+			!t->present)
+			flags |= TRACE_IRQ_HINT;
+		t->hint_hash = h;
+		if ((h = hash_cpumask(&irq->consumer_cpus)) != t->consumer_hash ||
+			!t->present)
+			flags |= TRACE_IRQ_CONSUMER;
+		t->consumer_hash = h;
+		if (!flags && (irq->old_intr == t->intr) &&
+			(irq->blacklisted == t->blacklisted) &&
+			((!irq_movable(irq)) == t->held))
+			continue;
+		if (irq->blacklisted)
+			flags |= TRACE_IRQ_BLACKLISTED;
+		if (!irq_movable(irq))
+			flags |= TRACE_IRQ_HELD;
+
+		put_varint(mem, irq->irq);
+		put_varint(mem, flags);
+		put_zigzag(mem, irq->old_intr - t->intr);
+		if (flags & TRACE_IRQ_DESC) {
+			put_string(mem, irq->type);
+			put_string(mem, irq->desc);
+		}
+		if (flags & TRACE_IRQ_AFFINITY)
+			put_cpumask(mem, &irq->affinity);
+		if (flags & TRACE_IRQ_LOCAL)
+			put_cpumask(mem, &irq->local_cpus);
+		if (flags & TRACE_IRQ_HINT)
+			put_cpumask(mem, &irq->hint);
+		if (flags & TRACE_IRQ_CONSUMER)
+			put_cpumask(mem, &irq->consumer_cpus);
+		t->present = 1;
+		t->intr = irq->old_intr;
+		t->blacklisted = irq->blacklisted;
+		t->held = !irq_movable(irq);
+		num++;
+	}
+	/* Disappeared IRQs */
+	for (prev_id = 0; prev_id < trace->irqs_num; prev_id++) {
+		trace_irq_t *t = &trace->irqs[prev_id];
+		if (t->present && !t->seen) {
+			put_varint(mem, prev_id);
+			put_varint(mem, TRACE_IRQ_REMOVED);
+			put_zigzag(mem, 0);
+			memset(t, 0, sizeof(*t));
+			num++;
+		}
+		t->seen = 0;
+	}
+	fclose(mem);
+	put_varint(f, num);
+	fwrite(buf, 1, size, f);
+	free(buf);
+
+	/* Set of CPUs. Written on change only. The zero means there is
+	   no change. */
+	cpus_init(cpus);
+	cpus_clear(cpus);
+	for (iter = lub_list_iterator_init(cycle->cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		cpu_set(cpu->id, cpus);
+	}
+	if ((h = hash_cpumask(&cpus)) != trace->cpus_hash) {
+		put_varint(f, 1);
+		put_cpumask(f, &cpus);
+		trace->cpus_hash = h;
+	} else {
+		put_varint(f, 0);
+	}
+	cpus_free(cpus);
+
+	/* Decisions. The CPU ID is written as ID + 1. Zero means
+	   the IRQ has no CPU. */
+	put_varint(f, lub_list_len(cycle->balance_irqs));
+	for (iter = lub_list_iterator_init(cycle->balance_irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		put_varint(f, irq->irq);
+		put_varint(f, irq->cpu ? irq->cpu->id + 1 : 0);
+	}
+	fflush(f);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+static int replay_start(FILE *f, cycle_t *cycle)
+{
+	unsigned long long threshold, load_limit, strategy, cooldown;
+
+	if (get_varint(f, &threshold) < 0 ||
+		get_varint(f, &load_limit) < 0 ||
+		get_varint(f, &strategy) < 0 ||
+		get_varint(f, &cooldown) < 0)
+		return -1;
+	cycle->threshold = (float)threshold / 100;
+	cycle->load_limit = (float)load_limit / 100;
+	cycle->strategy = strategy;
+	cycle->cooldown = cooldown;
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Apply recorded set of CPUs. The removed CPUs are handled like
+   cycle_hotplug() does. Returns -1 on error. */
+static int replay_cpus(FILE *f, trace_t *trace, cycle_t *cycle)
+{
+	unsigned long long changed;
+	lub_list_node_t *iter;
+	cpumask_t cpus;
+	unsigned int id;
+
+	if (trace->version < 3)
+		return 0;
+	if (get_varint(f, &changed) < 0)
+		return -1;
+	if (!changed)
+		return 0;
+	cpus_init(cpus);
+	if (get_cpumask(f, &cpus) < 0) {
+		cpus_free(cpus);
+		return -1;
+	}
+	iter = lub_list_iterator_init(cycle->cpus);
+	while (iter) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		iter = lub_list_iterator_next(iter);
+		if (!cpu_isset(cpu->id, cpus))
+			cycle_cpu_offline(cycle, cpu);
+	}
+	for (id = first_cpu(cpus); id < NR_CPUS; id = next_cpu(id, cpus))
+		cpu_list_add_id(cycle->cpus, id);
+	cpu_list_index(cycle->cpus, cycle->cpu_index);
+	cpus_free(cpus);
+
+	return 0;
+}
+
+/*--------------------------------------------------------- */
+/* Feed the cycle record to decision code. Returns number of decisions
+   differ from recorded ones or -1 on error. */
+static int replay_cycle(FILE *f, trace_t *trace, cycle_t *cycle,
+	unsigned int cycle_num, FILE *out)
+{
+	unsigned long long dt, seed, num, val;
+	unsigned int id = 0;
+	lub_list_node_t *iter;
+	lub_list_node_t *node;
+	int mismatch = 0;
+	unsigned int cpus_num = lub_list_len(cycle->cpus);
+
+	if (get_varint(f, &dt) < 0 || get_varint(f, &seed) < 0)
+		return -1;
+	trace->now += dt;
+
+	/* CPU counters */
+	if (get_varint(f, &num) < 0)
+		return -1;
+	while (num--) {
+		long long d_all, d_irq;
+		if (get_varint(f, &val) < 0 || get_zigzag(f, &d_all) < 0 ||
+			get_zigzag(f, &d_irq) < 0)
+			return -1;
+		id += val;
+		if (id >= NR_CPUS)
+			return -1;
+		cpu_list_add_id(cycle->cpus, id);
+		trace->load_all[id] += d_all;
+		trace->load_irq[id] += d_irq;
+	}
+	if (lub_list_len(cycle->cpus) != cpus_num)
+		cpu_list_index(cycle->cpus, cycle->cpu_index);
+
+	/* IRQs */
+	if (get_varint(f, &num) < 0)
+		return -1;
+	while (num--) {
+		unsigned long long irq_num, flags;
+		long long d_intr;
+		trace_irq_t *t;
+		irq_t *irq;
+
+		if (get_varint(f, &irq_num) < 0 ||
+			get_varint(f, &flags) < 0 ||
+			get_zigzag(f, &d_intr) < 0)
+			return -1;
+		t = trace_irq(trace, irq_num);
+		if (flags & TRACE_IRQ_REMOVED) {
+			memset(t, 0, sizeof(*t));
+			continue;
+		}
+		if (!(irq = irq_list_search(cycle->irqs, irq_num))) {
+			irq = irq_list_add(cycle->irqs, irq_num);
+			printf("Add IRQ %3u\n", irq->irq);
+		}
+		t->present = 1;
+		t->intr += d_intr;
+		if (irq->blacklisted != !!(flags & TRACE_IRQ_BLACKLISTED)) {
+			irq->blacklisted = !irq->blacklisted;
+			irq_changed(irq);
+		}
+		/* The replay doesn't verify moves. So the pinned and stuck
+		   IRQs are the same for it. */
+		irq->pinned = (flags & TRACE_IRQ_HELD) ? 1 : 0;
+		if (flags & TRACE_IRQ_DESC) {
+			free(irq->type);
+			free(irq->desc);
+			irq->type = get_string(f);
+			irq->desc = get_string(f);
+			if (!irq->type || !irq->desc)
+				return -1;
+		}
+		if (flags & TRACE_IRQ_AFFINITY) {
+			if (get_cpumask(f, &irq->affinity) < 0)
+				return -1;
+			irq_changed(irq);
+		}
+		if ((flags & TRACE_IRQ_LOCAL) &&
+			get_cpumask(f, &irq->local_cpus) < 0)
+			return -1;
+		if ((flags & TRACE_IRQ_HINT) &&
+			get_cpumask(f, &irq->hint) < 0)
+			return -1;
+		if ((flags & TRACE_IRQ_CONSUMER) &&
+			get_cpumask(f, &irq->consumer_cpus) < 0)
+			return -1;
+	}
+
+	/* The same as scan_irqs() */
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		irq->refresh = trace_irq(trace, irq->irq)->present;
+		if (!irq->refresh || irq->blacklisted)
+			continue;
+		if (irq_need_balance(irq))
+			lub_list_add(cycle->balance_irqs, irq);
+	}
+	irq_list_remove_stale(cycle->irqs);
+	/* The same as cycle_hotplug() */
+	if (replay_cpus(f, trace, cycle) < 0)
+		return -1;
+	link_irqs_to_cpus(cycle->cpu_index);
+
+	/* The same as gather_statistics() */
+	for (iter = lub_list_iterator_init(cycle->cpus); iter;
+		iter = lub_list_iterator_next(iter)) {
+		cpu_t *cpu = (cpu_t *)lub_list_node__get_data(iter);
+		cpu_update_load(cpu, trace->load_all[cpu->id],
+			trace->load_irq[cpu->id], 0, trace->now);
+	}
+	for (iter = lub_list_iterator_init(cycle->irqs); iter;
+		iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		irq_update_intr(irq, trace_irq(trace, irq->irq)->intr,
+			trace->now);
+	}
+
+	/* Decisions */
+	srand(seed);
+	choose_irqs_to_move(cycle->cpus, cycle->balance_irqs,
+		cycle->threshold, cycle->strategy, cycle->cooldown, trace->now);
+	/* The consumer CPUs are recorded. The IRQs without consumer
+	   are skipped by choose_consumer_irqs(). */
+	choose_consumer_irqs(cycle->cpus, cycle->irqs, cycle->balance_irqs,
+		cycle->load_limit, cycle->cooldown, trace->now);
+	if (lub_list_len(cycle->balance_irqs) != 0)
+		balance(cycle->cpus, cycle->balance_irqs, cycle->load_limit,
+			cycle->cooldown, trace->now);
+
+	/* Compare with recorded decisions */
+	if (get_varint(f, &num) < 0)
+		return -1;
+	iter = lub_list_iterator_init(cycle->balance_irqs);
+	while (num--) {
+		unsigned long long irq_num, cpu_id;
+		irq_t *irq = NULL;
+		if (get_varint(f, &irq_num) < 0 || get_varint(f, &cpu_id) < 0)
+			return -1;
+		if (iter) {
+			irq = (irq_t *)lub_list_node__get_data(iter);
+			iter = lub_list_iterator_next(iter);
+		}
+		if (irq && (irq->irq == irq_num) &&
+			((irq->cpu ? irq->cpu->id + 1 : 0) == cpu_id))
+			continue;
+		fprintf(out, "Mismatch: cycle %u: recorded IRQ %llu to CPU%lld, "
+			"replayed ", cycle_num, irq_num, (long long)cpu_id - 1);
+		if (irq)
+			fprintf(out, "IRQ %u to CPU%d\n", irq->irq,
+				irq->cpu ? (int)irq->cpu->id : -1);
+		else
+			fprintf(out, "nothing\n");
+		mismatch++;
+	}
+	for (; iter; iter = lub_list_iterator_next(iter)) {
+		irq_t *irq = (irq_t *)lub_list_node__get_data(iter);
+		fprintf(out, "Mismatch: cycle %u: recorded nothing, "
+			"replayed IRQ %u to CPU%d\n", cycle_num, irq->irq,
+			irq->cpu ? (int)irq->cpu->id : -1);
+		mismatch++;
+	}
+	while ((node = lub_list__get_tail(cycle->balance_irqs))) {
+		lub_list_del(cycle->balance_irqs, node);
+		lub_list_node_free(node);
+	}
+
+	return mismatch;
+}
+
+/*--------------------------------------------------------- */
+/* Replay trace. Returns number of mismatched decisions or -1
+   on error. */
+int trace_replay(const char *fname, FILE *out)
+{
+	FILE *f;
+	char magic[sizeof(TRACE_MAGIC)];
+	unsigned long long val;
+	unsigned long long version;
+	trace_t *trace;
+	cycle_t *cycle = NULL;
+	unsigned int cycle_num = 0;
+	int mismatch = 0;
+	int ret = -1;
+
+	if (!(f = fopen(fname, "r"))) {
+		fprintf(stderr, "Error: Can't open trace %s\n", fname);
+		return -1;
+	}
+	if ((fread(magic, 1, sizeof(magic), f) != sizeof(magic)) ||
+		memcmp(magic, TRACE_MAGIC, sizeof(magic)) ||
+		(get_varint(f, &version) < 0) || (version < 1) ||
+		(version > TRACE_VERSION) ||
+		(get_varint(f, &val) < 0) || (val != NR_CPUS)) {
+		fprintf(stderr, "Error: Illegal trace file %s\n", fname);
+		fclose(f);
+		return -1;
+	}
+	trace = trace_new(NULL);
+	trace->version = version;
+
+	while (get_varint(f, &val) == 0) {
+		if (val == TRACE_REC_START) {
+			/* Daemon was restarted. Start from scratch. */
+			cycle_free(cycle);
+			cycle = cycle_new();
+			trace_reset(trace);
+			if (replay_start(f, cycle) < 0)
+				goto err;
+		} else if ((val == TRACE_REC_CYCLE) && cycle) {
+			int res = replay_cycle(f, trace, cycle, cycle_num, out);
+			if (res < 0)
+				goto err;
+			mismatch += res;
+			cycle_num++;
+		} else {
+			goto err;
+		}
+	}
+	fprintf(out, "Replayed cycles: %u, mismatched decisions: %d\n",
+		cycle_num, mismatch);
+	ret = mismatch;
+err:
+	if (ret < 0)
+		fprintf(stderr, "Error: Broken trace %s after %u cycles\n",
+			fname, cycle_num);
+	cycle_free(cycle);
+	trace_close(trace);
+	fclose(f);
+
+	return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef _trace_h
+#define _trace_h
+
+#include <stdio.h>
+#include "cpumask.h"
+
+#define TRACE_MAGIC "BIRQTRC"
+/* Version 1 has no affinity hints. Version 2 has no CPU set.
+   Version 3 has no consumer CPUs. */
+#define TRACE_VERSION 4
+
+/* Record types */
+#define TRACE_REC_START 1 /* Daemon start. Resets the delta state */
+#define TRACE_REC_CYCLE 2 /* Balancing cycle */
+
+/* IRQ entry flags */
+#define TRACE_IRQ_REMOVED 0x01 /* IRQ disappeared */
+#define TRACE_IRQ_DESC 0x02 /* Type and description follow */
+#define TRACE_IRQ_AFFINITY 0x04 /* Affinity mask follows */
+#define TRACE_IRQ_LOCAL 0x08 /* Local CPUs mask follows */
+#define TRACE_IRQ_BLACKLISTED 0x10 /* IRQ is blacklisted */
+#define TRACE_IRQ_HELD 0x20 /* IRQ is pinned or stuck. It is not moved */
+#define TRACE_IRQ_HINT 0x40 /* Affinity hint mask follows */
+#define TRACE_IRQ_CONSUMER 0x80 /* Consumer CPUs mask follows */
+
+/* Writer's state of IRQ for delta encoding */
+struct trace_irq_s {
+	int present;
+	int seen; /* IRQ is found within current cycle */
+	int blacklisted;
+	int held;
+	unsigned long long intr;
+	unsigned long long desc_hash;
+	unsigned long long affinity_hash;
+	unsigned long long local_hash;
+	unsigned long long hint_hash;
+	unsigned long long consumer_hash;
+};
+typedef struct trace_irq_s trace_irq_t;
+
+struct trace_s {
+	FILE *file;
+	unsigned int version; /* Version of replayed trace */
+	unsigned long long now; /* Time of previous cycle */
+	unsigned long long cpus_hash; /* Listed CPUs of previous cycle */
+	unsigned long long load_all[NR_CPUS];
+	unsigned long long load_irq[NR_CPUS];
+	trace_irq_t *irqs; /* Indexed by IRQ number */
+	unsigned int irqs_num; /* Size of irqs array */
+};
+typedef struct trace_s trace_t;
+
+/* The cycle.h includes trace.h */
+struct cycle_s;
+
+trace_t *trace_open(const char *fname, struct cycle_s *cycle);
+void trace_close(trace_t *trace);
+int trace_write_cycle(trace_t *trace, struct cycle_s *cycle,
+	unsigned long long now, unsigned int seed);
+int trace_replay(const char *fname, FILE *out);
+
+#endif